@@ -16,8 +16,15 @@
 // request header, ulong term (8), msg_type type (1), int32 src (4), int32 dst (4), ulong last_log_term (8), ulong last_log_idx (8), ulong commit_idx (8) + one int32 (4) for log data size 
 #define RPC_REQ_HEADER_SIZE 3 * 4 + 8 * 4 + 1
  
-// response header ulong term (8), msg_type type (1), int32 src (4), int32 dst (4), ulong next_idx (8), bool accepted (1)
+// response header ulong term (8), msg_type type (1), int32 src (4), int32 dst (4), ulong next_idx (8), byte flags (1),
+// the lowest bit of flags is accepted, which is the bool that the versions without the flags send
 #define RPC_RESP_HEADER_SIZE 4 * 2 + 8 * 2 + 2
+#define RPC_RESP_ACCEPTED 0x01
+
+// a rejected response with the conflict hints has this flag set, and ulong conflict_term (8), ulong conflict_idx (8)
+// follow the header, the other responses are the same as the ones of the versions without the hints
+#define RPC_RESP_HAS_HINTS 0x02
+#define RPC_RESP_HINTS_SIZE 8 * 2
 
 namespace cornerstone {
 
@@ -100,7 +107,7 @@ namespace cornerstone {
     class rpc_session {
     private:
         rpc_session(asio::io_service& io, ptr<msg_handler>& handler, logger& logger, session_closed_callback& callback)
-            : handler_(handler), socket_(io), log_data_(), header_(buffer::alloc(RPC_REQ_HEADER_SIZE)), l_(logger), callback_(callback) {}
+            : io_(io), handler_(handler), socket_(io), log_data_(), header_(buffer::alloc(RPC_REQ_HEADER_SIZE)), l_(logger), callback_(callback) {}
 
         __nocopy__(rpc_session)
 
@@ -126,6 +133,7 @@ namespace cornerstone {
 
                     if (data_size == 0) {
                         this->read_complete();
+                        return;
                     }
 
                     this->log_data_ = buffer::alloc((size_t)data_size);
@@ -187,30 +195,17 @@ namespace cornerstone {
                     }
                 }
 
-                ptr<resp_msg> resp = handler_->process_req(*req);
-                if (resp) {
-                    l_.err("no response is returned from raft message handler, potential system bug");
-                    this->stop();
-                }
-                else {
-                    ptr<buffer> resp_buf(buffer::alloc(RPC_RESP_HEADER_SIZE));
-                    resp_buf->put((byte)resp->get_type());
-                    resp_buf->put(resp->get_src());
-                    resp_buf->put(resp->get_dst());
-                    resp_buf->put(resp->get_term());
-                    resp_buf->put(resp->get_next_idx());
-                    resp_buf->put((byte)resp->get_accepted());
-                    resp_buf->pos(0);
-                    asio::async_write(socket_, asio::buffer(resp_buf->data(), RPC_RESP_HEADER_SIZE), [this, self](asio::error_code err_code, size_t) -> void {
-                        if (!err_code) {
-                            this->start();
-                        }
-                        else {
-                            this->l_.err(lstrfmt("failed to send response to peer due to error %d").fmt(err_code.value()));
-                            this->stop();
-                        }
+                // the response is written once it's ready, which could be after the log entries are durable,
+                // the next request is read after that, the rpc thread is not blocked meanwhile, the result could be
+                // set by the thread of the event loop or of the log store, so the write is posted back to asio
+                async_result<ptr<resp_msg>>::handler_type handler = [this, self](ptr<resp_msg>& resp, ptr<std::exception>& err) -> void {
+                    this->io_.post([this, self, resp, err]() -> void {
+                        ptr<resp_msg> r(resp);
+                        ptr<std::exception> e(err);
+                        this->write_resp(r, e);
                     });
-                }
+                };
+                handler_->process_req_async(req)->when_ready(handler);
             }
             catch (std::exception& ex) {
                 l_.err(lstrfmt("failed to process request message due to error: %s").fmt(ex.what()));
@@ -218,9 +213,49 @@ namespace cornerstone {
             }
         }
 
+        void write_resp(ptr<resp_msg>& resp, ptr<std::exception>& err) {
+            ptr<rpc_session> self = cs_safe(this);
+            if (err) {
+                l_.err(lstrfmt("failed to process request message due to error: %s").fmt(err->what()));
+                this->stop();
+                return;
+            }
+
+            if (!resp) {
+                l_.err("no response is returned from raft message handler, potential system bug");
+                this->stop();
+                return;
+            }
+
+            bool has_hints = !resp->get_accepted() && resp->get_conflict_term() > 0;
+            ptr<buffer> resp_buf(buffer::alloc(RPC_RESP_HEADER_SIZE + (has_hints ? RPC_RESP_HINTS_SIZE : 0)));
+            resp_buf->put((byte)resp->get_type());
+            resp_buf->put(resp->get_src());
+            resp_buf->put(resp->get_dst());
+            resp_buf->put(resp->get_term());
+            resp_buf->put(resp->get_next_idx());
+            resp_buf->put((byte)((resp->get_accepted() ? RPC_RESP_ACCEPTED : 0) | (has_hints ? RPC_RESP_HAS_HINTS : 0)));
+            if (has_hints) {
+                resp_buf->put(resp->get_conflict_term());
+                resp_buf->put(resp->get_conflict_idx());
+            }
+
+            resp_buf->pos(0);
+            asio::async_write(socket_, asio::buffer(resp_buf->data(), resp_buf->size()), [this, self, resp_buf](asio::error_code err_code, size_t) -> void {
+                if (!err_code) {
+                    this->start();
+                }
+                else {
+                    this->l_.err(lstrfmt("failed to send response to peer due to error %d").fmt(err_code.value()));
+                    this->stop();
+                }
+            });
+        }
+
     public:
         friend ptr<rpc_session> cs_new<rpc_session, asio::io_service&, ptr<msg_handler>&, logger&, session_closed_callback& >(asio::io_service&, ptr<msg_handler>&, logger&, session_closed_callback&);
     private:
+        asio::io_service& io_;
         ptr<msg_handler> handler_;
         asio::ip::tcp::socket socket_;
         ptr<buffer> log_data_;
@@ -282,115 +317,247 @@ namespace cornerstone {
         logger& l_;
     };
 
+    // the client writes the requests one after another without waiting for the responses, so that the requests
+    // could be pipelined, the session serves the requests of a connection in order, so the responses are read
+    // back in the order the requests were written
     class asio_rpc_client : public rpc_client {
+    private:
+        struct pending_rpc {
+            pending_rpc(ptr<req_msg>& req, rpc_handler& when_done, ptr<buffer>& buf)
+                : req_(req), when_done_(when_done), buf_(buf) {}
+
+            ptr<req_msg> req_;
+            rpc_handler when_done_;
+            ptr<buffer> buf_;
+        };
     private:
         asio_rpc_client(asio::io_service& io_svc, std::string& host, std::string& port)
-            : io_svc_(io_svc), socket_(io_svc), host_(host), port_(port){}
+            : io_svc_(io_svc), strand_(io_svc), socket_(io_svc), host_(host), port_(port), write_queue_(), read_queue_(), writing_(false), reading_(false), conn_gen_(0) {}
     public:
         virtual void send(ptr<req_msg>& req, rpc_handler& when_done) __override__ {
+            // serialize req, the log entries are serialized straight into the request buffer
+            int32 log_data_size(0);
+            for (std::vector<ptr<log_entry>>::const_iterator it = req->log_entries().begin();
+                it != req->log_entries().end(); 
+                ++it) {
+                log_data_size += (int32)(8 + 1 + 4 + (*it)->get_buf().size());
+            }
+
+            ptr<buffer> req_buf(buffer::alloc(RPC_REQ_HEADER_SIZE + log_data_size));
+            req_buf->put((byte)req->get_type());
+            req_buf->put(req->get_src());
+            req_buf->put(req->get_dst());
+            req_buf->put(req->get_term());
+            req_buf->put(req->get_last_log_term());
+            req_buf->put(req->get_last_log_idx());
+            req_buf->put(req->get_commit_idx());
+            req_buf->put(log_data_size);
+            for (std::vector<ptr<log_entry>>::const_iterator it = req->log_entries().begin();
+                it != req->log_entries().end();
+                ++it) {
+                req_buf->put((*it)->get_term());
+                req_buf->put((byte)((*it)->get_val_type()));
+                req_buf->put((int32)(*it)->get_buf().size());
+                (*it)->get_buf().pos(0);
+                req_buf->put((*it)->get_buf());
+            }
+
+            req_buf->pos(0);
+
+            // the queues and the socket are only touched on the strand of the client
             ptr<asio_rpc_client> self(cs_safe(this));
+            pending_rpc rpc(req, when_done, req_buf);
+            strand_.post([self, rpc]() mutable -> void {
+                self->enqueue(rpc);
+            });
+        }
+    private:
+        void enqueue(pending_rpc& rpc) {
+            write_queue_.push(rpc);
+
+            // the request is written after the ones in front of it
+            if (writing_) {
+                return;
+            }
+
+            writing_ = true;
             if (!socket_.is_open()) {
-                asio::ip::tcp::resolver r(io_svc_);
-                r.async_resolve(host_, port_, [self, this, &req, &when_done](std::error_code err, asio::ip::tcp::resolver::iterator itor) -> void {
-                    if (!err) {
-                        asio::async_connect(socket_, itor, std::bind(&asio_rpc_client::connected, self, req, when_done, std::placeholders::_1, std::placeholders::_2));
-                    }
-                    else {
-                        ptr<resp_msg> rsp;
-                        ptr<rpc_exception> except(cs_new<rpc_exception>(lstrfmt("failed to resolve host %s").fmt(host_.c_str()), req));
-                        when_done(rsp, except);
-                    }
-                });
-            }else{
-                // serialize req, send and read response
-                std::vector<ptr<buffer>> log_entry_bufs;
-                int32 log_data_size(0);
-                for (std::vector<ptr<log_entry>>::const_iterator it = req->log_entries().begin();
-                    it != req->log_entries().end(); 
-                    ++it) {
-                    ptr<buffer> entry_buf(buffer::alloc(8 + 1 + 4 + (*it)->get_buf().size()));
-                    entry_buf->put((*it)->get_term());
-                    entry_buf->put((byte)((*it)->get_val_type()));
-                    entry_buf->put((int32)(*it)->get_buf().size());
-                    (*it)->get_buf().pos(0);
-                    entry_buf->put((*it)->get_buf());
-                    entry_buf->pos(0);
-                    log_entry_bufs.push_back(entry_buf);
-                    log_data_size += (int32)entry_buf->size();
-                }
+                connect();
+            }
+            else {
+                write_next(conn_gen_);
+            }
+        }
 
-                ptr<buffer> req_buf(buffer::alloc(RPC_REQ_HEADER_SIZE + log_data_size));
-                req_buf->put((byte)req->get_type());
-                req_buf->put(req->get_src());
-                req_buf->put(req->get_dst());
-                req_buf->put(req->get_term());
-                req_buf->put(req->get_last_log_term());
-                req_buf->put(req->get_last_log_idx());
-                req_buf->put(req->get_commit_idx());
-                req_buf->put(log_data_size);
-                for (std::vector<ptr<buffer>>::const_iterator it = log_entry_bufs.begin();
-                    it != log_entry_bufs.end();
-                    ++it) {
-                    req_buf->put(*(*it));
-                }
+        void connect() {
+            ulong gen = ++conn_gen_;
+            ptr<asio_rpc_client> self(cs_safe(this));
+            asio::ip::tcp::resolver r(io_svc_);
+            r.async_resolve(host_, port_, strand_.wrap(std::bind(&asio_rpc_client::resolved, self, gen, std::placeholders::_1, std::placeholders::_2)));
+        }
 
-                req_buf->pos(0);
+        // the handlers of a connection that is already closed must not touch the socket of the one after it
+        bool stale(ulong gen, const asio::error_code& err) const {
+            return gen != conn_gen_ || err == asio::error::operation_aborted;
+        }
+
+        void resolved(ulong gen, asio::error_code err, asio::ip::tcp::resolver::iterator itor) {
+            if (stale(gen, err)) {
+                return;
+            }
 
-                asio::async_write(socket_, asio::buffer(req_buf->data(), req_buf->size()), std::bind(&asio_rpc_client::sent, self, req, when_done, std::placeholders::_1, std::placeholders::_2));
+            if (err) {
+                fail_all(lstrfmt("failed to resolve host %s").fmt(host_.c_str()));
+                return;
             }
+
+            ptr<asio_rpc_client> self(cs_safe(this));
+            asio::async_connect(socket_, itor, strand_.wrap(std::bind(&asio_rpc_client::connected, self, gen, std::placeholders::_1, std::placeholders::_2)));
         }
-    private:
-        void connected(ptr<req_msg>& req, rpc_handler& when_done, std::error_code err, asio::ip::tcp::resolver::iterator itor) {
-            if (!err) {
-                this->send(req, when_done);
+
+        void connected(ulong gen, asio::error_code err, asio::ip::tcp::resolver::iterator itor) {
+            if (stale(gen, err)) {
+                return;
             }
-            else {
-                ptr<resp_msg> rsp;
-                ptr<rpc_exception> except(cs_new<rpc_exception>("failed to connect to remote socket", req));
-                when_done(rsp, except);
+
+            if (err) {
+                fail_all("failed to connect to remote socket");
+                return;
             }
+
+            write_next(gen);
         }
 
-        void sent(ptr<req_msg>& req, rpc_handler& when_done, std::error_code err, size_t bytes_transferred) {
+        void write_next(ulong gen) {
+            if (write_queue_.empty()) {
+                writing_ = false;
+                return;
+            }
+
             ptr<asio_rpc_client> self(cs_safe(this));
-            if (!err) {
-                // read a response
-                ptr<buffer> resp_buf(buffer::alloc(RPC_RESP_HEADER_SIZE));
-                asio::async_read(socket_, asio::buffer(resp_buf->data(), resp_buf->size()), std::bind(&asio_rpc_client::response_read, self, req, when_done, resp_buf, std::placeholders::_1, std::placeholders::_2));
+            ptr<buffer> req_buf(write_queue_.front().buf_);
+            asio::async_write(socket_, asio::buffer(req_buf->data(), req_buf->size()), strand_.wrap(std::bind(&asio_rpc_client::sent, self, gen, std::placeholders::_1, std::placeholders::_2)));
+        }
+
+        void sent(ulong gen, asio::error_code err, size_t bytes_transferred) {
+            if (stale(gen, err)) {
+                return;
             }
-            else {
-                ptr<resp_msg> rsp;
-                ptr<rpc_exception> except(cs_new<rpc_exception>("failed to send request to remote socket", req));
-                socket_.close();
-                when_done(rsp, except);
+
+            if (err) {
+                fail_all("failed to send request to remote socket");
+                return;
             }
+
+            read_queue_.push(write_queue_.front());
+            write_queue_.pop();
+            if (!reading_) {
+                reading_ = true;
+                read_next(gen);
+            }
+
+            write_next(gen);
         }
 
-        void response_read(ptr<req_msg>& req, rpc_handler& when_done, ptr<buffer>& resp_buf, std::error_code err, size_t bytes_transferred) {
-            if (!err) {
-                byte msg_type_val = resp_buf->get_byte();
-                int32 src = resp_buf->get_int();
-                int32 dst = resp_buf->get_int();
-                ulong term = resp_buf->get_ulong();
-                ulong nxt_idx = resp_buf->get_ulong();
-                byte accepted_val = resp_buf->get_byte();
-                ptr<resp_msg> rsp(cs_new<resp_msg>(term, (msg_type)msg_type_val, src, dst, nxt_idx, accepted_val == 1));
-                ptr<rpc_exception> except;
-                when_done(rsp, except);
+        void read_next(ulong gen) {
+            if (read_queue_.empty()) {
+                reading_ = false;
+                return;
             }
-            else {
+
+            // read a response
+            ptr<asio_rpc_client> self(cs_safe(this));
+            ptr<buffer> resp_buf(buffer::alloc(RPC_RESP_HEADER_SIZE));
+            asio::async_read(socket_, asio::buffer(resp_buf->data(), resp_buf->size()), strand_.wrap(std::bind(&asio_rpc_client::response_read, self, gen, resp_buf, std::placeholders::_1, std::placeholders::_2)));
+        }
+
+        void response_read(ulong gen, ptr<buffer>& resp_buf, asio::error_code err, size_t bytes_transferred) {
+            if (stale(gen, err)) {
+                return;
+            }
+
+            if (err) {
+                fail_all("failed to read response to remote socket");
+                return;
+            }
+
+            byte msg_type_val = resp_buf->get_byte();
+            int32 src = resp_buf->get_int();
+            int32 dst = resp_buf->get_int();
+            ulong term = resp_buf->get_ulong();
+            ulong nxt_idx = resp_buf->get_ulong();
+            byte flags = resp_buf->get_byte();
+            ptr<resp_msg> rsp(cs_new<resp_msg>(term, (msg_type)msg_type_val, src, dst, nxt_idx, (flags & RPC_RESP_ACCEPTED) != 0));
+            if ((flags & RPC_RESP_HAS_HINTS) != 0) {
+                // the response is done once the hints after the header are read
+                ptr<asio_rpc_client> self(cs_safe(this));
+                ptr<buffer> hints_buf(buffer::alloc(RPC_RESP_HINTS_SIZE));
+                asio::async_read(socket_, asio::buffer(hints_buf->data(), hints_buf->size()), strand_.wrap(std::bind(&asio_rpc_client::hints_read, self, gen, rsp, hints_buf, std::placeholders::_1, std::placeholders::_2)));
+                return;
+            }
+
+            response_done(gen, rsp);
+        }
+
+        void hints_read(ulong gen, ptr<resp_msg>& rsp, ptr<buffer>& hints_buf, asio::error_code err, size_t bytes_transferred) {
+            if (stale(gen, err)) {
+                return;
+            }
+
+            if (err) {
+                fail_all("failed to read response to remote socket");
+                return;
+            }
+
+            ulong conflict_term = hints_buf->get_ulong();
+            ulong conflict_idx = hints_buf->get_ulong();
+            rsp->set_conflict(conflict_term, conflict_idx);
+            response_done(gen, rsp);
+        }
+
+        void response_done(ulong gen, ptr<resp_msg>& rsp) {
+            rpc_handler when_done(read_queue_.front().when_done_);
+            read_queue_.pop();
+            ptr<rpc_exception> except;
+            when_done(rsp, except);
+            read_next(gen);
+        }
+
+        // the connection is broken, all the requests that are not responded fail,
+        // the handlers that are still outstanding on it see a newer generation and do nothing
+        void fail_all(const std::string& err_msg) {
+            conn_gen_ += 1;
+            asio::error_code ignored;
+            socket_.close(ignored);
+            std::queue<pending_rpc> failed;
+            for (; !read_queue_.empty(); read_queue_.pop()) {
+                failed.push(read_queue_.front());
+            }
+
+            for (; !write_queue_.empty(); write_queue_.pop()) {
+                failed.push(write_queue_.front());
+            }
+
+            writing_ = false;
+            reading_ = false;
+            for (; !failed.empty(); failed.pop()) {
                 ptr<resp_msg> rsp;
-                ptr<rpc_exception> except(cs_new<rpc_exception>("failed to read response to remote socket", req));
-                socket_.close();
-                when_done(rsp, except);
+                ptr<rpc_exception> except(cs_new<rpc_exception>(err_msg, failed.front().req_));
+                failed.front().when_done_(rsp, except);
             }
         }
 
     private:
         asio::io_service& io_svc_;
+        asio::io_service::strand strand_;
         asio::ip::tcp::socket socket_;
         std::string host_;
         std::string port_;
+        std::queue<pending_rpc> write_queue_;
+        std::queue<pending_rpc> read_queue_;
+        bool writing_;
+        bool reading_;
+        ulong conn_gen_;
 
     public:
         friend ptr<asio_rpc_client> cs_new<asio_rpc_client, asio::io_service&, std::string&, std::string&>(asio::io_service&, std::string&, std::string&);
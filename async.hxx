@@ -51,7 +51,7 @@ namespace cornerstone {
                 throw err_;
             }
 
-            cv_.wait(lock);
+            cv_.wait(lock, [this]() -> bool { return has_result_; });
             if (err_ == nullptr) {
                 return result_;
             }
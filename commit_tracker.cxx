@@ -0,0 +1,83 @@
+#include "cornerstone.hxx"
+
+using namespace cornerstone;
+
+void commit_tracker::add_voter(int32 id, int32 weight) {
+    size_t pos = position_of(id);
+    if (pos < voters_.size()) {
+        total_weight_ += weight - voters_[pos].weight_;
+        voters_[pos].weight_ = weight;
+    }
+    else {
+        voters_.push_back(voter(id, weight));
+        total_weight_ += weight;
+    }
+
+    recount();
+}
+
+void commit_tracker::remove_voter(int32 id) {
+    size_t pos = position_of(id);
+    if (pos < voters_.size()) {
+        total_weight_ -= voters_[pos].weight_;
+        voters_.erase(voters_.begin() + pos);
+        recount();
+    }
+}
+
+bool commit_tracker::update(int32 id, ulong matched_idx) {
+    size_t pos = position_of(id);
+    if (pos >= voters_.size() || voters_[pos].matched_idx_ == matched_idx) {
+        return false;
+    }
+
+    ulong old_idx = voters_[pos].matched_idx_;
+    voters_[pos].matched_idx_ = matched_idx;
+    for (; pos > 0 && voters_[pos - 1].matched_idx_ < matched_idx; --pos) {
+        std::swap(voters_[pos - 1], voters_[pos]);
+    }
+
+    for (; pos + 1 < voters_.size() && voters_[pos + 1].matched_idx_ > matched_idx; ++pos) {
+        std::swap(voters_[pos + 1], voters_[pos]);
+    }
+
+    // the quorum index stays if the voter is not counted, advances up to the quorum index or goes back not below it
+    if (voters_[pos].weight_ == 0 || (matched_idx > old_idx ? matched_idx <= quorum_idx_ : matched_idx >= quorum_idx_)) {
+        return false;
+    }
+
+    ulong last_quorum_idx = quorum_idx_;
+    recount();
+    return quorum_idx_ > last_quorum_idx;
+}
+
+void commit_tracker::reset() {
+    for (size_t i = 0; i < voters_.size(); ++i) {
+        voters_[i].matched_idx_ = 0;
+    }
+
+    quorum_idx_ = 0;
+}
+
+size_t commit_tracker::position_of(int32 id) const {
+    size_t pos = 0;
+    while (pos < voters_.size() && voters_[pos].id_ != id) {
+        ++pos;
+    }
+
+    return pos;
+}
+
+// the quorum index is the highest index that the voters with more than half of the weights have matched
+void commit_tracker::recount() {
+    int32 weight = 0;
+    for (size_t i = 0; i < voters_.size(); ++i) {
+        weight += voters_[i].weight_;
+        if (weight * 2 > total_weight_) {
+            quorum_idx_ = voters_[i].matched_idx_;
+            return;
+        }
+    }
+
+    quorum_idx_ = 0;
+}
@@ -0,0 +1,64 @@
+#ifndef _COMMIT_TRACKER_HXX_
+#define _COMMIT_TRACKER_HXX_
+
+namespace cornerstone {
+    /**
+    * Tracks the log index that a quorum of the voters has matched. The voters are kept in the order of their matched
+    * indexes, so an index that advances only moves its voter forward, and the quorum index is counted again only if
+    * the voter crosses it. There is no allocation but for the membership changes.
+    * A voter counts with its weight, a member with weight 0 is tracked without being counted, which is for the
+    * non-voting members
+    */
+    class commit_tracker {
+    public:
+        commit_tracker()
+            : voters_(), total_weight_(0), quorum_idx_(0) {}
+
+        __nocopy__(commit_tracker)
+    public:
+        /**
+        * Adds a voter, or changes the weight of a voter that is tracked already
+        * @param id
+        * @param weight, 0 for a non-voting member
+        */
+        void add_voter(int32 id, int32 weight = 1);
+
+        void remove_voter(int32 id);
+
+        /**
+        * Updates the matched index of a voter, the unknown voters are ignored
+        * @param id
+        * @param matched_idx
+        * @return true if the quorum index advances
+        */
+        bool update(int32 id, ulong matched_idx);
+
+        /**
+        * Sets the matched indexes of all voters to 0, it's for a new term of a leader
+        */
+        void reset();
+
+        ulong quorum_index() const {
+            return quorum_idx_;
+        }
+    private:
+        struct voter {
+            voter(int32 id, int32 weight)
+                : id_(id), weight_(weight), matched_idx_(0) {}
+
+            int32 id_;
+            int32 weight_;
+            ulong matched_idx_;
+        };
+    private:
+        size_t position_of(int32 id) const;
+        void recount();
+    private:
+        // ordered by the matched indexes, the highest first
+        std::vector<voter> voters_;
+        int32 total_weight_;
+        ulong quorum_idx_;
+    };
+}
+
+#endif //_COMMIT_TRACKER_HXX_
@@ -8,6 +8,7 @@
 #include <memory>
 #include <vector>
 #include <list>
+#include <deque>
 #include <string>
 #include <functional>
 #include <mutex>
@@ -37,6 +38,7 @@
 #include "raft_params.hxx"
 #include "msg_type.hxx"
 #include "buffer.hxx"
+#include "crc32c.hxx"
 #include "log_val_type.hxx"
 #include "log_entry.hxx"
 #include "msg_base.hxx"
@@ -62,8 +64,16 @@
 #include "context.hxx"
 #include "snapshot_sync_ctx.hxx"
 #include "snapshot_sync_req.hxx"
+#include "event_loop.hxx"
+#include "commit_tracker.hxx"
 #include "peer.hxx"
 #include "raft_server.hxx"
 #include "asio_service.hxx"
+#include "durability_policy.hxx"
+#include "log_codec.hxx"
+#include "lz_codec.hxx"
 #include "fs_log_store.hxx"
+#include "io_ring.hxx"
+#include "uring_log_store.hxx"
+#include "mmap_log_store.hxx"
 #endif // _CORNERSTONE_HXX_
@@ -0,0 +1,134 @@
+#include "cornerstone.hxx"
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#include <nmmintrin.h>
+#define CRC32C_HW
+#define CRC32C_TARGET
+static bool cpu_has_sse42() {
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+}
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#include <cpuid.h>
+#include <nmmintrin.h>
+#define CRC32C_HW
+#define CRC32C_TARGET __attribute__((target("sse4.2")))
+static bool cpu_has_sse42() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+
+    return (ecx & bit_SSE4_2) != 0;
+}
+#endif
+
+using namespace cornerstone;
+
+// the reversed polynomial of CRC32C
+static const uint crc32c_poly = 0x82F63B78;
+
+// tables for slicing by 8, table[k][b] is the crc of byte b followed by k zero bytes
+class crc32c_tables {
+public:
+    crc32c_tables() {
+        for (uint b = 0; b < 256; ++b) {
+            uint crc = b;
+            for (int i = 0; i < 8; ++i) {
+                crc = (crc >> 1) ^ ((crc & 1) ? crc32c_poly : 0);
+            }
+
+            table_[0][b] = crc;
+        }
+
+        for (uint b = 0; b < 256; ++b) {
+            for (int k = 1; k < 8; ++k) {
+                table_[k][b] = (table_[k - 1][b] >> 8) ^ table_[0][table_[k - 1][b] & 0xFF];
+            }
+        }
+
+#ifdef CRC32C_HW
+        hw_ = cpu_has_sse42();
+#else
+        hw_ = false;
+#endif
+    }
+
+    __nocopy__(crc32c_tables)
+
+public:
+    uint update(uint crc, const byte* data, size_t len) const {
+        while (len > 0 && (reinterpret_cast<size_t>(data) & 7) != 0) {
+            crc = (crc >> 8) ^ table_[0][(crc ^ *data++) & 0xFF];
+            --len;
+        }
+
+        while (len >= 8) {
+            uint low = crc ^ (static_cast<uint>(data[0]) | (static_cast<uint>(data[1]) << 8) | (static_cast<uint>(data[2]) << 16) | (static_cast<uint>(data[3]) << 24));
+            crc = table_[7][low & 0xFF] ^
+                table_[6][(low >> 8) & 0xFF] ^
+                table_[5][(low >> 16) & 0xFF] ^
+                table_[4][low >> 24] ^
+                table_[3][data[4]] ^
+                table_[2][data[5]] ^
+                table_[1][data[6]] ^
+                table_[0][data[7]];
+            data += 8;
+            len -= 8;
+        }
+
+        while (len > 0) {
+            crc = (crc >> 8) ^ table_[0][(crc ^ *data++) & 0xFF];
+            --len;
+        }
+
+        return crc;
+    }
+
+    bool hw() const {
+        return hw_;
+    }
+
+private:
+    uint table_[8][256];
+    bool hw_;
+};
+
+static const crc32c_tables tables;
+
+#ifdef CRC32C_HW
+static CRC32C_TARGET uint update_hw(uint crc, const byte* data, size_t len) {
+    while (len > 0 && (reinterpret_cast<size_t>(data) & 7) != 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+        --len;
+    }
+
+    unsigned long long crc64 = crc;
+    while (len >= 8) {
+        crc64 = _mm_crc32_u64(crc64, *reinterpret_cast<const unsigned long long*>(data));
+        data += 8;
+        len -= 8;
+    }
+
+    crc = static_cast<uint>(crc64);
+    while (len > 0) {
+        crc = _mm_crc32_u8(crc, *data++);
+        --len;
+    }
+
+    return crc;
+}
+#endif
+
+uint cornerstone::crc32c(const byte* data, size_t len, uint crc) {
+    crc = ~crc;
+#ifdef CRC32C_HW
+    if (tables.hw()) {
+        return ~update_hw(crc, data, len);
+    }
+#endif
+
+    return ~tables.update(crc, data, len);
+}
@@ -0,0 +1,16 @@
+#ifndef _CRC32C_HXX_
+#define _CRC32C_HXX_
+
+namespace cornerstone {
+    /**
+    * Computes the CRC32C (Castagnoli) checksum of data, the crc32 instruction of SSE4.2 is used if the processor
+    * supports it, otherwise, the checksum is computed with lookup tables
+    * @param data
+    * @param len
+    * @param crc, the checksum of the data before this one, so that a checksum could be computed in pieces
+    * @return the checksum of all the data
+    */
+    uint crc32c(const byte* data, size_t len, uint crc = 0);
+}
+
+#endif //_CRC32C_HXX_
@@ -0,0 +1,15 @@
+#ifndef _DURABILITY_POLICY_HXX_
+#define _DURABILITY_POLICY_HXX_
+
+namespace cornerstone {
+    enum durability_policy {
+        // log entries are written to the files after each append, but never synced to disk
+        no_sync = 0x0,
+        // each append waits for its entries to be synced, concurrent appends share one write and one sync
+        per_batch_sync,
+        // appends return immediately, the entries are written and synced by a background thread periodically
+        interval_sync
+    };
+}
+
+#endif //_DURABILITY_POLICY_HXX_
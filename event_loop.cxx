@@ -0,0 +1,160 @@
+#include "cornerstone.hxx"
+
+using namespace cornerstone;
+
+// the queue is a linked list of nodes, the producers swap the head and then link the node after the previous head,
+// the consumer keeps the tail, which is a stub node whose task has been taken
+struct event_loop::node {
+    node()
+        : next_(nilptr), task_() {}
+
+    explicit node(const task& t)
+        : next_(nilptr), task_(t) {}
+
+    std::atomic<node*> next_;
+    task task_;
+};
+
+event_loop::event_loop()
+    : head_(nilptr), tail_(nilptr), sleeping_(false), stopped_(false), posting_(0), loop_id_(), sleep_lock_(), sleep_cv_(), thread_() {
+    tail_ = new node();
+    head_.store(tail_);
+    thread_ = std::thread(std::bind(&event_loop::loop, this));
+}
+
+event_loop::~event_loop() {
+    stop();
+    for (node* n = pop(); n != nilptr; n = pop());
+    delete tail_;
+}
+
+// the poster is counted before it checks stopped_, and the loop waits for the count to drop to zero once it's stopped,
+// so a task is either rejected or queued before the loop takes the last look at the queue
+bool event_loop::post(const task& t) {
+    posting_.fetch_add(1);
+    if (stopped_.load()) {
+        posting_.fetch_sub(1);
+        return false;
+    }
+
+    node* n = new node(t);
+    node* prev = head_.exchange(n, std::memory_order_acq_rel);
+    prev->next_.store(n, std::memory_order_release);
+    posting_.fetch_sub(1);
+
+    // the loop checks the queue again after it says it's sleeping, so it either sees the task or is woken up here
+    if (sleeping_.exchange(false)) {
+        std::lock_guard<std::mutex> guard(sleep_lock_);
+        sleep_cv_.notify_one();
+    }
+
+    return true;
+}
+
+void event_loop::run(const task& t) {
+    if (in_loop()) {
+        t();
+        return;
+    }
+
+    ptr<async_result<bool>> done(cs_new<async_result<bool>>());
+    bool posted = post([&t, done]() -> void {
+        bool result(true);
+        ptr<std::exception> err;
+        try {
+            t();
+        }
+        catch (std::exception& ex) {
+            err = cs_new<std::runtime_error>(ex.what());
+        }
+
+        done->set_result(result, err);
+    });
+
+    if (!posted) {
+        throw std::runtime_error("the event loop is stopped");
+    }
+
+    try {
+        done->get();
+    }
+    catch (ptr<std::exception>& err) {
+        throw std::runtime_error(err->what());
+    }
+}
+
+bool event_loop::in_loop() const {
+    return loop_id_.load() == std::this_thread::get_id();
+}
+
+void event_loop::stop() {
+    {
+        std::lock_guard<std::mutex> guard(sleep_lock_);
+        stopped_.store(true);
+        sleep_cv_.notify_all();
+    }
+
+    if (thread_.joinable()) {
+        if (in_loop()) {
+            thread_.detach();
+        }
+        else {
+            thread_.join();
+        }
+    }
+}
+
+// the task of the returned node is taken by the caller, the node is the tail after that
+event_loop::node* event_loop::pop() {
+    node* tail = tail_;
+    node* next = tail->next_.load(std::memory_order_acquire);
+    if (next == nilptr) {
+        return nilptr;
+    }
+
+    tail_ = next;
+    delete tail;
+    return next;
+}
+
+void event_loop::loop() {
+    loop_id_.store(std::this_thread::get_id());
+    while (true) {
+        node* n = pop();
+        if (n != nilptr) {
+            task t;
+            t.swap(n->task_);
+
+            // a task handles its own errors, the loop must keep going for the other tasks
+            try {
+                t();
+            }
+            catch (...) {
+            }
+
+            continue;
+        }
+
+        if (stopped_.load()) {
+            while (posting_.load() > 0) {
+                std::this_thread::yield();
+            }
+
+            if (tail_->next_.load(std::memory_order_acquire) != nilptr) {
+                continue;
+            }
+
+            return;
+        }
+
+        sleeping_.store(true);
+        if (tail_->next_.load(std::memory_order_acquire) != nilptr) {
+            sleeping_.store(false);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_lock_);
+        sleep_cv_.wait(lock, [this]() -> bool { return !sleeping_.load() || stopped_.load(); });
+        sleeping_.store(false);
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef _EVENT_LOOP_HXX_
+#define _EVENT_LOOP_HXX_
+
+namespace cornerstone {
+    /**
+    * A single thread that runs the posted tasks one at a time in the order they are posted, the tasks are queued by
+    * a lock-free multi-producer single-consumer queue, so posting never blocks, the thread sleeps only when the
+    * queue is empty. The state that is only touched by the tasks needs no lock
+    */
+    class event_loop {
+    public:
+        typedef std::function<void()> task;
+        struct node;
+    public:
+        event_loop();
+        ~event_loop();
+
+        __nocopy__(event_loop)
+    public:
+        /**
+        * Queues the task to run on the loop, it could be called by any thread
+        * @param t
+        * @return false if the loop is stopped, the task is not queued then
+        */
+        bool post(const task& t);
+
+        /**
+        * Runs the task on the loop and waits for it, the task runs directly if it's called on the loop,
+        * std::runtime_error is thrown if the task throws or the loop is stopped
+        * @param t
+        */
+        void run(const task& t);
+
+        /**
+        * Whether the caller is the thread of the loop
+        */
+        bool in_loop() const;
+
+        /**
+        * Stops the loop after the queued tasks are run, including the ones that are being posted meanwhile,
+        * the tasks cannot be posted after that
+        */
+        void stop();
+    private:
+        node* pop();
+        void loop();
+    private:
+        std::atomic<node*> head_;
+        node* tail_;
+        std::atomic<bool> sleeping_;
+        std::atomic<bool> stopped_;
+        std::atomic<int32> posting_;
+        std::atomic<std::thread::id> loop_id_;
+        std::mutex sleep_lock_;
+        std::condition_variable sleep_cv_;
+        std::thread thread_;
+    };
+}
+
+#endif //_EVENT_LOOP_HXX_
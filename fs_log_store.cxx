@@ -1,804 +1,2764 @@
 #include "cornerstone.hxx"
+#include "log_record.hxx"
 
 #define LOG_INDEX_FILE "store.idx"
 #define LOG_DATA_FILE "store.dat"
 #define LOG_START_INDEX_FILE "store.sti"
-#define LOG_INDEX_FILE_BAK "store.idx.bak"
-#define LOG_DATA_FILE_BAK "store.dat.bak"
-#define LOG_START_INDEX_FILE_BAK "store.sti.bak"
+#define LOG_MANIFEST_FILE "store.mft"
+#define LOG_TERM_RUNS_FILE "store.trm"
+#define LOG_HEADER_FILE "store.hdr"
+#define LOG_HEADER_FILE_TMP "store.hdr.tmp"
+#define LOG_SEGMENT_INDEX_FILE "store.%llu.idx"
+#define LOG_SEGMENT_DATA_FILE "store.%llu.dat"
+
+// the offsets and the sizes of the writes to a file that is opened for direct io must be multiples of it
+#define DIRECT_IO_ALIGNMENT 4096
 
 #ifdef _WIN32
 #include <Windows.h>
 #define PATH_SEPARATOR '\\'
-int truncate(const char* path, ulong new_size) {
-    HANDLE file_handle = ::CreateFileA(path, GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-    if (file_handle == INVALID_HANDLE_VALUE) {
-        return -1;
-    }
-
-    LONG offset = new_size & 0xFFFFFFFF;
-    LONG offset_high = (LONG)(new_size >> 32);
-    LONG result = ::SetFilePointer(file_handle, offset, &offset_high, FILE_BEGIN);
-    if (result == INVALID_SET_FILE_POINTER) {
-        CloseHandle(file_handle);
+int replace_file(const char* src, const char* dst) {
+    return ::MoveFileExA(src, dst, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) ? 0 : -1;
+}
+#undef max
+#undef min
+#else
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdlib.h>
+#define PATH_SEPARATOR '/'
+// the folder of dst is synced after the rename, so that the rename is durable as well
+int replace_file(const char* src, const char* dst) {
+    if (std::rename(src, dst) != 0) {
         return -1;
     }
 
-    if (!::SetEndOfFile(file_handle)) {
-        CloseHandle(file_handle);
+    std::string folder(dst);
+    size_t pos = folder.find_last_of(PATH_SEPARATOR);
+    folder = pos == std::string::npos ? std::string(".") : folder.substr(0, pos + 1);
+    int fd = ::open(folder.c_str(), O_RDONLY);
+    if (fd < 0) {
         return -1;
     }
 
-    CloseHandle(file_handle);
-    return 0;
+    int rc = ::fsync(fd);
+    ::close(fd);
+    return rc;
 }
-#undef max
-#undef min
+#endif
+
+namespace cornerstone {
+    // a file that is accessed by offsets, so that the reads and writes don't need to seek and
+    // the file could be synced to disk, which is not supported by std::fstream.
+    // a file could be opened for direct io, bypassing the page cache, the writes are then padded to whole blocks
+    // of DIRECT_IO_ALIGNMENT bytes in an aligned buffer, the partial last block written is kept, so that the next
+    // write that continues the block doesn't need to read it back
+    class log_file {
+    public:
+        log_file()
+#ifdef _WIN32
+            : handle_(INVALID_HANDLE_VALUE), mapping_(NULL), view_(nilptr), view_size_(0) {}
 #else
-// for truncate function
-#include <unistd.h>
-#include <sys/types.h>
-#define PATH_SEPARATOR '/'
+            : fd_(-1), view_(nilptr), view_size_(0), direct_(false), direct_buf_(nilptr), direct_buf_size_(0), tail_block_(nilptr), tail_block_offset_(no_block), staged_start_(0), staged_end_(0) {}
+#endif
+
+        ~log_file() {
+            close();
+#ifndef _WIN32
+            ::free(direct_buf_);
+            ::free(tail_block_);
+#endif
+        }
+
+        __nocopy__(log_file)
+
+    public:
+        // the read only view of the file, only the bytes within the file could be accessed
+        const byte* view() const {
+            return view_;
+        }
+
+        ulong view_size() const {
+            return view_size_;
+        }
+
+#ifdef _WIN32
+        // direct io is not supported on Windows, as the file is always mapped for reading
+        bool open(const std::string& path, bool create_new, bool = false) {
+            handle_ = ::CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, create_new ? CREATE_ALWAYS : OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+            return handle_ != INVALID_HANDLE_VALUE;
+        }
+
+        void close() {
+            unmap();
+            if (handle_ != INVALID_HANDLE_VALUE) {
+                ::CloseHandle(handle_);
+                handle_ = INVALID_HANDLE_VALUE;
+            }
+        }
+
+        ulong size() const {
+            LARGE_INTEGER file_size;
+            if (!::GetFileSizeEx(handle_, &file_size)) {
+                throw std::runtime_error("IO fails, cannot get the file size");
+            }
+
+            return static_cast<ulong>(file_size.QuadPart);
+        }
+
+        bool read(ulong offset, byte* data, size_t len) const {
+            while (len > 0) {
+                OVERLAPPED ov;
+                ::memset(&ov, 0, sizeof(ov));
+                ov.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+                ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+                DWORD bytes_read = 0;
+                if (!::ReadFile(handle_, data, static_cast<DWORD>(std::min(len, static_cast<size_t>(0x40000000))), &bytes_read, &ov) || bytes_read == 0) {
+                    return false;
+                }
+
+                offset += bytes_read;
+                data += bytes_read;
+                len -= bytes_read;
+            }
+
+            return true;
+        }
+
+        bool write(ulong offset, const byte* data, size_t len) {
+            while (len > 0) {
+                OVERLAPPED ov;
+                ::memset(&ov, 0, sizeof(ov));
+                ov.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+                ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+                DWORD bytes_written = 0;
+                if (!::WriteFile(handle_, data, static_cast<DWORD>(std::min(len, static_cast<size_t>(0x40000000))), &bytes_written, &ov)) {
+                    return false;
+                }
+
+                offset += bytes_written;
+                data += bytes_written;
+                len -= bytes_written;
+            }
+
+            return true;
+        }
+
+        bool truncate(ulong new_size) {
+            LARGE_INTEGER pos;
+            pos.QuadPart = static_cast<LONGLONG>(new_size);
+            return ::SetFilePointerEx(handle_, pos, NULL, FILE_BEGIN) && ::SetEndOfFile(handle_);
+        }
+
+        bool sync() {
+            return ::FlushFileBuffers(handle_) != 0;
+        }
+
+        // the space is not preallocated on Windows
+        bool allocate(ulong, ulong) {
+            return false;
+        }
+
+        // holes are not punched on Windows, as the file would need to be a sparse file
+        bool punch_hole(ulong, ulong) {
+            return false;
+        }
+
+        bool direct() const {
+            return false;
+        }
+
+        bool stage_write(ulong&, const byte*&, size_t&) {
+            return true;
+        }
+
+        void staged_written() {
+        }
+
+        // there is no io_ring on Windows
+        int fd() const {
+            return -1;
+        }
+
+        // maps the whole file for reading, the size is ignored as a view cannot be larger than the file on Windows
+        bool map(ulong) {
+            unmap();
+            ulong file_size = size();
+            if (file_size == 0) {
+                return true;
+            }
+
+            mapping_ = ::CreateFileMappingA(handle_, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (mapping_ == NULL) {
+                return false;
+            }
+
+            view_ = static_cast<byte*>(::MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+            if (view_ == nilptr) {
+                ::CloseHandle(mapping_);
+                mapping_ = NULL;
+                return false;
+            }
+
+            view_size_ = file_size;
+            return true;
+        }
+
+        void unmap() {
+            if (view_ != nilptr) {
+                ::UnmapViewOfFile(view_);
+                view_ = nilptr;
+                view_size_ = 0;
+            }
+
+            if (mapping_ != NULL) {
+                ::CloseHandle(mapping_);
+                mapping_ = NULL;
+            }
+        }
+#else
+        // opens the file for direct io if direct is true and it's supported by the file system,
+        // otherwise the file is opened for buffered io
+        bool open(const std::string& path, bool create_new, bool direct = false) {
+            int flags = O_RDWR | O_CREAT | (create_new ? O_TRUNC : 0);
+#ifdef O_DIRECT
+            if (direct) {
+                fd_ = ::open(path.c_str(), flags | O_DIRECT, 0644);
+                if (fd_ >= 0) {
+                    direct_ = true;
+                    return true;
+                }
+            }
+#endif
+            fd_ = ::open(path.c_str(), flags, 0644);
+            return fd_ >= 0;
+        }
+
+        void close() {
+            unmap();
+            if (fd_ >= 0) {
+                ::close(fd_);
+                fd_ = -1;
+            }
+        }
+
+        ulong size() const {
+            struct stat st;
+            if (::fstat(fd_, &st) != 0) {
+                throw std::runtime_error("IO fails, cannot get the file size");
+            }
+
+            return static_cast<ulong>(st.st_size);
+        }
+
+        bool read(ulong offset, byte* data, size_t len) const {
+            if (direct_) {
+                return read_direct(offset, data, len);
+            }
+
+            return read_raw(offset, data, len);
+        }
+
+        bool write(ulong offset, const byte* data, size_t len) {
+            if (!stage_write(offset, data, len)) {
+                return false;
+            }
+
+            if (!write_raw(offset, data, len)) {
+                tail_block_offset_ = no_block;
+                return false;
+            }
+
+            staged_written();
+            return true;
+        }
+
+        bool direct() const {
+            return direct_;
+        }
+
+        // for direct io, turns the write of len bytes of data at offset into a write of whole blocks from the aligned
+        // staging buffer, the partial first block is completed by the bytes that are already in the file, the partial
+        // last block is padded with zeros, staged_written() must be called once the staged write is done.
+        // nothing is changed if the file is not opened for direct io
+        bool stage_write(ulong& offset, const byte*& data, size_t& len) {
+            if (!direct_) {
+                return true;
+            }
+
+            ulong block_start = offset & ~static_cast<ulong>(DIRECT_IO_ALIGNMENT - 1);
+            size_t head = static_cast<size_t>(offset - block_start);
+            size_t total = (head + len + DIRECT_IO_ALIGNMENT - 1) & ~static_cast<size_t>(DIRECT_IO_ALIGNMENT - 1);
+            if (total > direct_buf_size_) {
+                ::free(direct_buf_);
+                direct_buf_ = nilptr;
+                direct_buf_size_ = 0;
+                if (!aligned_alloc(direct_buf_, total)) {
+                    return false;
+                }
+
+                direct_buf_size_ = total;
+            }
+
+            if (head > 0) {
+                if (tail_block_offset_ != block_start && !read_block(block_start)) {
+                    return false;
+                }
+
+                ::memcpy(direct_buf_, tail_block_, head);
+            }
+
+            ::memcpy(direct_buf_ + head, data, len);
+            ::memset(direct_buf_ + head + len, 0, total - head - len);
+            staged_end_ = offset + len;
+            staged_start_ = block_start;
+            offset = block_start;
+            data = direct_buf_;
+            len = total;
+            return true;
+        }
+
+        // keeps the partial last block of the staged write, so the next write doesn't need to read it
+        void staged_written() {
+            if (!direct_) {
+                return;
+            }
+
+            ulong last_block = staged_end_ & ~static_cast<ulong>(DIRECT_IO_ALIGNMENT - 1);
+            if (last_block == staged_end_ || (tail_block_ == nilptr && !aligned_alloc(tail_block_, DIRECT_IO_ALIGNMENT))) {
+                tail_block_offset_ = no_block;
+                return;
+            }
+
+            ::memcpy(tail_block_, direct_buf_ + static_cast<size_t>(last_block - staged_start_), DIRECT_IO_ALIGNMENT);
+            tail_block_offset_ = last_block;
+        }
+
+        // preallocates the space [offset, offset + len) of the file, the file size grows to cover the space,
+        // returns false if preallocation is not supported.
+        // fallocate leaves the extents unwritten, so the first sync over each block would still update the file system
+        // metadata, the whole blocks of the space are zero filled and synced here instead, once for the whole space,
+        // the partial first block is a part of the block at the end of the file, which is written already.
+        // it could run while the file is written below offset, by the background thread of the store
+        bool allocate(ulong offset, ulong len) {
+#ifdef __linux__
+            if (::fallocate(fd_, 0, static_cast<off_t>(offset), static_cast<off_t>(len)) != 0) {
+                return false;
+            }
+
+            ulong start = (offset + DIRECT_IO_ALIGNMENT - 1) & ~static_cast<ulong>(DIRECT_IO_ALIGNMENT - 1);
+            ulong end = (offset + len) & ~static_cast<ulong>(DIRECT_IO_ALIGNMENT - 1);
+            bool filled = true;
+            if (start < end) {
+                size_t chunk = static_cast<size_t>(std::min(end - start, static_cast<ulong>(zero_fill_chunk)));
+                byte* zeros = nilptr;
+                filled = aligned_alloc(zeros, chunk);
+                if (filled) {
+                    ::memset(zeros, 0, chunk);
+                    for (ulong pos = start; filled && pos < end; pos += chunk) {
+                        filled = write_raw(pos, zeros, static_cast<size_t>(std::min(end - pos, static_cast<ulong>(chunk))));
+                    }
+
+                    ::free(zeros);
+                }
+            }
+
+            if (!filled || !sync()) {
+                // the space is not used then, the file gets back its size if it could, otherwise the space is trimmed
+                // as the segment is sealed, the tail block that is kept for the direct writes is before offset, so it stays
+                int truncated = ::ftruncate(fd_, static_cast<off_t>(offset));
+                (void)truncated;
+                return false;
+            }
+
+            return true;
+#else
+            (void)offset;
+            (void)len;
+            return false;
+#endif
+        }
+
+        // gives the space [offset, offset + len) back to the file system, the range reads as zeros afterwards and
+        // the file size is not changed, returns false if it's not supported
+        bool punch_hole(ulong offset, ulong len) {
+#if defined(__linux__) && defined(FALLOC_FL_PUNCH_HOLE)
+            return ::fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, static_cast<off_t>(offset), static_cast<off_t>(len)) == 0;
+#else
+            (void)offset;
+            (void)len;
+            return false;
+#endif
+        }
+
+        bool read_raw(ulong offset, byte* data, size_t len) const {
+            while (len > 0) {
+                ssize_t bytes_read = ::pread(fd_, data, len, static_cast<off_t>(offset));
+                if (bytes_read <= 0) {
+                    if (bytes_read < 0 && errno == EINTR) {
+                        continue;
+                    }
+
+                    return false;
+                }
+
+                offset += static_cast<ulong>(bytes_read);
+                data += bytes_read;
+                len -= static_cast<size_t>(bytes_read);
+            }
+
+            return true;
+        }
+
+        bool write_raw(ulong offset, const byte* data, size_t len) {
+            while (len > 0) {
+                ssize_t bytes_written = ::pwrite(fd_, data, len, static_cast<off_t>(offset));
+                if (bytes_written < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+
+                    return false;
+                }
+
+                offset += static_cast<ulong>(bytes_written);
+                data += bytes_written;
+                len -= static_cast<size_t>(bytes_written);
+            }
+
+            return true;
+        }
+
+        bool truncate(ulong new_size) {
+            tail_block_offset_ = no_block;
+            return ::ftruncate(fd_, static_cast<off_t>(new_size)) == 0;
+        }
+
+        bool sync() {
 #ifdef OS_FREEBSD
-int truncate(const char* path, ulong new_size) {
-    return ::truncate(path, (off_t)new_size);
-}
+            return ::fsync(fd_) == 0;
 #else
-int truncate(const char* path, ulong new_size) {
-    return ::truncate64(path, (off64_t)new_size);
-}
+            return ::fdatasync(fd_) == 0;
+#endif
+        }
+
+        int fd() const {
+            return fd_;
+        }
+
+        // maps size bytes of the file for reading, the view could be larger than the file,
+        // so that it doesn't need to be remapped each time the file grows
+        bool map(ulong size) {
+            unmap();
+            void* addr = ::mmap(nilptr, static_cast<size_t>(size), PROT_READ, MAP_SHARED, fd_, 0);
+            if (addr == MAP_FAILED) {
+                return false;
+            }
+
+            view_ = static_cast<byte*>(addr);
+            view_size_ = size;
+            return true;
+        }
+
+        void unmap() {
+            if (view_ != nilptr) {
+                ::munmap(view_, static_cast<size_t>(view_size_));
+                view_ = nilptr;
+                view_size_ = 0;
+            }
+        }
+#endif
+
+    private:
+#ifndef _WIN32
+        // reads through an aligned buffer of the whole blocks that cover [offset, offset + len)
+        bool read_direct(ulong offset, byte* data, size_t len) const {
+            ulong block_start = offset & ~static_cast<ulong>(DIRECT_IO_ALIGNMENT - 1);
+            size_t head = static_cast<size_t>(offset - block_start);
+            size_t total = (head + len + DIRECT_IO_ALIGNMENT - 1) & ~static_cast<size_t>(DIRECT_IO_ALIGNMENT - 1);
+            byte* buf = nilptr;
+            if (!aligned_alloc(buf, total)) {
+                return false;
+            }
+
+            // the read stops at the end of the file, which is not aligned
+            size_t filled = 0;
+            while (filled < head + len) {
+                ssize_t bytes_read = ::pread(fd_, buf + filled, total - filled, static_cast<off_t>(block_start + filled));
+                if (bytes_read < 0 && errno == EINTR) {
+                    continue;
+                }
+
+                if (bytes_read <= 0) {
+                    break;
+                }
+
+                filled += static_cast<size_t>(bytes_read);
+            }
+
+            bool result = filled >= head + len;
+            if (result) {
+                ::memcpy(data, buf + head, len);
+            }
+
+            ::free(buf);
+            return result;
+        }
+
+        // reads the block at offset as the partial last block, the bytes beyond the end of the file are zeros
+        bool read_block(ulong offset) {
+            if (tail_block_ == nilptr && !aligned_alloc(tail_block_, DIRECT_IO_ALIGNMENT)) {
+                return false;
+            }
+
+            ::memset(tail_block_, 0, DIRECT_IO_ALIGNMENT);
+            while (true) {
+                ssize_t bytes_read = ::pread(fd_, tail_block_, DIRECT_IO_ALIGNMENT, static_cast<off_t>(offset));
+                if (bytes_read >= 0) {
+                    break;
+                }
+
+                if (errno != EINTR) {
+                    return false;
+                }
+            }
+
+            tail_block_offset_ = offset;
+            return true;
+        }
+
+        static bool aligned_alloc(byte*& buf, size_t size) {
+            void* mem = nilptr;
+            if (::posix_memalign(&mem, DIRECT_IO_ALIGNMENT, size) != 0) {
+                return false;
+            }
+
+            buf = static_cast<byte*>(mem);
+            return true;
+        }
+#endif
+
+    private:
+#ifdef _WIN32
+        HANDLE handle_;
+        HANDLE mapping_;
+#else
+        int fd_;
 #endif
+        byte* view_;
+        ulong view_size_;
+#ifndef _WIN32
+        static const ulong no_block = static_cast<ulong>(-1);
+        // the zeros are written by allocate in chunks of this size
+        static const size_t zero_fill_chunk = 256 * 1024;
+        bool direct_;
+        byte* direct_buf_;
+        size_t direct_buf_size_;
+        byte* tail_block_;
+        ulong tail_block_offset_;
+        ulong staged_start_;
+        ulong staged_end_;
 #endif
+    };
+}
+
+static void put_ulong(std::vector<byte>& bytes, ulong val) {
+    for (size_t i = 0; i < sz_ulong; ++i) {
+        bytes.push_back(static_cast<byte>(val >> (i * 8)));
+    }
+}
+
+using namespace cornerstone;
+
+// the data file of a segment starts with the magic, "CSLOG" and the format version, and then the records
+static const ulong segment_magic = 0x010000474F4C5343;
+
+// the store header is the magic, "CSHDR" and the format version, the version of the header, which is increased each time
+// it's saved, the start index of the store, the checkpoint index and term, the start indexes of the segments as int32 count
+// and the indexes, the term runs up to the checkpoint as int32 count and the (start index, term) pairs, and then
+// the CRC32C of all above
+static const ulong header_magic = 0x0100005244485343;
+
+// the compressed entry of a record keeps the term and the value type of the entry as they are, followed by the codec id,
+// the length of the entry data and the compressed entry data, so that the terms could still be read without
+// decompressing the entries
+static const size_t compressed_entry_header_size = sz_ulong + 1 + 1 + sizeof(uint);
+
+// the codec that has the id, the built-in lz_codec is always known
+static log_codec* codec_of(byte id, log_codec* codec) {
+    static lz_codec lz;
+    if (codec != nilptr && codec->id() == id) {
+        return codec;
+    }
+
+    return id == lz.id() ? &lz : nilptr;
+}
+
+// compresses the entry data of a serialized log entry into a compressed entry,
+// returns false if the entry is not compressed as it's not worth it
+static bool compress_entry(log_codec& codec, const byte* entry, size_t len, std::vector<byte>& result) {
+    if (len <= sz_ulong + 1) {
+        return false;
+    }
+
+    result.assign(entry, entry + sz_ulong + 1);
+    result.push_back(codec.id());
+    result.resize(compressed_entry_header_size);
+    put_uint(&result[sz_ulong + 2], static_cast<uint>(len - sz_ulong - 1));
+    return codec.compress(entry + sz_ulong + 1, len - sz_ulong - 1, result) && result.size() < len;
+}
+
+// the serialized log entry of a record entry, a compressed entry is decompressed
+static ptr<buffer> entry_data_of(uint len_field, const byte* entry, log_codec* codec) {
+    uint len = record_len(len_field);
+    ptr<buffer> result;
+    if ((len_field & compressed_record) == 0) {
+        result = buffer::alloc(len);
+        ::memcpy(result->data(), entry, len);
+        return result;
+    }
+
+    if (len < compressed_entry_header_size) {
+        throw std::runtime_error("bad log record, the compressed entry is broken");
+    }
+
+    log_codec* entry_codec = codec_of(entry[sz_ulong + 1], codec);
+    if (entry_codec == nilptr) {
+        throw std::runtime_error(sstrfmt("bad log record, unknown codec %d").fmt(entry[sz_ulong + 1]));
+    }
+
+    size_t data_len = get_uint(entry + sz_ulong + 2);
+    result = buffer::alloc(sz_ulong + 1 + data_len);
+    ::memcpy(result->data(), entry, sz_ulong + 1);
+    if (!entry_codec->decompress(entry + compressed_entry_header_size, len - compressed_entry_header_size, result->data() + sz_ulong + 1, data_len)) {
+        throw std::runtime_error("bad log record, the entry cannot be decompressed");
+    }
+
+    return result;
+}
+
+const ulong fs_log_store::default_segment_size = 64 * 1024 * 1024;
+const ulong fs_log_store::max_segment_size = 0x80000000;
+const ulong fs_log_store::default_cache_size = 64 * 1024 * 1024;
+const ulong fs_log_store::max_preallocate_size = 4 * 1024 * 1024;
+
+ptr<buffer> zero_buf;
+ptr<log_entry> empty_entry(cs_new<log_entry>(0, zero_buf, log_val_type::app_log));
+
+// the buffer keeps the most recent entries in memory, [start_idx_, end_idx_), in a ring of slots, it is bounded by the bytes
+// of the entries as well as the number of slots, the oldest entries are evicted first to keep the tail for replication,
+// the last entry always stays, as it's the last entry of the store.
+// only one thread changes the buffer at a time (the store lock is held), the readers don't take any lock of the buffer,
+// a slot has the log index of the entry it keeps, so a reader could tell if the slot is reused for another entry,
+// the entry is copied under a spin flag of the slot, as ptr doesn't support atomic loads, the flag is only held
+// for copying or replacing the pointer, so the writer and the readers don't wait for each other except on the same slot
+class cornerstone::log_store_buffer {
+    struct slot {
+        slot() : busy(), idx(0), entry() {
+            busy.clear();
+        }
+
+        std::atomic_flag busy;
+        ulong idx;
+        ptr<log_entry> entry;
+    };
+
+    class slot_guard {
+    public:
+        slot_guard(slot& s) : slot_(s) {
+            while (slot_.busy.test_and_set(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+        }
+
+        ~slot_guard() {
+            slot_.busy.clear(std::memory_order_release);
+        }
+
+        __nocopy__(slot_guard)
+    private:
+        slot& slot_;
+    };
+public:
+    // the number of slots, it must be a power of two
+    static const size_t slots = 64 * 1024;
+
+    log_store_buffer(ulong start_idx, ulong max_bytes)
+        : slots_(new slot[slots]), start_idx_(start_idx), end_idx_(start_idx), bytes_(0), max_bytes_(max_bytes) {
+    }
+
+    ~log_store_buffer() {
+        delete[] slots_;
+    }
+
+    __nocopy__(log_store_buffer)
+public:
+    ulong last_idx() const {
+        return end_idx_;
+    }
+
+    ulong first_idx() const {
+        return start_idx_;
+    }
+
+    ulong bytes() const {
+        return bytes_;
+    }
+
+    ptr<log_entry> last_entry() {
+        // the slot could only be missed while the writer is changing it, retry with the new end,
+        // the start is loaded first, as the end could otherwise be stale against a start that is moved by the evictions
+        while (true) {
+            ulong start = start_idx_;
+            ulong end = end_idx_;
+            if (end <= start) {
+                return ptr<log_entry>();
+            }
+
+            ptr<log_entry> entry(get(end - 1));
+            if (entry) {
+                return entry;
+            }
+        }
+    }
+
+    ptr<log_entry> operator[](ulong idx) {
+        if (idx < start_idx_ || idx >= end_idx_) {
+            return ptr<log_entry>();
+        }
+
+        return get(idx);
+    }
+
+    // [start, end), the entries that are not in the buffer are left as null
+    void fill(ulong start, ulong end, std::vector<ptr<log_entry>>& result) {
+        for (ulong idx = start; idx < end; ++idx) {
+            result.push_back((*this)[idx]);
+        }
+    }
+
+    // trimming the buffer [start, end)
+    void trim(ulong start) {
+        if (start < start_idx_) {
+            reset(start);
+            return;
+        }
+
+        ulong end = end_idx_;
+        if (start >= end) {
+            return;
+        }
+
+        end_idx_ = start;
+        for (ulong idx = end; idx > start; --idx) {
+            clear(idx - 1);
+        }
+    }
+
+    void append(ptr<log_entry>& entry) {
+        ulong idx = end_idx_;
+        if (idx - start_idx_ >= slots) {
+            evict();
+        }
+
+        slot& s = slots_[idx & (slots - 1)];
+        {
+            slot_guard guard(s);
+            s.entry = entry;
+            s.idx = idx;
+        }
+
+        bytes_ += size_of(*entry);
+        end_idx_ = idx + 1;
+        while (bytes_ > max_bytes_ && end_idx_ - start_idx_ > 1) {
+            evict();
+        }
+    }
+
+    // drop all entries before start
+    void compact(ulong start) {
+        while (start_idx_ < start && start_idx_ < end_idx_) {
+            evict();
+        }
+
+        if (start_idx_ < start) {
+            start_idx_ = end_idx_ = start;
+        }
+    }
+
+    void reset(ulong start_idx) {
+        ulong end = end_idx_;
+        end_idx_ = start_idx_.load();
+        for (ulong idx = start_idx_; idx < end; ++idx) {
+            clear(idx);
+        }
+
+        start_idx_ = end_idx_ = start_idx;
+    }
+
+    // the bytes that an entry takes in the buffer, the serialized size of it
+    static ulong size_of(log_entry& entry) {
+        return sz_ulong + 1 + entry.get_buf().size();
+    }
+private:
+    ptr<log_entry> get(ulong idx) {
+        slot& s = slots_[idx & (slots - 1)];
+        slot_guard guard(s);
+        return s.idx == idx ? s.entry : ptr<log_entry>();
+    }
+
+    void evict() {
+        ulong idx = start_idx_;
+        start_idx_ = idx + 1;
+        clear(idx);
+    }
+
+    void clear(ulong idx) {
+        slot& s = slots_[idx & (slots - 1)];
+        ptr<log_entry> entry;
+        {
+            slot_guard guard(s);
+            if (s.idx != idx) {
+                return;
+            }
+
+            entry = s.entry;
+            s.entry.reset();
+            s.idx = 0;
+        }
+
+        // the entry is released out of the spin flag
+        bytes_ -= size_of(*entry);
+    }
+private:
+    slot* slots_;
+    std::atomic<ulong> start_idx_;
+    std::atomic<ulong> end_idx_;
+    std::atomic<ulong> bytes_;
+    ulong max_bytes_;
+};
+
+// IMPORTANT!! 
+// We hack the log_entry serialization details here, so that the entry is created without copying data twice,
+// record is a record with the header, a compressed entry is decompressed first
+static ptr<log_entry> entry_of(const byte* record, log_codec* codec) {
+    uint len_field = get_uint(record);
+    if ((len_field & compressed_record) != 0) {
+        return log_entry::deserialize(*entry_data_of(len_field, record + record_header_size, codec));
+    }
+
+    const byte* data = record + record_header_size;
+    size_t len = record_len(len_field);
+    ptr<buffer> entry_data(buffer::alloc(len - sz_ulong - 1));
+    ::memcpy(entry_data->data(), data + sz_ulong + 1, entry_data->size());
+    return cs_new<log_entry>(get_ulong(data), entry_data, static_cast<log_val_type>(data[sz_ulong]));
+}
+
+static bool file_exists(const std::string& path) {
+    std::ifstream file(path);
+    return file.good();
+}
+
+// a segment keeps the log entries [start_idx_, start_idx_ + entries_) in a pair of data and index files,
+// the data file has the entries as checksummed records, except for the segments that are created by
+// the versions without the records, those are read as they are, but never appended once they are not the last one.
+// the index file has one sz_ulong data file offset for each entry in this segment, the offsets are loaded once
+// into memory as 32 bits values, as a segment never grows beyond 4GB, so that the index file is never read again,
+// they are loaded on the first access, so opening the store reads the last offset of each segment only.
+// appended entries are staged in memory until flush() is called, so that a group of entries
+// costs one write for each file. written entries are read through the memory mapped view of the data file,
+// which is also allowed without the store lock, see read_written.
+// the space of the data file is preallocated in chunks of preallocate_size bytes, and the space of the index file
+// in chunks of an eighth of that, so that the appends don't grow the files. the next chunk is allocated ahead of the
+// writes by the background thread of the store, see allocate_ahead, so the appends never wait for the space to be
+// zero filled unless they run into the chunk that is being allocated, the files of the last segment could be
+// longer than its records and offsets, the space is trimmed once the segment is sealed as a new segment is rolled
+// out or the store is closed, the space that is left by a crash is ignored when the segment is opened again, the
+// offsets end at the first zero offset, as no record starts at 0. the segments without the records are not preallocated.
+// once the first entries of the segment are compacted, their space is released by punching a hole in the data file,
+// the offsets of the remaining records don't change, so the compaction doesn't copy anything.
+// with a codec, the entries are compressed one record at a time as they are appended, and decompressed as they are read
+class cornerstone::log_segment {
+public:
+    log_segment(const std::string& log_folder, ulong start_idx, bool create_new, io_ring* write_ring, io_ring* sync_ring, bool direct_io, ulong segment_size, ulong preallocate_size, log_codec* codec)
+        : idx_path_(log_folder + sstrfmt(LOG_SEGMENT_INDEX_FILE).fmt(start_idx)),
+        data_path_(log_folder + sstrfmt(LOG_SEGMENT_DATA_FILE).fmt(start_idx)),
+        idx_file_(),
+        data_file_(),
+        pending_idx_(),
+        pending_data_(),
+        start_idx_(start_idx),
+        entries_(0),
+        data_size_(0),
+        written_entries_(0),
+        written_data_size_(0),
+        unsynced_(false),
+        view_lock_(),
+        view_cv_(),
+        readers_(0),
+        offsets_(),
+        offsets_loaded_(false),
+        view_data_size_(0),
+        framed_(true),
+        data_start_(sz_ulong),
+        write_ring_(write_ring),
+        sync_ring_(sync_ring),
+        allocated_size_(0),
+        idx_allocated_size_(0),
+        preallocate_size_(preallocate_size),
+        space_limit_(preallocate_size > 0 ? (segment_size + preallocate_size - 1) / preallocate_size * preallocate_size : 0),
+        alloc_lock_(),
+        alloc_cv_(),
+        allocating_(false),
+        space_wanted_(false),
+        write_end_(0),
+        idx_write_end_(0),
+        released_entries_(0),
+        released_size_(0),
+        codec_(codec),
+        compressed_() {
+        if (!idx_file_.open(idx_path_, create_new) || !data_file_.open(data_path_, create_new, direct_io)) {
+            throw std::runtime_error("fail to create segment files");
+        }
+
+        idx_allocated_size_ = idx_file_.size();
+        data_size_ = written_data_size_ = allocated_size_ = data_file_.size();
+        if (data_size_ > std::numeric_limits<uint>::max()) {
+            throw std::runtime_error("bad segment files, the segment is too large");
+        }
+
+        byte magic[sz_ulong];
+        if (data_size_ == 0) {
+            put_ulong_to(magic, segment_magic);
+            if (!data_file_.write(0, magic, sz_ulong)) {
+                throw std::runtime_error("IO fails, data cannot be saved");
+            }
+
+            data_size_ = written_data_size_ = sz_ulong;
+            unsynced_ = true;
+        }
+        else if (data_size_ < sz_ulong || !data_file_.read(0, magic, sz_ulong) || get_ulong(magic) != segment_magic) {
+            framed_ = false;
+            data_start_ = 0;
+            preallocate_size_ = 0;
+        }
+
+        // the index file has preallocated space if its last offset is zero, the offsets are loaded to find the end then
+        entries_ = written_entries_ = idx_allocated_size_ / sz_ulong;
+        ulong last_offset = written_entries_ > 0 ? read_offset(written_entries_ - 1) : 0;
+        if (framed_ && written_entries_ > 0 && last_offset == 0) {
+            load_offsets();
+            size_t cnt = std::find(offsets_.begin(), offsets_.end(), 0U) - offsets_.begin();
+            offsets_.resize(cnt);
+            entries_ = written_entries_ = cnt;
+            last_offset = cnt > 0 ? offsets_.back() : 0;
+        }
+
+        offsets_loaded_ = offsets_loaded_ || written_entries_ == 0;
+
+        // the hole starts at the first block after the header, which must be kept
+        released_size_ = (data_start_ + DIRECT_IO_ALIGNMENT - 1) & ~static_cast<ulong>(DIRECT_IO_ALIGNMENT - 1);
+        trim_preallocated(last_offset);
+        write_end_ = written_data_size_;
+        idx_write_end_ = written_entries_ * sz_ulong;
+        publish(nilptr);
+    }
+
+    __nocopy__(log_segment)
+
+public:
+    ulong start_idx() const {
+        return start_idx_;
+    }
+
+    ulong next_idx() const {
+        return start_idx_ + entries_;
+    }
+
+    ulong entries() const {
+        return entries_;
+    }
+
+    ulong data_size() const {
+        return data_size_;
+    }
+
+    bool written(ulong index) const {
+        return index - start_idx_ < written_entries_;
+    }
+
+    bool framed() const {
+        return framed_;
+    }
+
+    // loads the offsets of the written entries if they are not loaded yet, under the store lock,
+    // so that the written entries could be read through the view
+    void load_offsets() {
+        if (offsets_loaded_) {
+            return;
+        }
+
+        auto_lock(view_lock_);
+        std::vector<byte> idx_data(static_cast<size_t>(written_entries_ * sz_ulong));
+        if (idx_data.size() > 0 && !idx_file_.read(0, &idx_data[0], idx_data.size())) {
+            throw std::runtime_error("IO fails, index cannot be read");
+        }
+
+        offsets_.reserve(idx_data.size() / sz_ulong);
+        for (size_t i = 0; i < idx_data.size(); i += sz_ulong) {
+            offsets_.push_back(static_cast<uint>(get_ulong(&idx_data[i])));
+        }
+
+        offsets_loaded_ = true;
+    }
+
+    void append(buffer& data) {
+        const byte* entry = data.data();
+        size_t len = data.size() - data.pos();
+        put_ulong(pending_idx_, data_size_);
+        if (framed_) {
+            uint len_field = static_cast<uint>(len);
+            if (codec_ != nilptr && compress_entry(*codec_, entry, len, compressed_)) {
+                entry = &compressed_[0];
+                len = compressed_.size();
+                len_field = static_cast<uint>(len) | compressed_record;
+            }
+
+            byte header[record_header_size];
+            put_record_header(header, entry, len_field);
+            pending_data_.insert(pending_data_.end(), header, header + record_header_size);
+            data_size_ += record_header_size;
+        }
+
+        pending_data_.insert(pending_data_.end(), entry, entry + len);
+        data_size_ += len;
+        entries_ += 1;
+    }
+
+    // writes the staged entries to the files, returns true if there is anything written
+    bool flush() {
+        if (pending_idx_.size() == 0) {
+            return false;
+        }
+
+        if (!write_files(&pending_idx_[0], pending_idx_.size(), pending_data_.size() > 0 ? &pending_data_[0] : nilptr, pending_data_.size())) {
+            throw std::runtime_error("IO fails, data cannot be saved");
+        }
+
+        written_entries_ = entries_;
+        written_data_size_ = data_size_;
+        unsynced_ = true;
+        publish(&pending_idx_[0]);
+        pending_idx_.clear();
+        pending_data_.clear();
+        return true;
+    }
+
+    // writes the records in data straight to the files without staging them, sizes has the size of each record
+    void write_direct(const byte* data, const std::vector<ulong>& sizes) {
+        if (!framed_) {
+            throw std::runtime_error("records cannot be written to a segment without records");
+        }
+
+        flush();
+        std::vector<byte> idx_data;
+        ulong data_len = 0;
+        for (size_t i = 0; i < sizes.size(); ++i) {
+            put_ulong(idx_data, data_size_ + data_len);
+            data_len += sizes[i];
+        }
+
+        if (idx_data.size() == 0) {
+            return;
+        }
+
+        if (!write_files(&idx_data[0], idx_data.size(), data, static_cast<size_t>(data_len))) {
+            throw std::runtime_error("IO fails, data cannot be saved");
+        }
+
+        entries_ += sizes.size();
+        data_size_ += data_len;
+        written_entries_ = entries_;
+        written_data_size_ = data_size_;
+        unsynced_ = true;
+        publish(&idx_data[0]);
+    }
+
+    // returns true if there are written entries not synced yet, and marks them as synced,
+    // the caller must call sync() afterwards, which could be done outside the store lock
+    bool take_unsynced() {
+        bool unsynced = unsynced_;
+        unsynced_ = false;
+        return unsynced;
+    }
+
+    // returns true if less than half a chunk of the allocated space is left ahead of the writes
+    bool wants_space() {
+        auto_lock(alloc_lock_);
+        return space_wanted_;
+    }
+
+    // allocates the space of the files up to a whole chunk ahead of the writes, the data file up to the segment size,
+    // the last record could go beyond it. it's done without the store lock,
+    // so the zero fill and the sync of the space are never on the append path, the writes go on meanwhile
+    // below the space that is being allocated, preallocation is turned off if the file system doesn't support it
+    void allocate_ahead() {
+        ulong start = 0;
+        ulong end = 0;
+        ulong idx_start = 0;
+        ulong idx_end = 0;
+        {
+            auto_lock(alloc_lock_);
+            if (!space_wanted_ || allocating_ || preallocate_size_ == 0) {
+                return;
+            }
+
+            space_wanted_ = false;
+            start = std::max(allocated_size_, write_end_);
+            end = std::min((write_end_ + 2 * preallocate_size_ - 1) / preallocate_size_ * preallocate_size_, space_limit_);
+            idx_start = std::max(idx_allocated_size_, idx_write_end_);
+            idx_end = (idx_write_end_ + 2 * idx_chunk() - 1) / idx_chunk() * idx_chunk();
+            allocating_ = true;
+        }
+
+        bool allocated = start >= end || data_file_.allocate(start, end - start);
+        bool idx_allocated = idx_start >= idx_end || idx_file_.allocate(idx_start, idx_end - idx_start);
+        auto_lock(alloc_lock_);
+        if (allocated) {
+            allocated_size_ = std::max(allocated_size_, end);
+        }
+
+        if (idx_allocated) {
+            idx_allocated_size_ = std::max(idx_allocated_size_, idx_end);
+        }
+
+        if (!allocated || !idx_allocated) {
+            preallocate_size_ = 0;
+        }
+
+        allocating_ = false;
+        alloc_cv_.notify_all();
+    }
+
+    void sync() {
+        bool synced = false;
+        if (sync_ring_ != nilptr) {
+            std::vector<int> fds;
+            fds.push_back(idx_file_.fd());
+            fds.push_back(data_file_.fd());
+            synced = sync_ring_->sync(fds);
+        }
+        else {
+            synced = idx_file_.sync() && data_file_.sync();
+        }
+
+        if (!synced) {
+            throw std::runtime_error("IO fails, data cannot be synced to disk");
+        }
+    }
+
+    ptr<buffer> read(ulong index) {
+        ulong local_idx = index - start_idx_;
+        ulong data_start = offset_of(local_idx) + header_size();
+        ulong data_end = local_idx + 1 < entries_ ? offset_of(local_idx + 1) : data_size_;
+        if (framed_) {
+            byte header[record_header_size];
+            read_data(data_start - record_header_size, header, record_header_size);
+            if ((get_uint(header) & compressed_record) != 0) {
+                std::vector<byte> entry(static_cast<size_t>(data_end - data_start));
+                read_data(data_start, &entry[0], entry.size());
+                return entry_data_of(get_uint(header), &entry[0], codec_);
+            }
+        }
+
+        ptr<buffer> entry_buf(buffer::alloc(static_cast<size_t>(data_end - data_start)));
+        read_data(data_start, *entry_buf);
+        return entry_buf;
+    }
+
+    // reads a written entry through the view without the store lock,
+    // returns null if the entry is not (or no longer) in the view
+    ptr<buffer> read_written(ulong index) {
+        view_reader reader(*this, index - start_idx_);
+        if (index < start_idx_ || !reader.valid()) {
+            return ptr<buffer>();
+        }
+
+        const byte* record = data_file_.view() + reader.data_start();
+        if (framed_ && (get_uint(record) & compressed_record) != 0) {
+            return entry_data_of(get_uint(record), record + record_header_size, codec_);
+        }
+
+        ulong data_start = reader.data_start() + header_size();
+        ptr<buffer> entry_buf(buffer::alloc(static_cast<size_t>(reader.data_end() - data_start)));
+        ::memcpy(entry_buf->data(), data_file_.view() + data_start, entry_buf->size());
+        return entry_buf;
+    }
+
+    // offsets of the records [start, end) within the data file, the offset of end is included as the end of the data
+    void offsets(ulong start, ulong end, std::vector<ulong>& result) {
+        for (ulong i = start - start_idx_; i < end - start_idx_; ++i) {
+            result.push_back(offset_of(i));
+        }
+
+        result.push_back(end < next_idx() ? offset_of(end - start_idx_) : data_size_);
+    }
+
+    // reads the data starting at offset, the written data is read from the view and the staged data from memory
+    void read_data(ulong offset, buffer& data) {
+        read_data(offset, data.data(), data.size() - data.pos());
+    }
+
+    void read_data(ulong offset, byte* dst, size_t len) {
+        if (offset < written_data_size_) {
+            size_t written_len = static_cast<size_t>(std::min(static_cast<ulong>(len), written_data_size_ - offset));
+            ::memcpy(dst, data_file_.view() + offset, written_len);
+            offset += written_len;
+            dst += written_len;
+            len -= written_len;
+        }
+
+        if (len > 0) {
+            ::memcpy(dst, &pending_data_[static_cast<size_t>(offset - written_data_size_)], len);
+        }
+    }
+
+    // removes all entries starting from index
+    void truncate(ulong index) {
+        if (index >= next_idx()) {
+            return;
+        }
+
+        ulong local_idx = index < start_idx_ ? 0 : index - start_idx_;
+        ulong new_data_size = local_idx == 0 ? data_start_ : offset_of(local_idx);
+        if (local_idx >= written_entries_) {
+            // only staged entries are dropped
+            pending_idx_.resize(static_cast<size_t>(local_idx - written_entries_) * sz_ulong);
+            pending_data_.resize(static_cast<size_t>(new_data_size - written_data_size_));
+        }
+        else {
+            pending_idx_.clear();
+            pending_data_.clear();
+
+            // the readers must be done with the view before the files shrink, the data file is unmapped
+            // while being truncated, as a mapped file cannot be truncated on Windows
+            std::unique_lock<std::mutex> lock(view_lock_);
+            wait_for_readers(lock);
+            std::unique_lock<std::mutex> alloc_lock(alloc_lock_);
+            wait_for_allocation(alloc_lock);
+            data_file_.unmap();
+            if (!idx_file_.truncate(local_idx * sz_ulong) || !data_file_.truncate(new_data_size)) {
+                throw std::runtime_error("IO fails, failed to truncate the segment");
+            }
+
+            written_entries_ = local_idx;
+            written_data_size_ = allocated_size_ = write_end_ = new_data_size;
+            idx_allocated_size_ = idx_write_end_ = local_idx * sz_ulong;
+            released_entries_ = std::min(released_entries_, local_idx);
+            unsynced_ = true;
+            offsets_.resize(static_cast<size_t>(local_idx));
+            view_data_size_ = written_data_size_;
+            map_view();
+        }
+
+        entries_ = local_idx;
+        data_size_ = new_data_size;
+    }
+
+    // checks the records from the one of first_index to the end of the data file, the first broken record and all
+    // the records after it are dropped, the index file is rebuilt if it doesn't match the records, the records before
+    // first_index are compacted and could be released, so those are kept as they are in the index file.
+    // only the last segment could have broken records after a crash, so this is for the last segment only
+    void recover(ulong first_index) {
+        if (!framed_) {
+            return;
+        }
+
+        load_offsets();
+        const byte* view = data_file_.view();
+        size_t first = first_index > start_idx_ && first_index - start_idx_ < offsets_.size() ? static_cast<size_t>(first_index - start_idx_) : 0;
+        std::vector<uint> offsets(offsets_.begin(), offsets_.begin() + first);
+        ulong pos = first > 0 ? offsets_[first] : data_start_;
+        while (pos + record_header_size <= written_data_size_) {
+            ulong size = record_header_size + record_len(get_uint(view + pos));
+            if (pos + size > written_data_size_ || !valid_record(view + pos, size)) {
+                break;
+            }
+
+            offsets.push_back(static_cast<uint>(pos));
+            pos += size;
+        }
+
+        if (pos == written_data_size_ && offsets == offsets_) {
+            return;
+        }
+
+        std::vector<byte> idx_data;
+        for (size_t i = 0; i < offsets.size(); ++i) {
+            put_ulong(idx_data, offsets[i]);
+        }
+
+        std::unique_lock<std::mutex> lock(view_lock_);
+        wait_for_readers(lock);
+        std::unique_lock<std::mutex> alloc_lock(alloc_lock_);
+        wait_for_allocation(alloc_lock);
+        data_file_.unmap();
+        if (!data_file_.truncate(pos) || !idx_file_.truncate(0) || (idx_data.size() > 0 && !idx_file_.write(0, &idx_data[0], idx_data.size()))) {
+            throw std::runtime_error("IO fails, failed to recover the segment");
+        }
+
+        entries_ = written_entries_ = offsets.size();
+        data_size_ = written_data_size_ = allocated_size_ = write_end_ = pos;
+        idx_allocated_size_ = idx_write_end_ = idx_data.size();
+        offsets_.swap(offsets);
+        view_data_size_ = written_data_size_;
+        unsynced_ = true;
+        map_view();
+    }
+
+    // releases the space of the entries before index, which are compacted, the entries could no longer be read,
+    // the space is released in whole blocks, a block that is shared with the first remaining record is kept
+    void release(ulong index) {
+        if (index <= start_idx_ || index >= next_idx()) {
+            return;
+        }
+
+        ulong local_idx = index - start_idx_;
+        ulong release_end = offset_of(local_idx) & ~static_cast<ulong>(DIRECT_IO_ALIGNMENT - 1);
+        if (local_idx > written_entries_ || release_end > written_data_size_) {
+            return;
+        }
+
+        // the readers of the released entries must be done before the space is gone
+        std::unique_lock<std::mutex> lock(view_lock_);
+        wait_for_readers(lock);
+        released_entries_ = std::max(released_entries_, local_idx);
+        if (release_end > released_size_ && data_file_.punch_hole(released_size_, release_end - released_size_)) {
+            released_size_ = release_end;
+        }
+    }
+
+    // trims the preallocated space of the files, once the segment is no longer the last one or it's closed
+    void seal() {
+        flush();
+        ulong idx_size = written_entries_ * sz_ulong;
+        std::unique_lock<std::mutex> lock(alloc_lock_);
+        wait_for_allocation(lock);
+        space_wanted_ = false;
+        if (allocated_size_ <= written_data_size_ && idx_allocated_size_ <= idx_size) {
+            return;
+        }
+
+        // the view covers the written data only, which is not changed, so the readers are not waited
+        if (!data_file_.truncate(written_data_size_) || !idx_file_.truncate(idx_size)) {
+            throw std::runtime_error("IO fails, failed to trim the segment");
+        }
+
+        allocated_size_ = written_data_size_;
+        idx_allocated_size_ = idx_size;
+        unsynced_ = true;
+    }
+
+    void close() {
+        flush();
+        std::unique_lock<std::mutex> lock(view_lock_);
+        wait_for_readers(lock);
+        offsets_.clear();
+        view_data_size_ = 0;
+        idx_file_.close();
+        data_file_.close();
+    }
+
+    // removes the files, the opened files are closed when the segment is released,
+    // as the segment could still be syncing or read
+    void remove() {
+        pending_idx_.clear();
+        pending_data_.clear();
+        std::remove(idx_path_.c_str());
+        std::remove(data_path_.c_str());
+    }
+
+private:
+    // a reader of the view, the view is not changed until all readers are gone
+    class view_reader {
+    public:
+        view_reader(log_segment& seg, ulong local_idx)
+            : seg_(seg), valid_(false), data_start_(0), data_end_(0) {
+            auto_lock(seg_.view_lock_);
+            seg_.readers_ += 1;
+            if (seg_.offsets_loaded_ && local_idx < seg_.offsets_.size() && local_idx >= seg_.released_entries_) {
+                valid_ = true;
+                data_start_ = seg_.offsets_[static_cast<size_t>(local_idx)];
+                data_end_ = local_idx + 1 < seg_.offsets_.size() ? seg_.offsets_[static_cast<size_t>(local_idx + 1)] : seg_.view_data_size_;
+            }
+        }
+
+        ~view_reader() {
+            auto_lock(seg_.view_lock_);
+            if (--seg_.readers_ == 0) {
+                seg_.view_cv_.notify_all();
+            }
+        }
+
+        __nocopy__(view_reader)
+
+    public:
+        bool valid() const {
+            return valid_;
+        }
+
+        ulong data_start() const {
+            return data_start_;
+        }
+
+        ulong data_end() const {
+            return data_end_;
+        }
+
+    private:
+        log_segment& seg_;
+        bool valid_;
+        ulong data_start_;
+        ulong data_end_;
+    };
+
+    // makes the written entries visible to the readers, the data file is remapped if the view is too small,
+    // new_idx has the index file data of the entries that are just written
+    void publish(const byte* new_idx) {
+        std::unique_lock<std::mutex> lock(view_lock_);
+        if (written_data_size_ > data_file_.view_size() || data_file_.view() == nilptr) {
+            wait_for_readers(lock);
+            map_view();
+        }
+
+        // the offsets that are not loaded yet are read from the index file once they are loaded
+        size_t first = offsets_.size();
+        for (size_t i = first; offsets_loaded_ && i < written_entries_; ++i) {
+            offsets_.push_back(static_cast<uint>(get_ulong(new_idx + (i - first) * sz_ulong)));
+        }
+
+        view_data_size_ = written_data_size_;
+    }
+
+    // view_lock_ must be held and there must be no readers
+    void map_view() {
+        if (written_data_size_ <= data_file_.view_size() && data_file_.view() != nilptr) {
+            return;
+        }
+
+        // reserve some room for the file to grow, the view doubles to keep the remapping rare
+        ulong view_size = std::max(written_data_size_, std::max(data_file_.view_size() * 2, static_cast<ulong>(1024 * 1024)));
+        if (!data_file_.map(view_size)) {
+            throw std::runtime_error("fail to map the segment files");
+        }
+    }
+
+    ulong header_size() const {
+        return framed_ ? record_header_size : 0;
+    }
+
+    // appends the offsets to the index file and the records to the data file, through the io ring if there is one,
+    // the two writes are submitted together then
+    bool write_files(const byte* idx_data, size_t idx_len, const byte* data, size_t data_len) {
+        reserve(written_data_size_ + data_len, written_entries_ * sz_ulong + idx_len);
+        if (write_ring_ != nilptr) {
+            std::vector<io_ring::write_op> ops;
+            ops.push_back(io_ring::write_op(idx_file_.fd(), written_entries_ * sz_ulong, idx_data, idx_len));
+            ulong data_offset = written_data_size_;
+            if (data_len > 0 && !data_file_.stage_write(data_offset, data, data_len)) {
+                return false;
+            }
+
+            if (data_len > 0) {
+                ops.push_back(io_ring::write_op(data_file_.fd(), data_offset, data, data_len));
+            }
+
+            if (!write_ring_->write(ops)) {
+                return false;
+            }
+
+            if (data_len > 0) {
+                data_file_.staged_written();
+            }
+
+            return true;
+        }
+
+        return idx_file_.write(written_entries_ * sz_ulong, idx_data, idx_len) &&
+            (data_len == 0 || data_file_.write(written_data_size_, data, data_len));
+    }
+
+    // the writes up to end of the data file and idx_end of the index file are about to start, they only wait
+    // if they run into the chunk that is being allocated, the next chunk is wanted once less than half a chunk is left
+    void reserve(ulong end, ulong idx_end) {
+        std::unique_lock<std::mutex> lock(alloc_lock_);
+        while (allocating_ && (end > allocated_size_ || idx_end > idx_allocated_size_)) {
+            alloc_cv_.wait(lock);
+        }
+
+        // the space that is written beyond the allocated space grows the files, the next chunk starts after it
+        write_end_ = std::max(write_end_, end);
+        idx_write_end_ = std::max(idx_write_end_, idx_end);
+        if (preallocate_size_ > 0 && ((end + preallocate_size_ / 2 > allocated_size_ && allocated_size_ < space_limit_) || idx_end + idx_chunk() / 2 > idx_allocated_size_)) {
+            space_wanted_ = true;
+        }
+    }
+
+    ulong idx_chunk() const {
+        return std::max(preallocate_size_ / 8, static_cast<ulong>(DIRECT_IO_ALIGNMENT));
+    }
+
+    // alloc_lock_ must be held
+    void wait_for_allocation(std::unique_lock<std::mutex>& lock) {
+        while (allocating_) {
+            alloc_cv_.wait(lock);
+        }
+    }
+
+    // the data file could be longer than the records if its space is preallocated, the data ends
+    // at the end of the last record then, which starts at last_offset
+    void trim_preallocated(ulong last_offset) {
+        if (!framed_ || written_data_size_ <= data_start_) {
+            return;
+        }
+
+        ulong data_end = data_start_;
+        byte header[record_header_size];
+        if (written_entries_ > 0 && last_offset + record_header_size <= written_data_size_) {
+            if (!data_file_.read(last_offset, header, record_header_size)) {
+                throw std::runtime_error("IO fails, data cannot be read");
+            }
+
+            data_end = last_offset + record_header_size + record_len(get_uint(header));
+        }
+
+        // a broken tail is left to recover()
+        if (data_end < written_data_size_) {
+            data_size_ = written_data_size_ = data_end;
+        }
+    }
+
+    void wait_for_readers(std::unique_lock<std::mutex>& lock) {
+        while (readers_ > 0) {
+            view_cv_.wait(lock);
+        }
+    }
+
+    ulong offset_of(ulong local_idx) {
+        if (local_idx >= written_entries_) {
+            return get_ulong(&pending_idx_[static_cast<size_t>(local_idx - written_entries_) * sz_ulong]);
+        }
+
+        load_offsets();
+        return offsets_[static_cast<size_t>(local_idx)];
+    }
+
+    ulong read_offset(ulong local_idx) {
+        byte data[sz_ulong];
+        if (!idx_file_.read(local_idx * sz_ulong, data, sz_ulong)) {
+            throw std::runtime_error("IO fails, index cannot be read");
+        }
+
+        return get_ulong(data);
+    }
+
+private:
+    std::string idx_path_;
+    std::string data_path_;
+    log_file idx_file_;
+    log_file data_file_;
+    std::vector<byte> pending_idx_;
+    std::vector<byte> pending_data_;
+    ulong start_idx_;
+    ulong entries_;
+    ulong data_size_;
+    ulong written_entries_;
+    ulong written_data_size_;
+    bool unsynced_;
+    std::mutex view_lock_;
+    std::condition_variable view_cv_;
+    int32 readers_;
+    std::vector<uint> offsets_;
+    bool offsets_loaded_;
+    ulong view_data_size_;
+    bool framed_;
+    ulong data_start_;
+    io_ring* write_ring_;
+    io_ring* sync_ring_;
+    ulong allocated_size_;
+    ulong idx_allocated_size_;
+    ulong preallocate_size_;
+    ulong space_limit_;
+    std::mutex alloc_lock_;
+    std::condition_variable alloc_cv_;
+    bool allocating_;
+    bool space_wanted_;
+    ulong write_end_;
+    ulong idx_write_end_;
+    ulong released_entries_;
+    ulong released_size_;
+    log_codec* codec_;
+    std::vector<byte> compressed_;
+};
+
+fs_log_store::~fs_log_store() {
+    close();
+    recur_lock(store_lock_);
+    if (buf_ != nilptr) {
+        delete buf_;
+    }
+
+    // the segments use the io rings
+    segments_.clear();
+    if (write_ring_ != nilptr) {
+        delete write_ring_;
+    }
+
+    if (sync_ring_ != nilptr) {
+        delete sync_ring_;
+    }
+}
+
+fs_log_store::fs_log_store(const std::string& log_folder, ulong cache_size, ulong segment_size, durability_policy durability, int32 sync_interval, bool direct_io, ptr<log_codec> codec)
+    : fs_log_store(log_folder, cache_size, segment_size, durability, sync_interval, direct_io, codec, false) {
+}
+
+fs_log_store::fs_log_store(const std::string& log_folder, ulong cache_size, ulong segment_size, durability_policy durability, int32 sync_interval, bool direct_io, ptr<log_codec> codec, bool use_io_ring)
+    : segments_(),
+    entries_in_store_(0), 
+    start_idx_(1), 
+    checkpoint_idx_(0),
+    header_version_(0),
+    runs_end_(0),
+    segment_size_(segment_size),
+    log_folder_(log_folder), 
+    store_lock_(), 
+    buf_(nilptr), 
+    write_ring_(nilptr),
+    sync_ring_(nilptr),
+    cache_size_(cache_size),
+    cache_hits_(0),
+    cache_misses_(0),
+    durability_(durability),
+    sync_interval_(sync_interval > 0 ? sync_interval : 1),
+    direct_io_(direct_io),
+    codec_(codec),
+    durable_idx_(0),
+    truncate_gen_(0),
+    syncing_(false),
+    stopping_(false),
+    space_wanted_(false),
+    sync_lock_(),
+    sync_cv_(),
+    bg_cv_(),
+    durable_handler_(),
+    waiters_(),
+    sync_thread_() {
+    // a segment keeps 32 bits offsets, the last entry could take up to 2GB beyond the segment size
+    if (segment_size_ > max_segment_size) {
+        throw std::range_error("segment size is too large");
+    }
+
+    if (log_folder_.length() > 0 && log_folder_[log_folder_.length() - 1] != PATH_SEPARATOR) {
+        log_folder_.push_back(PATH_SEPARATOR);
+    }
+
+    // the writes and the syncs go through two rings, so that the appends are not blocked by a sync
+    if (use_io_ring) {
+        write_ring_ = new io_ring();
+        try {
+            sync_ring_ = new io_ring();
+        }
+        catch (...) {
+            delete write_ring_;
+            throw;
+        }
+    }
+
+    std::vector<ulong> seg_starts;
+    ulong checkpoint_term = 0;
+    bool has_header = load_header(seg_starts, checkpoint_term);
+    if (!has_header) {
+        load_legacy_files(seg_starts);
+    }
+
+    load_segments(seg_starts);
+
+    // only the last segment could be left with broken records by a crash, drop them, the records before the checkpoint
+    // are durable, so only the checkpoint record and the ones after it are checked
+    segments_.back()->recover(std::max(start_idx_, checkpoint_idx_));
+    if (segments_.back()->next_idx() < start_idx_) {
+        throw std::runtime_error("bad store files, the segments don't have the start index");
+    }
+
+    frame_last_segment();
+    entries_in_store_ = segments_.back()->next_idx() - start_idx_;
+
+    // the space of the compacted entries is released again, in case the store was stopped before it was done
+    segments_.front()->release(start_idx_);
+
+    // the buffer is warmed lazily by the new entries, it starts with the last entry only, so opening
+    // the store doesn't read the whole log, the older entries are read from the segments on demand
+    buf_ = new log_store_buffer(entries_in_store_ > 0 ? start_idx_ + entries_in_store_ - 1 : start_idx_, cache_size_);
+    fill_buffer();
+    load_term_runs();
+
+    // the checkpoint entry must be the one that was durable when the header was saved
+    if (has_header && checkpoint_idx_ >= start_idx_ && checkpoint_idx_ < start_idx_ + entries_in_store_) {
+        // IMPORTANT!! 
+        // We hack the log_entry serialization details here
+        ptr<buffer> entry_buf(read_entry(checkpoint_idx_));
+        if (entry_buf->get_ulong() != checkpoint_term) {
+            throw std::runtime_error("bad store files, the checkpoint doesn't match the entries");
+        }
+    }
+
+    // whatever is found in the files is taken as durable, the entries after the checkpoint are synced before
+    // the new checkpoint covers them
+    durable_idx_ = start_idx_ + entries_in_store_ - 1;
+    for (size_t i = 0; i < segments_.size() && durability_ != no_sync; ++i) {
+        if (segments_[i]->next_idx() > checkpoint_idx_ + 1) {
+            segments_[i]->sync();
+        }
+    }
+
+    save_header();
+    if (!has_header) {
+        std::remove((log_folder_ + LOG_START_INDEX_FILE).c_str());
+        std::remove((log_folder_ + LOG_MANIFEST_FILE).c_str());
+        std::remove((log_folder_ + LOG_TERM_RUNS_FILE).c_str());
+    }
+
+    sync_thread_ = std::thread(std::bind(&fs_log_store::sync_in_bg, this));
+}
+
+ulong fs_log_store::next_slot() const {
+    recur_lock(store_lock_);
+    return start_idx_ + entries_in_store_;
+}
+
+ulong fs_log_store::start_index() const {
+    recur_lock(store_lock_);
+    return start_idx_;
+}
+
+ptr<log_entry> fs_log_store::last_entry() const {
+    ptr<log_entry> entry = buf_->last_entry();
+    if (entry == nilptr) {
+        return empty_entry;
+    }
+
+    return entry;
+}
+
+ulong fs_log_store::append(ptr<log_entry>& entry) {
+    ulong index = append_entry(entry);
+    commit_writes(index);
+    return index;
+}
+
+ulong fs_log_store::append_batch(std::vector<ptr<log_entry>>& entries) {
+    ulong first_idx = 0;
+    {
+        recur_lock(store_lock_);
+        first_idx = start_idx_ + entries_in_store_;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            append_entry(entries[i]);
+        }
+    }
+
+    // all staged entries go to the files by one write for each file
+    if (entries.size() > 0) {
+        commit_writes(first_idx + entries.size() - 1);
+    }
+
+    return first_idx;
+}
+
+ptr<async_result<ulong>> fs_log_store::append_async(std::vector<ptr<log_entry>>& entries) {
+    ptr<async_result<ulong>> result(cs_new<async_result<ulong>>());
+    ulong last_idx = 0;
+    {
+        recur_lock(store_lock_);
+        for (size_t i = 0; i < entries.size(); ++i) {
+            append_entry(entries[i]);
+        }
+
+        last_idx = start_idx_ + entries_in_store_ - 1;
+    }
+
+    // the background thread writes and syncs the entries, the result is set once they are durable,
+    // the durable index is checked with the sync lock held, the same lock that the waiters are completed with
+    {
+        auto_lock(sync_lock_);
+        if (durable_idx_ < last_idx) {
+            waiters_.push_back(std::make_pair(last_idx, result));
+            bg_cv_.notify_all();
+            return result;
+        }
+    }
+
+    ptr<std::exception> no_err;
+    result->set_result(last_idx, no_err);
+    return result;
+}
+
+void fs_log_store::write_at(ulong index, ptr<log_entry>& entry) {
+    {
+        recur_lock(store_lock_);
+        if (index < start_idx_ || index > start_idx_ + entries_in_store_) {
+            throw std::range_error("index out of range");
+        }
+
+        if (index - start_idx_ < entries_in_store_) {
+            truncate_from(index);
+        }
+
+        append_entry(entry);
+    }
+
+    commit_writes(index);
+}
+
+void fs_log_store::truncate(ulong index) {
+    recur_lock(store_lock_);
+    if (index < start_idx_ || index > start_idx_ + entries_in_store_) {
+        throw std::range_error("index out of range");
+    }
+
+    if (index - start_idx_ < entries_in_store_) {
+        truncate_from(index);
+    }
+}
+
+ptr<std::vector<ptr<log_entry>>> fs_log_store::log_entries(ulong start, ulong end) {
+    ulong lstart(0), lend(0), good_end(0);
+    {
+        recur_lock(store_lock_);
+        if (start < start_idx_) {
+            throw std::range_error("index out of range");
+        }
+
+        if (start >= end || start >= (start_idx_ + entries_in_store_)) {
+            return ptr<std::vector<ptr<log_entry>>>();
+        }
+
+        lstart = start - start_idx_;
+        lend = end - start_idx_;
+        lend = lend > entries_in_store_ ? entries_in_store_ : lend;
+        good_end = lend + start_idx_;
+    }
+
+    if (lstart >= lend) {
+        return ptr<std::vector<ptr<log_entry>>>();
+    }
+
+    ptr<std::vector<ptr<log_entry>>> results(cs_new<std::vector<ptr<log_entry>>>());
+
+    // fill with the buffer, the entries that are not in the buffer are read from the segments
+    buf_->fill(start, good_end, *results);
+    ulong missed = 0;
+    for (ulong idx = start; idx < good_end; ++idx) {
+        ptr<log_entry>& entry = (*results)[static_cast<size_t>(idx - start)];
+        if (entry) {
+            continue;
+        }
+
+        ptr<buffer> entry_buf(read_entry(idx));
+        if (!entry_buf) {
+            // the store is truncated meanwhile
+            results->resize(static_cast<size_t>(idx - start));
+            break;
+        }
+
+        missed += 1;
+        entry = log_entry::deserialize(*entry_buf);
+    }
+
+    cache_hits_ += results->size() - missed;
+    cache_misses_ += missed;
+    return results;
+}
+
+ptr<log_entry> fs_log_store::entry_at(ulong index) {
+    ptr<log_entry> entry = (*buf_)[index];
+    if (entry) {
+        cache_hits_ += 1;
+        return entry;
+    }
+
+    cache_misses_ += 1;
+    // since we don't hit the buffer, so this must not be the last entry 
+    // (according to Assumption: buffer.last_index() == entries_in_store_ + start_idx_)
+    ptr<buffer> entry_buf(read_entry(index));
+    if (!entry_buf) {
+        return ptr<log_entry>();
+    }
+
+    return log_entry::deserialize(*entry_buf);
+}
+
+ulong fs_log_store::term_at(ulong index) {
+    recur_lock(store_lock_);
+    if (index < start_idx_) {
+        throw std::range_error("index out of range");
+    }
+
+    if (index >= start_idx_ + entries_in_store_) {
+        return 0;
+    }
+
+    // the last run that starts at or before index
+    std::vector<std::pair<ulong, ulong>>::const_iterator it = std::upper_bound(
+        term_runs_.begin(),
+        term_runs_.end(),
+        std::make_pair(index, std::numeric_limits<ulong>::max()));
+    return (--it)->second;
+}
+
+ulong fs_log_store::first_index_of_term(ulong index) {
+    recur_lock(store_lock_);
+    if (index < start_idx_ || index >= start_idx_ + entries_in_store_) {
+        throw std::range_error("index out of range");
+    }
+
+    // the run that has index, the runs before it with the same term belong to the term as well
+    std::vector<std::pair<ulong, ulong>>::const_iterator it = std::upper_bound(
+        term_runs_.begin(),
+        term_runs_.end(),
+        std::make_pair(index, std::numeric_limits<ulong>::max()));
+    --it;
+    while (it != term_runs_.begin() && (it - 1)->second == it->second) {
+        --it;
+    }
+
+    return std::max(it->first, start_idx_);
+}
+
+ptr<buffer> fs_log_store::pack(ulong index, int32 cnt) {
+    recur_lock(store_lock_);
+    if (index < start_idx_) {
+        throw std::range_error("index out of range");
+    }
+
+    ulong offset = index - start_idx_;
+    if (offset >= entries_in_store_) {
+        return ptr<buffer>();
+    }
+
+    // pack format, int32 idx_len, int32 data_len, idx_len bytes of offsets and data_len bytes of log records,
+    // the offsets are relative to the beginning of the log records, as the entries may come from different segments,
+    // the entries of the segments without records are framed into records while being packed
+    ulong end_idx = start_idx_ + std::min(offset + cnt, entries_in_store_);
+    size_t idx_len = static_cast<size_t>(end_idx - index) * sz_ulong;
+    std::vector<std::pair<ptr<log_segment>, std::vector<ulong>>> ranges;
+    ulong data_len = 0;
+    for (ulong idx = index; idx < end_idx;) {
+        ptr<log_segment>& seg = segment_of(idx);
+        ulong seg_end = std::min(end_idx, seg->next_idx());
+        std::vector<ulong> offsets;
+        seg->offsets(idx, seg_end, offsets);
+        data_len += offsets.back() - offsets.front() + (seg->framed() ? 0 : (seg_end - idx) * record_header_size);
+        ranges.push_back(std::make_pair(seg, offsets));
+        idx = seg_end;
+    }
+
+    ptr<buffer> result = buffer::alloc(2 * sz_int + idx_len + static_cast<size_t>(data_len));
+    result->put(static_cast<int32>(idx_len));
+    result->put(static_cast<int32>(data_len));
+    ulong data_pos = 0;
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        std::vector<ulong>& offsets = ranges[i].second;
+        ulong header = ranges[i].first->framed() ? 0 : record_header_size;
+        for (size_t j = 0; j < offsets.size() - 1; ++j) {
+            result->put(data_pos);
+            data_pos += offsets[j + 1] - offsets[j] + header;
+        }
+    }
+
+    // the records are copied once, from the segments straight into the pack
+    byte* data = result->data();
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        std::vector<ulong>& offsets = ranges[i].second;
+        if (ranges[i].first->framed()) {
+            size_t len = static_cast<size_t>(offsets.back() - offsets.front());
+            ranges[i].first->read_data(offsets.front(), data, len);
+            data += len;
+            continue;
+        }
+
+        for (size_t j = 0; j < offsets.size() - 1; ++j) {
+            size_t len = static_cast<size_t>(offsets[j + 1] - offsets[j]);
+            ranges[i].first->read_data(offsets[j], data + record_header_size, len);
+            put_record_header(data, data + record_header_size, static_cast<uint>(len));
+            data += record_header_size + len;
+        }
+    }
+
+    result->pos(0);
+    return result;
+}
+
+void fs_log_store::apply_pack(ulong index, buffer& pack) {
+    ulong last_idx = 0;
+    {
+        recur_lock(store_lock_);
+        apply_pack_entries(index, pack);
+        last_idx = start_idx_ + entries_in_store_ - 1;
+    }
+
+    commit_writes(last_idx);
+}
+
+void fs_log_store::apply_pack_entries(ulong index, buffer& pack) {
+    if (index < start_idx_ || index > start_idx_ + entries_in_store_) {
+        throw std::range_error("index out of range");
+    }
+
+    // the pack comes from the wire, its index and data must fit in what is left of it before anything is read from them
+    int32 idx_len = pack.get_int();
+    int32 data_len = pack.get_int();
+    if (idx_len < 0 || data_len < 0 || idx_len % sz_ulong != 0 ||
+        static_cast<ulong>(idx_len) + static_cast<ulong>(data_len) > static_cast<ulong>(pack.size() - pack.pos())) {
+        throw std::runtime_error("bad log pack, the index or data length is out of range");
+    }
+
+    size_t cnt = static_cast<size_t>(idx_len) / sz_ulong;
+    std::vector<ulong> offsets;
+    for (size_t i = 0; i < cnt; ++i) {
+        offsets.push_back(pack.get_ulong());
+        if (i > 0 && offsets[i] <= offsets[i - 1]) {
+            throw std::runtime_error("bad log pack, the log offsets are not increasing");
+        }
+    }
+
+    // the offsets in the pack may not start from zero (packed by a store without segments), rebase them
+    ulong base = cnt > 0 ? offsets[0] : 0;
+    if (cnt > 0 && offsets[cnt - 1] - base > static_cast<ulong>(data_len)) {
+        throw std::runtime_error("bad log pack, the log offsets are beyond the data");
+    }
+
+    offsets.push_back(base + static_cast<ulong>(data_len));
+    const byte* data = pack.data();
+    for (size_t i = 0; i < cnt; ++i) {
+        const byte* record = data + (offsets[i] - base);
+        if (offsets[i + 1] - offsets[i] < record_header_size + sz_ulong || !valid_record(record, offsets[i + 1] - offsets[i])) {
+            throw std::runtime_error("bad log pack, the log record is broken");
+        }
+
+        // a compressed entry must be readable by this store
+        if ((get_uint(record) & compressed_record) != 0 &&
+            (record_len(get_uint(record)) < compressed_entry_header_size || codec_of(record[record_header_size + sz_ulong + 1], codec_.get()) == nilptr)) {
+            throw std::runtime_error("bad log pack, the log record has an unknown codec");
+        }
+    }
+
+    if (index - start_idx_ < entries_in_store_) {
+        truncate_from(index);
+    }
+
+    // the records are written straight from the pack to the segments, as many as the segment could take in one write
+    ulong first_idx = start_idx_ + entries_in_store_;
+    for (size_t i = 0; i < cnt;) {
+        if (segments_.back()->data_size() >= segment_size_) {
+            roll_segment();
+        }
+
+        size_t first = i;
+        ulong seg_data_size = segments_.back()->data_size();
+        std::vector<ulong> sizes;
+        for (; i < cnt && seg_data_size < segment_size_; ++i) {
+            // IMPORTANT!! 
+            // We hack the log_entry serialization details here
+            track_term(start_idx_ + entries_in_store_ + sizes.size(), get_ulong(data + (offsets[i] - base) + record_header_size));
+            sizes.push_back(offsets[i + 1] - offsets[i]);
+            seg_data_size += sizes.back();
+        }
+
+        segments_.back()->write_direct(data + (offsets[first] - base), sizes);
+        entries_in_store_ += sizes.size();
+    }
+
+    // only the entries that stay in the buffer are deserialized, the serialized size of an entry is the size it takes in the buffer
+    size_t first_cached = cnt;
+    ulong cached_bytes = 0;
+    while (first_cached > 0) {
+        ulong size = offsets[first_cached] - offsets[first_cached - 1] - record_header_size;
+        if (first_cached < cnt && cached_bytes + size > cache_size_) {
+            break;
+        }
+
+        cached_bytes += size;
+        first_cached -= 1;
+    }
+
+    if (first_cached > 0) {
+        buf_->reset(first_idx + first_cached);
+    }
+
+    for (size_t i = first_cached; i < cnt; ++i) {
+        ptr<log_entry> entry(entry_of(data + (offsets[i] - base), codec_.get()));
+        buf_->append(entry);
+    }
+}
+
+bool fs_log_store::compact(ulong last_log_index) {
+    recur_lock(store_lock_);
+    if (last_log_index < start_idx_) {
+        throw std::range_error("index out of range");
+    }
+
+    ulong new_start_idx = last_log_index + 1;
+    std::vector<ptr<log_segment>> removed;
+    if (new_start_idx >= start_idx_ + entries_in_store_) {
+        // all entries are compacted, start over with a new segment
+        ptr<log_segment> seg(new_segment(new_start_idx, true));
+        removed.swap(segments_);
+        segments_.push_back(seg);
+        entries_in_store_ = 0;
+    }
+    else {
+        // drop all segments that are fully covered by the compaction
+        size_t cnt = 0;
+        while (cnt < segments_.size() && segments_[cnt]->next_idx() <= new_start_idx) {
+            ++cnt;
+        }
+
+        removed.insert(removed.end(), segments_.begin(), segments_.begin() + cnt);
+        segments_.erase(segments_.begin(), segments_.begin() + cnt);
+        entries_in_store_ -= new_start_idx - start_idx_;
+    }
+
+    start_idx_ = new_start_idx;
+    if (durable_idx_ < start_idx_ - 1) {
+        durable_idx_ = start_idx_ - 1;
+    }
+
+    if (entries_in_store_ == 0) {
+        buf_->reset(start_idx_);
+        term_runs_.clear();
+    }
+    else {
+        buf_->compact(start_idx_);
+
+        // keep the run that has the new start index and the runs after it
+        std::vector<std::pair<ulong, ulong>>::iterator it = std::upper_bound(
+            term_runs_.begin(),
+            term_runs_.end(),
+            std::make_pair(start_idx_, std::numeric_limits<ulong>::max()));
+        term_runs_.erase(term_runs_.begin(), --it);
+        term_runs_.front().first = start_idx_;
+    }
+
+    // the header goes first, so that a crash before the segments are removed only leaves some
+    // segments that could be cleaned up on next open
+    save_header();
+    for (size_t i = 0; i < removed.size(); ++i) {
+        removed[i]->remove();
+    }
+
+    // the compacted entries of the first segment are not copied away, their space is released instead
+    segments_.front()->release(start_idx_);
+    return true;
+}
+
+ulong fs_log_store::cache_hits() const {
+    return cache_hits_;
+}
+
+ulong fs_log_store::cache_misses() const {
+    return cache_misses_;
+}
+
+ulong fs_log_store::cache_bytes() const {
+    return buf_->bytes();
+}
+
+ulong fs_log_store::durable_index() const {
+    return durable_idx_;
+}
+
+void fs_log_store::sync(ulong index) {
+    std::unique_lock<std::mutex> lock(sync_lock_);
+    while (durable_idx_ < index) {
+        if (syncing_) {
+            // some other thread is writing and syncing, which may cover the index too
+            sync_cv_.wait(lock);
+            continue;
+        }
+
+        syncing_ = true;
+        lock.unlock();
+        bool synced = false;
+        try {
+            synced = flush_and_sync();
+        }
+        catch (...) {
+            lock.lock();
+            syncing_ = false;
+            sync_cv_.notify_all();
+            throw;
+        }
+
+        lock.lock();
+        syncing_ = false;
+        sync_cv_.notify_all();
+        if (synced && durable_idx_ < index) {
+            // index is not in the store
+            break;
+        }
+    }
+}
+
+void fs_log_store::set_durable_handler(const durable_handler& handler) {
+    recur_lock(store_lock_);
+    durable_handler_ = handler;
+}
+
+void fs_log_store::close() {
+    {
+        auto_lock(sync_lock_);
+        stopping_ = true;
+        bg_cv_.notify_all();
+    }
+
+    if (sync_thread_.joinable()) {
+        sync_thread_.join();
+    }
 
-using namespace cornerstone;
-ptr<buffer> zero_buf;
-ptr<log_entry> empty_entry(cs_new<log_entry>(0, zero_buf, log_val_type::app_log));
+    recur_lock(store_lock_);
+    for (size_t i = 0; i < segments_.size(); ++i) {
+        segments_[i]->seal();
+        if (segments_[i]->take_unsynced() && durability_ != no_sync) {
+            segments_[i]->sync();
+        }
 
-class cornerstone::log_store_buffer {
-public:
-    typedef std::vector<ptr<log_entry>>::const_iterator const_buf_itor;
-    typedef std::vector<ptr<log_entry>>::iterator buf_itor;
-public:
-    log_store_buffer(ulong start_idx, int32 max_size)
-        : buf_(), lock_(), start_idx_(start_idx), max_size_(max_size) {
+        segments_[i]->close();
     }
 
-    ulong last_idx() {
-        recur_lock(lock_);
-        return start_idx_ + buf_.size();
+    // all entries are durable now, as far as the durability policy goes, the header checkpoints them,
+    // unless it's done by a close before
+    ulong last_idx = start_idx_ + entries_in_store_ - 1;
+    durable_idx_ = last_idx;
+    if (runs_end_ != last_idx || (durability_ != no_sync && checkpoint_idx_ != last_idx)) {
+        save_header();
     }
 
-    ulong first_idx() {
-        recur_lock(lock_);
-        return start_idx_;
+    complete_waiters(last_idx, ptr<std::exception>());
+}
+
+ulong fs_log_store::append_entry(ptr<log_entry>& entry) {
+    recur_lock(store_lock_);
+    if (segments_.back()->data_size() >= segment_size_) {
+        roll_segment();
     }
 
-    ptr<log_entry> last_entry() {
-        recur_lock(lock_);
-        if (buf_.size() > 0) {
-            return buf_[buf_.size() - 1];
-        }
+    ptr<buffer> entry_buf = entry->serialize();
+    track_term(start_idx_ + entries_in_store_, entry->get_term());
+    segments_.back()->append(*entry_buf);
+    buf_->append(entry);
+    entries_in_store_ += 1;
+    return start_idx_ + entries_in_store_ - 1;
+}
 
-        return ptr<log_entry>();
+void fs_log_store::commit_writes(ulong index) {
+    if (durability_ == per_batch_sync) {
+        sync(index);
+    }
+    else if (durability_ == no_sync) {
+        flush_and_sync();
     }
+}
 
-    ptr<log_entry> operator[](ulong idx) {
-        recur_lock(lock_);
-        size_t idx_within_buf = static_cast<size_t>(idx - start_idx_);
-        if (idx_within_buf >= buf_.size() || idx < start_idx_) {
-            return ptr<log_entry>();
+// writes all staged entries, syncs them unless the policy is no_sync and advances the durable index,
+// returns false if the store was truncated while syncing, in which case the durable index is not advanced
+bool fs_log_store::flush_and_sync() {
+    std::vector<ptr<log_segment>> unsynced;
+    ulong last_idx = 0;
+    ulong gen = 0;
+    bool wants_space = false;
+    {
+        recur_lock(store_lock_);
+        for (size_t i = 0; i < segments_.size(); ++i) {
+            segments_[i]->flush();
+            if (segments_[i]->take_unsynced()) {
+                unsynced.push_back(segments_[i]);
+            }
         }
 
-        return buf_[idx_within_buf];
+        last_idx = start_idx_ + entries_in_store_ - 1;
+        gen = truncate_gen_;
+        wants_space = segments_.back()->wants_space();
     }
 
-    // [start, end), returns the start_idx_;
-    ulong fill(ulong start, ulong end, std::vector<ptr<log_entry>>& result) {
-        recur_lock(lock_);
-        if (end < start_idx_) {
-            return start_idx_;
+    // the next chunk of the last segment is allocated by the background thread
+    if (wants_space) {
+        auto_lock(sync_lock_);
+        space_wanted_ = true;
+        bg_cv_.notify_all();
+    }
+
+    // sync outside the store lock, so that new entries could be staged meanwhile
+    if (durability_ != no_sync) {
+        for (size_t i = 0; i < unsynced.size(); ++i) {
+            unsynced[i]->sync();
         }
+    }
 
-        int offset = static_cast<int>(start - start_idx_);
-        if (offset > 0) {
-            for (int i = 0; i < static_cast<int>(end - start); ++i, ++offset) {
-                result.push_back(buf_[offset]);
-            }
+    durable_handler handler;
+    {
+        recur_lock(store_lock_);
+        if (gen != truncate_gen_) {
+            return false;
         }
-        else {
-            offset *= -1;
-            for (int i = 0; i < offset; ++i) {
-                result.push_back(ptr<log_entry>()); // make room for items that doesn't found in the buffer
-            }
 
-            for (int i = 0; i < static_cast<int>(end - start_idx_); ++i, ++offset) {
-                result.push_back(buf_[i]);
-            }
+        if (durable_idx_ >= last_idx) {
+            return true;
         }
 
-        return start_idx_;
+        durable_idx_ = last_idx;
+        handler = durable_handler_;
     }
 
-    ptr<buffer> pack(ulong start, int32 cnt) {
-        recur_lock(lock_);
-        size_t offset = static_cast<size_t>(start - start_idx_);
-        size_t good_cnt = static_cast<size_t>((size_t)cnt > buf_.size() - offset ? buf_.size() - offset : cnt);
-        std::vector<ptr<buffer>> buffers;
-        size_t size = 0;
-        for (size_t i = offset; i < offset + good_cnt; ++offset) {
-            ptr<buffer> buf = buf_[i]->serialize();
-            size += buf->size();
-        }
+    complete_waiters(last_idx, ptr<std::exception>());
+    if (handler) {
+        handler(last_idx);
+    }
+
+    return true;
+}
 
-        ptr<buffer> buf = buffer::alloc(size);
-        for (size_t i = 0; i < buffers.size(); ++i) {
-            buf->put(*buffers[i]);
+// sets the results of the waiting appends that have the last index <= index, the results are set without the lock
+void fs_log_store::complete_waiters(ulong index, ptr<std::exception> err) {
+    std::vector<std::pair<ulong, ptr<async_result<ulong>>>> completed;
+    {
+        auto_lock(sync_lock_);
+        std::vector<std::pair<ulong, ptr<async_result<ulong>>>> waiting;
+        for (size_t i = 0; i < waiters_.size(); ++i) {
+            if (waiters_[i].first <= index) {
+                completed.push_back(waiters_[i]);
+            }
+            else {
+                waiting.push_back(waiters_[i]);
+            }
         }
 
-        buf->pos(0);
-        return buf;
+        waiters_.swap(waiting);
+    }
+
+    for (size_t i = 0; i < completed.size(); ++i) {
+        completed[i].second->set_result(completed[i].first, err);
     }
+}
 
-    ulong get_term(ulong index) {
-        recur_lock(lock_);
-        if (index < start_idx_ || index >= start_idx_ + buf_.size()) {
-            return 0;
+// the background thread writes and syncs the entries of the async appends as soon as they are staged,
+// with interval_sync policy, it also writes and syncs all the staged entries periodically,
+// and it allocates the space of the last segment ahead of the writes once they ask for it
+void fs_log_store::sync_in_bg() {
+    std::unique_lock<std::mutex> lock(sync_lock_);
+    while (!stopping_) {
+        if (durability_ == interval_sync && !space_wanted_) {
+            bg_cv_.wait_for(lock, std::chrono::milliseconds(sync_interval_));
+        }
+        else if (waiters_.size() == 0 && !space_wanted_) {
+            bg_cv_.wait(lock);
         }
 
-        return buf_[static_cast<int>(index - start_idx_)]->get_term();
-    }
+        if (stopping_) {
+            break;
+        }
 
-    // trimming the buffer [start, end)
-    void trim(ulong start) {
-        recur_lock(lock_);
-        if (start < start_idx_) {
-            return;
+        ulong index = 0;
+        for (size_t i = 0; i < waiters_.size(); ++i) {
+            index = std::max(index, waiters_[i].first);
         }
 
-        size_t index = static_cast<size_t>(start - start_idx_);
-        if (index < buf_.size()) {
-            buf_.erase(buf_.begin() + index, buf_.end());
+        bool wants_space = space_wanted_;
+        space_wanted_ = false;
+        lock.unlock();
+        try {
+            sync(durability_ == interval_sync ? next_slot() - 1 : index);
+        }
+        catch (std::exception& ex) {
+            // the durable index stops advancing, for interval_sync, it will be retried in next round,
+            // the waiting appends are failed, as the entries may not be written
+            if (durability_ != interval_sync) {
+                complete_waiters(index, cs_new<std::runtime_error>(ex.what()));
+            }
         }
-    }
 
-    void append(ptr<log_entry>& entry) {
-        recur_lock(lock_);
-        buf_.push_back(entry);
-        if ((size_t)max_size_ < buf_.size()) {
-            buf_.erase(buf_.begin());
-            start_idx_ += 1;
+        // the space is allocated after the sync, so the waiting appends don't wait for the zero fill
+        if (wants_space) {
+            allocate_ahead();
         }
-    }
 
-    void reset(ulong start_idx) {
-        recur_lock(lock_);
-        buf_.clear();
-        start_idx_ = start_idx;
+        lock.lock();
     }
-private:
-    std::vector<ptr<log_entry>> buf_;
-    std::recursive_mutex lock_;
-    ulong start_idx_;
-    int32 max_size_;
-};
+}
 
-fs_log_store::~fs_log_store() {
-    recur_lock(store_lock_);
-    if (idx_file_) {
-        idx_file_.close();
+// the space of the last segment is allocated without the store lock, the segment could be sealed meanwhile,
+// then nothing is allocated, or the seal waits for the allocation that is started
+void fs_log_store::allocate_ahead() {
+    ptr<log_segment> seg;
+    {
+        recur_lock(store_lock_);
+        seg = segments_.back();
     }
 
-    if (data_file_) {
-        data_file_.close();
-    }
+    seg->allocate_ahead();
+}
 
-    if (start_idx_file_) {
-        start_idx_file_.close();
-    }
+// written entries are read through the mapped views of the segment files without holding the store lock,
+// so that reading old entries for the lagging peers doesn't block the appends,
+// returns null if index is not in the store
+ptr<buffer> fs_log_store::read_entry(ulong index) {
+    while (true) {
+        ptr<log_segment> seg;
+        {
+            recur_lock(store_lock_);
+            if (index < start_idx_) {
+                throw std::range_error("index out of range");
+            }
 
-    if (buf_ != nilptr) {
-        delete buf_;
+            if (index >= start_idx_ + entries_in_store_) {
+                return ptr<buffer>();
+            }
+
+            seg = segment_of(index);
+            if (!seg->written(index)) {
+                return seg->read(index);
+            }
+
+            seg->load_offsets();
+        }
+
+        ptr<buffer> entry_buf(seg->read_written(index));
+        if (entry_buf) {
+            return entry_buf;
+        }
+
+        // the segment is truncated after it's picked, try again
     }
 }
 
-fs_log_store::fs_log_store(const std::string& log_folder, int buf_size)
-    : idx_file_(), 
-    data_file_(), 
-    start_idx_file_(), 
-    entries_in_store_(0), 
-    start_idx_(1), 
-    log_folder_(log_folder), 
-    store_lock_(), 
-    buf_(nilptr), 
-    buf_size_(buf_size < 0 ? std::numeric_limits<int>::max() : buf_size) {
-    if (log_folder_.length() > 0 && log_folder_[log_folder_.length() - 1] != PATH_SEPARATOR) {
-        log_folder_.push_back(PATH_SEPARATOR);
+void fs_log_store::fill_buffer() {
+    for (ulong idx = buf_->last_idx(); idx < start_idx_ + entries_in_store_; ++idx) {
+        ptr<buffer> entry_buf(segment_of(idx)->read(idx));
+        ptr<log_entry> entry = log_entry::deserialize(*entry_buf);
+        buf_->append(entry);
     }
+}
 
-    idx_file_.open(log_folder_ + LOG_INDEX_FILE, std::fstream::in | std::fstream::out | std::fstream::binary | std::fstream::ate);
-    if (!idx_file_) {
-        // create the file and reopen
-        idx_file_.open(log_folder_ + LOG_INDEX_FILE, std::fstream::out);
-        idx_file_.close();
-        idx_file_.open(log_folder_ + LOG_INDEX_FILE, std::fstream::in | std::fstream::out | std::fstream::binary | std::fstream::ate);
+bool fs_log_store::load_header(std::vector<ulong>& seg_starts, ulong& checkpoint_term) {
+    std::string path = log_folder_ + LOG_HEADER_FILE;
+    if (!file_exists(path)) {
+        return false;
     }
 
-    data_file_.open(log_folder_ + LOG_DATA_FILE, std::fstream::in | std::fstream::out | std::fstream::binary | std::fstream::ate);
-    if (!data_file_) {
-        // create the file and reopen
-        data_file_.open(log_folder_ + LOG_DATA_FILE, std::fstream::out);
-        data_file_.close();
-        data_file_.open(log_folder_ + LOG_DATA_FILE, std::fstream::in | std::fstream::out | std::fstream::binary | std::fstream::ate);
+    log_file file;
+    if (!file.open(path, false)) {
+        throw std::runtime_error("fail to open the store header");
     }
 
-    start_idx_file_.open(log_folder_ + LOG_START_INDEX_FILE, std::fstream::in | std::fstream::out | std::fstream::binary | std::fstream::ate);
-    if (!start_idx_file_) {
-        start_idx_file_.open(log_folder_ + LOG_START_INDEX_FILE, std::fstream::out);
-        start_idx_file_.close();
-        start_idx_file_.open(log_folder_ + LOG_START_INDEX_FILE, std::fstream::in | std::fstream::out | std::fstream::binary | std::fstream::ate);
+    size_t size = static_cast<size_t>(file.size());
+    if (size < sz_ulong * 6 + sz_int * 3) {
+        throw std::runtime_error("bad store header, the header is too short");
     }
 
-    if (!idx_file_ || !data_file_ || !start_idx_file_) {
-        throw std::runtime_error("fail to create store files");
+    ptr<buffer> header(buffer::alloc(size));
+    byte* data = header->data();
+    if (!file.read(0, data, size)) {
+        throw std::runtime_error("IO fails, the store header cannot be read");
     }
 
-    if (start_idx_file_.tellp() > 0) {
-        start_idx_file_.seekg(0, std::fstream::beg);
-        ptr<buffer> idx_buf(buffer::alloc(sz_ulong));
-        start_idx_file_ >> *idx_buf;
-        start_idx_ = idx_buf->get_ulong();
-        entries_in_store_ = idx_file_.tellp() / sz_ulong;
-    }
-    else {
-        start_idx_ = 1;
-        ptr<buffer> idx_buf(buffer::alloc(sz_ulong));
-        idx_buf->put(start_idx_);
-        idx_buf->pos(0);
-        start_idx_file_.seekp(0, std::fstream::beg);
-        start_idx_file_ << *idx_buf;
-        entries_in_store_ = 0;
+    file.close();
+    if (crc32c(data, size - sz_int) != get_uint(data + size - sz_int)) {
+        throw std::runtime_error("bad store header, the checksum doesn't match");
     }
 
-    buf_ = new log_store_buffer(entries_in_store_ > (size_t)buf_size_ ? entries_in_store_ - buf_size_ + start_idx_ : start_idx_, buf_size_);
-    fill_buffer();
-}
-
-ulong fs_log_store::next_slot() const {
-    recur_lock(store_lock_);
-    return start_idx_ + entries_in_store_;
-}
-
-ulong fs_log_store::start_index() const {
-    recur_lock(store_lock_);
-    return start_idx_;
-}
+    if (header->get_ulong() != header_magic) {
+        throw std::runtime_error("bad store header, unknown format version");
+    }
 
-ptr<log_entry> fs_log_store::last_entry() const {
-    ptr<log_entry> entry = buf_->last_entry();
-    if (entry == nilptr) {
-        return empty_entry;
+    header_version_ = header->get_ulong();
+    start_idx_ = header->get_ulong();
+    checkpoint_idx_ = header->get_ulong();
+    checkpoint_term = header->get_ulong();
+    runs_end_ = header->get_ulong();
+    int32 seg_cnt = header->get_int();
+    for (int32 i = 0; i < seg_cnt; ++i) {
+        seg_starts.push_back(header->get_ulong());
     }
 
-    return entry;
-}
+    int32 run_cnt = header->get_int();
+    for (int32 i = 0; i < run_cnt; ++i) {
+        ulong start = header->get_ulong();
+        term_runs_.push_back(std::make_pair(start, header->get_ulong()));
+    }
 
-ulong fs_log_store::append(ptr<log_entry>& entry) {
-    recur_lock(store_lock_);
-    idx_file_.seekp(0, std::fstream::end);
-    data_file_.seekp(0, std::fstream::end);
-    ptr<buffer> idx_buf(buffer::alloc(sz_ulong));
-    idx_buf->put(static_cast<ulong>(data_file_.tellp()));
-    idx_buf->pos(0);
-    idx_file_ << *idx_buf;
-    ptr<buffer> entry_buf = entry->serialize();
-    data_file_ << *entry_buf;
-    buf_->append(entry);
-    entries_in_store_ += 1;
-    idx_file_.flush();
-    data_file_.flush();
-    if (!data_file_ || !idx_file_) {
-        throw std::runtime_error("IO fails, data cannot be saved");
+    if (seg_starts.size() == 0) {
+        throw std::runtime_error("bad store header, no segment is found");
     }
 
-    return start_idx_ + entries_in_store_ - 1;
+    return true;
 }
 
-void fs_log_store::write_at(ulong index, ptr<log_entry>& entry) {
-    recur_lock(store_lock_);
-    if (index < start_idx_ || index > start_idx_ + entries_in_store_) {
-        throw std::range_error("index out of range");
+// the older versions keep the start index in store.sti, the list of segments in the manifest file and the term runs
+// in store.trm, or all logs in store.idx and store.dat, those are read once, and replaced by the header
+void fs_log_store::load_legacy_files(std::vector<ulong>& seg_starts) {
+    ptr<buffer> buf(buffer::alloc(sz_ulong));
+    std::ifstream start_idx_file(log_folder_ + LOG_START_INDEX_FILE, std::ifstream::binary);
+    if (start_idx_file.read(reinterpret_cast<char*>(buf->data()), sz_ulong)) {
+        start_idx_ = buf->get_ulong();
     }
 
-    ulong local_idx = index - start_idx_ + 1; //start_idx is one based
-    ulong idx_pos = (local_idx - 1) * sz_ulong;
-    if (local_idx <= entries_in_store_) {
-        idx_file_.seekg(idx_pos, std::fstream::beg);
-        ptr<buffer> buf(std::move(buffer::alloc(sz_ulong)));
-        idx_file_ >> *buf;
-        data_file_.seekp(buf->get_ulong(), std::fstream::beg);
-    }
-    else {
-        data_file_.seekp(0, std::fstream::end);
-    }
-
-    idx_file_.seekp(idx_pos, std::fstream::beg);
-    ulong data_pos = data_file_.tellp();
-    ptr<buffer> ibuf(std::move(buffer::alloc(sz_ulong)));
-    ibuf->put(data_pos);
-    ibuf->pos(0);
-    idx_file_ << *ibuf;
-    ptr<buffer> ebuf = entry->serialize();
-    data_file_ << *ebuf;
-    idx_file_.flush();
-    data_file_.flush();
-
-    // truncate the files if necessary
-    ulong ndata_len = data_file_.tellp();
-    ulong nidx_len = idx_file_.tellp();
-    idx_file_.seekp(0, std::fstream::end);
-    if (static_cast<ulong>(idx_file_.tellp()) > nidx_len) { // new index length is less than current file size, truncate it
+    start_idx_file.close();
+    std::ifstream manifest(log_folder_ + LOG_MANIFEST_FILE, std::ifstream::binary);
+    if (!manifest) {
+        // no manifest, this is a new store or a store that has all logs in store.idx and store.dat,
+        // for the later, the files become the first segment
         std::string idx_path = log_folder_ + LOG_INDEX_FILE;
         std::string data_path = log_folder_ + LOG_DATA_FILE;
-        idx_file_.close();
-        data_file_.close();
-        if (truncate(idx_path.c_str(), nidx_len) < 0) {
-            throw std::ios_base::failure("failed to truncate the index file");
-        }
+        if (file_exists(idx_path) && file_exists(data_path)) {
+            std::string seg_idx_path = log_folder_ + sstrfmt(LOG_SEGMENT_INDEX_FILE).fmt(start_idx_);
+            std::string seg_data_path = log_folder_ + sstrfmt(LOG_SEGMENT_DATA_FILE).fmt(start_idx_);
+            if (replace_file(idx_path.c_str(), seg_idx_path.c_str()) != 0 || replace_file(data_path.c_str(), seg_data_path.c_str()) != 0) {
+                throw std::runtime_error("fail to convert store files into a segment");
+            }
 
-        if (truncate(data_path.c_str(), ndata_len) < 0) {
-            throw std::ios_base::failure("failed to truncate the data file");
+            seg_starts.push_back(start_idx_);
         }
-
-        idx_file_.open(idx_path, std::fstream::in | std::fstream::out | std::fstream::binary | std::fstream::ate);
-        data_file_.open(data_path, std::fstream::in | std::fstream::out | std::fstream::binary | std::fstream::ate);
     }
+    else {
+        buf->pos(0);
+        while (manifest.read(reinterpret_cast<char*>(buf->data()), sz_ulong)) {
+            seg_starts.push_back(buf->get_ulong());
+            buf->pos(0);
+        }
 
-    if (local_idx <= entries_in_store_) {
-        buf_->trim(index);
+        manifest.close();
+        if (seg_starts.size() == 0) {
+            throw std::runtime_error("bad manifest file, no segment is found");
+        }
     }
 
-    buf_->append(entry);
-    entries_in_store_ = local_idx;
-    if (!data_file_ || !idx_file_) {
-        throw std::runtime_error("IO fails, data cannot be saved");
+    // the runs are saved before the entries are written, so they cover all entries in the files
+    std::ifstream runs_file(log_folder_ + LOG_TERM_RUNS_FILE, std::ifstream::binary);
+    byte run[sz_ulong * 2];
+    runs_end_ = runs_file ? std::numeric_limits<ulong>::max() : 0;
+    while (runs_file.read(reinterpret_cast<char*>(run), sizeof(run))) {
+        term_runs_.push_back(std::make_pair(get_ulong(run), get_ulong(run + sz_ulong)));
     }
 }
 
-ptr<std::vector<ptr<log_entry>>> fs_log_store::log_entries(ulong start, ulong end) {
-    ulong lstart(0), lend(0), good_end(0);
-    {
-        recur_lock(store_lock_);
-        if (start < start_idx_) {
-            throw std::range_error("index out of range");
-        }
-
-        if (start >= end || start >= (start_idx_ + entries_in_store_)) {
-            return ptr<std::vector<ptr<log_entry>>>();
-        }
+void fs_log_store::load_segments(const std::vector<ulong>& seg_starts) {
+    for (size_t i = 0; i < seg_starts.size(); ++i) {
+        segments_.push_back(new_segment(seg_starts[i], false));
+    }
 
-        lstart = start - start_idx_;
-        lend = end - start_idx_;
-        lend = lend > entries_in_store_ ? entries_in_store_ : lend;
-        good_end = lend + start_idx_;
+    if (segments_.size() == 0) {
+        segments_.push_back(new_segment(start_idx_, true));
     }
 
-    if (lstart >= lend) {
-        return ptr<std::vector<ptr<log_entry>>>();
+    // clean up the segments that were left behind by an interrupted compaction
+    size_t cnt = 0;
+    while (cnt < segments_.size() && segments_[cnt]->start_idx() < start_idx_ && segments_[cnt]->next_idx() <= start_idx_) {
+        segments_[cnt++]->remove();
     }
 
-    ptr<std::vector<ptr<log_entry>>> results(cs_new<std::vector<ptr<log_entry>>>());
+    if (cnt > 0) {
+        segments_.erase(segments_.begin(), segments_.begin() + cnt);
+        if (segments_.size() == 0) {
+            segments_.push_back(new_segment(start_idx_, true));
+        }
+    }
 
-    // fill with the buffer
-    ulong buffer_first_idx = buf_->fill(start, good_end, *results);
+    if (segments_.front()->start_idx() > start_idx_) {
+        throw std::runtime_error("bad store files, the segments don't have the start index");
+    }
+}
 
-    // Assumption: buffer.last_index() == entries_in_store_ + start_idx_
-    // (Yes, for sure, we need to enforce this assumption to be true)
-    if (start < buffer_first_idx) {
-        // in this case, we need to read from store file
-        recur_lock(store_lock_);
-        if (!data_file_ || !idx_file_) {
-            throw std::runtime_error("IO fails, data cannot be saved");
-        }
+// the saved runs cover the entries up to runs_end_, the runs of the entries after it are rebuilt from the entries,
+// which are the entries after the checkpoint, or all entries for a store that was created before the runs are kept
+void fs_log_store::load_term_runs() {
+    ulong end_idx = start_idx_ + entries_in_store_;
+    while (term_runs_.size() > 0 && (term_runs_.back().first > runs_end_ || term_runs_.back().first >= end_idx)) {
+        term_runs_.pop_back();
+    }
 
-        lend = buffer_first_idx - start_idx_;
-        idx_file_.seekg(lstart * sz_ulong);
-        ptr<buffer> d_start_idx_buf(std::move(buffer::alloc(sz_ulong)));
-        idx_file_ >> *d_start_idx_buf;
-        ulong data_start = d_start_idx_buf->get_ulong();
-        for (int i = 0; i < (int)(lend - lstart); ++i) {
-            ptr<buffer> d_end_idx_buf(std::move(buffer::alloc(sz_ulong)));
-            idx_file_ >> *d_end_idx_buf;
-            ulong data_end = d_end_idx_buf->get_ulong();
-            int data_sz = (int)(data_end - data_start);
-            data_file_.seekg(data_start);
-            ptr<buffer> entry_buf(std::move(buffer::alloc(data_sz)));
-            data_file_ >> *entry_buf;
-            (*results)[i] = log_entry::deserialize(*entry_buf);
-            data_start = data_end;
-        }
+    if (term_runs_.size() > 0 && term_runs_.front().first > start_idx_) {
+        throw std::runtime_error("bad store files, the term runs don't cover the start index");
     }
 
-    return results;
+    ulong covered = std::min(runs_end_, end_idx - 1);
+    ulong idx = term_runs_.size() > 0 ? std::max(start_idx_, covered + 1) : start_idx_;
+    for (; idx < end_idx; ++idx) {
+        // IMPORTANT!! 
+        // We hack the log_entry serialization details here
+        ptr<buffer> entry_buf(read_entry(idx));
+        track_term(idx, entry_buf->get_ulong());
+    }
 }
 
-ptr<log_entry> fs_log_store::entry_at(ulong index) {
+// the header is written to a temp file, which is synced and then replaces the header, so the header is always complete,
+// the log folder is synced after that, which makes the files of the new segments durable as well
+void fs_log_store::save_header() {
+    if (durability_ != no_sync || durable_idx_ < checkpoint_idx_) {
+        checkpoint_idx_ = durable_idx_;
+    }
 
-    ptr<log_entry> entry = (*buf_)[index];
-    if (entry) {
-        return entry;
+    ulong checkpoint_term = 0;
+    if (checkpoint_idx_ >= start_idx_ && term_runs_.size() > 0) {
+        std::vector<std::pair<ulong, ulong>>::const_iterator it = std::upper_bound(
+            term_runs_.begin(),
+            term_runs_.end(),
+            std::make_pair(checkpoint_idx_, std::numeric_limits<ulong>::max()));
+        checkpoint_term = (--it)->second;
     }
 
-    {
-        // since we don't hit the buffer, so this must not be the last entry 
-        // (according to Assumption: buffer.last_index() == entries_in_store_ + start_idx_)
-        recur_lock(store_lock_);
-        if (index < start_idx_) {
-            throw std::range_error("index out of range");
-        }
+    runs_end_ = start_idx_ + entries_in_store_ - 1;
+    size_t size = sz_ulong * 6 + sz_int * 3 + segments_.size() * sz_ulong + term_runs_.size() * sz_ulong * 2;
+    ptr<buffer> header(buffer::alloc(size));
+    byte* data = header->data();
+    header->put(header_magic);
+    header->put(++header_version_);
+    header->put(start_idx_);
+    header->put(checkpoint_idx_);
+    header->put(checkpoint_term);
+    header->put(runs_end_);
+    header->put(static_cast<int32>(segments_.size()));
+    for (size_t i = 0; i < segments_.size(); ++i) {
+        header->put(segments_[i]->start_idx());
+    }
 
-        if (!data_file_ || !idx_file_) {
-            throw std::runtime_error("IO fails, data cannot be saved");
-        }
+    header->put(static_cast<int32>(term_runs_.size()));
+    for (size_t i = 0; i < term_runs_.size(); ++i) {
+        header->put(term_runs_[i].first);
+        header->put(term_runs_[i].second);
+    }
 
-        if (index >= start_idx_ + entries_in_store_) {
-            return ptr<log_entry>();
-        }
+    header->put(static_cast<int32>(crc32c(data, size - sz_int)));
+    std::string tmp_path = log_folder_ + LOG_HEADER_FILE_TMP;
+    log_file file;
+    if (!file.open(tmp_path, true) || !file.write(0, data, size) || !file.sync()) {
+        throw std::runtime_error("IO fails, the store header cannot be saved");
+    }
 
-        ulong idx_pos = (index - start_idx_) * sz_ulong;
-        idx_file_.seekg(idx_pos);
-        ptr<buffer> d_start_idx_buf(std::move(buffer::alloc(sz_ulong)));
-        idx_file_ >> *d_start_idx_buf;
-        ulong d_pos = d_start_idx_buf->get_ulong();
-        ptr<buffer> d_end_idx_buf(std::move(buffer::alloc(sz_ulong)));
-        idx_file_ >> *d_end_idx_buf;
-        ulong end_d_pos = d_end_idx_buf->get_ulong();
-        data_file_.seekg(d_pos);
-        ptr<buffer> entry_buf(std::move(buffer::alloc((int)(end_d_pos - d_pos))));
-        data_file_ >> *entry_buf;
-        return log_entry::deserialize(*entry_buf);
+    file.close();
+    if (replace_file(tmp_path.c_str(), (log_folder_ + LOG_HEADER_FILE).c_str()) != 0) {
+        throw std::runtime_error("IO fails, the store header cannot be replaced");
     }
 }
 
-ulong fs_log_store::term_at(ulong index) {
-    if (index >= buf_->first_idx() && index < buf_->last_idx()) {
-        return buf_->get_term(index);
+// the term of the entry at index starts a new run if it's different from the last run, the runs are saved with
+// the header, the runs of the entries that are written after the header is saved are rebuilt when the store is opened
+void fs_log_store::track_term(ulong index, ulong term) {
+    if (term_runs_.size() > 0 && term_runs_.back().second == term) {
+        return;
     }
 
-    {
-        recur_lock(store_lock_);
-        if (index < start_idx_) {
-            throw std::range_error("index out of range");
-        }
-
-        if (!data_file_ || !idx_file_) {
-            throw std::runtime_error("IO fails, data cannot be saved");
-        }
-
-        idx_file_.seekg(static_cast<int>(index - start_idx_) * sz_ulong);
-        ptr<buffer> d_start_idx_buf(std::move(buffer::alloc(sz_ulong)));
-        idx_file_ >> *d_start_idx_buf;
-        data_file_.seekg(d_start_idx_buf->get_ulong());
+    term_runs_.push_back(std::make_pair(index, term));
+}
 
-        // IMPORTANT!! 
-        // We hack the log_entry serialization details here
-        ptr<buffer> term_buf(std::move(buffer::alloc(sz_ulong)));
-        data_file_ >> *term_buf;
-        return term_buf->get_ulong();
-    }
+ptr<log_segment> fs_log_store::new_segment(ulong start_idx, bool create_new) {
+    return cs_new<log_segment>(log_folder_, start_idx, create_new, write_ring_, sync_ring_, direct_io_, segment_size_, std::min(segment_size_, max_preallocate_size), codec_.get());
 }
 
-ptr<buffer> fs_log_store::pack(ulong index, int32 cnt) {
-    recur_lock(store_lock_);
-    if (index < start_idx_) {
-        throw std::range_error("index out of range");
-    }
+void fs_log_store::roll_segment() {
+    segments_.back()->seal();
+    segments_.push_back(new_segment(segments_.back()->next_idx(), true));
+    save_header();
+}
 
-    if (!data_file_ || !idx_file_) {
-        throw std::runtime_error("IO fails, data cannot be saved");
+void fs_log_store::frame_last_segment() {
+    if (segments_.back()->framed()) {
+        return;
     }
 
-    ulong offset = index - start_idx_;
-    if (offset >= entries_in_store_) {
-        return ptr<buffer>();
+    // the last segment is created by a version without records, the new entries go to a new segment,
+    // an empty one is replaced instead, the files must be closed before the new ones are created
+    if (segments_.back()->entries() > 0) {
+        roll_segment();
+        return;
     }
 
-    ulong end_offset = std::min(offset + cnt, entries_in_store_);
-    idx_file_.seekg(static_cast<int>(offset) * sz_ulong);
-    bool read_to_end = end_offset == entries_in_store_;
-    ptr<buffer> idx_buf(std::move(buffer::alloc(static_cast<int>(end_offset - offset) * sz_ulong)));
-    idx_file_ >> *idx_buf;
-    ulong end_of_data(0);
-    if (read_to_end) {
-        data_file_.seekg(0, std::fstream::end);
-        end_of_data = data_file_.tellg();
-    }
-    else {
-        ptr<buffer> end_d_idx_buf(std::move(buffer::alloc(sz_ulong)));
-        idx_file_ >> *end_d_idx_buf;
-        end_of_data = end_d_idx_buf->get_ulong();
-    }
-
-    idx_buf->pos(0);
-    ulong start_of_data = idx_buf->get_ulong();
-    idx_buf->pos(0);
-    data_file_.seekg(start_of_data);
-    ptr<buffer> data_buf(std::move(buffer::alloc(static_cast<int>(end_of_data - start_of_data))));
-    data_file_ >> *data_buf;
-    ptr<buffer> result = buffer::alloc(2 * sz_int + idx_buf->size() + data_buf->size());
-    result->put(static_cast<int32>(idx_buf->size()));
-    result->put(static_cast<int32>(data_buf->size()));
-    result->put(*idx_buf);
-    result->put(*data_buf);
-    result->pos(0);
-    return result;
+    ulong start = segments_.back()->start_idx();
+    segments_.back()->remove();
+    segments_.back().reset();
+    segments_.back() = new_segment(start, true);
 }
 
-void fs_log_store::apply_pack(ulong index, buffer& pack) {
-    recur_lock(store_lock_);
-    int32 idx_len = pack.get_int();
-    int32 data_len = pack.get_int();
-    ulong local_idx = index - start_idx_;
-    if (local_idx == entries_in_store_) {
-        idx_file_.seekp(0, std::fstream::end);
-        data_file_.seekp(0, std::fstream::end);
+void fs_log_store::truncate_from(ulong index) {
+    // drop all segments that start after index, and truncate the one that has it
+    std::vector<ptr<log_segment>> removed;
+    while (segments_.size() > 1 && segments_.back()->start_idx() >= index) {
+        removed.push_back(segments_.back());
+        segments_.pop_back();
     }
-    else {
-        ulong idx_pos = local_idx * sz_ulong;
-        idx_file_.seekg(idx_pos);
-        ptr<buffer> data_pos_buf(std::move(buffer::alloc(sz_ulong)));
-        idx_file_ >> *data_pos_buf;
-        idx_file_.seekp(idx_pos);
-        data_file_.seekp(data_pos_buf->get_ulong());
-    }
-
-    idx_file_.write(reinterpret_cast<const char*>(pack.data()), idx_len);
-    data_file_.write(reinterpret_cast<const char*>(pack.data() + idx_len), data_len);
-    idx_file_.flush();
-    data_file_.flush();
-    ulong idx_pos = idx_file_.tellp();
-    ulong data_pos = data_file_.tellp();
-    idx_file_.seekp(0, std::fstream::end);
-    data_file_.seekp(0, std::fstream::end);
-    if (idx_pos < static_cast<ulong>(idx_file_.tellp())) {
-        std::string idx_path = log_folder_ + LOG_INDEX_FILE;
-        std::string data_path = log_folder_ + LOG_DATA_FILE;
-        idx_file_.close();
-        data_file_.close();
-        if (truncate(idx_path.c_str(), idx_pos) < 0) {
-            throw std::ios_base::failure("failed to truncate the index file");
-        }
 
-        if (truncate(data_path.c_str(), data_pos) < 0) {
-            throw std::ios_base::failure("failed to truncate the data file");
-        }
-
-        idx_file_.open(idx_path, std::fstream::in | std::fstream::out | std::fstream::binary | std::fstream::ate);
-        data_file_.open(data_path, std::fstream::in | std::fstream::out | std::fstream::binary | std::fstream::ate);
+    entries_in_store_ = index - start_idx_;
+    while (term_runs_.size() > 0 && term_runs_.back().first >= index) {
+        term_runs_.pop_back();
     }
 
-    if (!data_file_ || !idx_file_) {
-        throw std::runtime_error("IO fails, data cannot be saved");
+    // the entries being synced may be gone, the sync must not advance the durable index over index
+    truncate_gen_ += 1;
+    if (durable_idx_ >= index) {
+        durable_idx_ = index - 1;
     }
 
-    entries_in_store_ = local_idx + idx_len / sz_ulong;
-    buf_->reset(entries_in_store_ > (size_t)buf_size_ ? entries_in_store_ + start_idx_ - buf_size_ : start_idx_);
-    fill_buffer();
-}
+    // the header goes first if it has the removed segments or the runs of the truncated entries,
+    // a crash before the files are truncated leaves the entries as they were before the truncation
+    if (removed.size() > 0 || index <= runs_end_) {
+        save_header();
+    }
 
-bool fs_log_store::compact(ulong last_log_index) {
-    recur_lock(store_lock_);
-    if (last_log_index < start_idx_) {
-        throw std::range_error("index out of range");
+    for (size_t i = 0; i < removed.size(); ++i) {
+        removed[i]->remove();
     }
 
-    // backup the files
-    idx_file_.seekg(0);
-    data_file_.seekg(0);
-    start_idx_file_.seekg(0);
-    std::string idx_bak_path = log_folder_ + LOG_INDEX_FILE_BAK;
-    std::string data_bak_path = log_folder_ + LOG_DATA_FILE_BAK;
-    std::string start_idx_bak_path = log_folder_ + LOG_START_INDEX_FILE_BAK;
-    std::string data_file_path = log_folder_ + LOG_DATA_FILE;
-    std::string idx_file_path = log_folder_ + LOG_INDEX_FILE;
-    std::string start_idx_file_path = log_folder_ + LOG_START_INDEX_FILE;
-    std::remove(idx_bak_path.c_str());
-    std::remove(data_bak_path.c_str());
-    std::remove(start_idx_bak_path.c_str());
-
-    std::fstream idx_bak_file, data_bak_file, start_idx_bak_file;
-    idx_bak_file.open(idx_bak_path, std::fstream::in | std::fstream::out | std::fstream::binary);
-    if (!idx_bak_file) {
-        idx_bak_file.open(idx_bak_path, std::fstream::out);
-        idx_bak_file.close();
-        idx_bak_file.open(idx_bak_path, std::fstream::in | std::fstream::out | std::fstream::binary);
-    }
-
-    data_bak_file.open(data_bak_path, std::fstream::in | std::fstream::out | std::fstream::binary);
-    if (!data_bak_file) {
-        data_bak_file.open(data_bak_path, std::fstream::out);
-        data_bak_file.close();
-        data_bak_file.open(data_bak_path, std::fstream::in | std::fstream::out | std::fstream::binary);
-    }
-
-    start_idx_bak_file.open(start_idx_bak_path, std::fstream::in | std::fstream::out | std::fstream::binary);
-    if (!start_idx_bak_file) {
-        start_idx_bak_file.open(start_idx_bak_path, std::fstream::out);
-        start_idx_bak_file.close();
-        start_idx_bak_file.open(start_idx_bak_path, std::fstream::in | std::fstream::out | std::fstream::binary);
-    }
-
-    if (!idx_bak_file || !data_bak_file || !start_idx_bak_file) return false; //we cannot proceed as backup files are bad
-
-    idx_file_.seekg(0);
-    data_file_.seekg(0);
-    start_idx_file_.seekg(0);
-    idx_bak_file << idx_file_.rdbuf();
-    data_bak_file << data_file_.rdbuf();
-    start_idx_bak_file << start_idx_file_.rdbuf();
-    idx_bak_file.flush();
-    data_bak_file.flush();
-    start_idx_bak_file.flush();
-
-    do {
-        if (last_log_index >= start_idx_ + entries_in_store_ - 1) {
-            // need to clear all entries in this store and update the start index
-            idx_file_.close();
-            data_file_.close();
-            if (std::remove(idx_file_path.c_str()) != 0) break;
-            if (std::remove(data_file_path.c_str()) != 0) break;
-            idx_file_.open(idx_file_path, std::fstream::out);
-            idx_file_.close();
-            idx_file_.open(idx_file_path, std::fstream::in | std::fstream::out | std::fstream::binary | std::fstream::ate);
-            data_file_.open(data_file_path, std::fstream::out);
-            data_file_.close();
-            data_file_.open(data_file_path, std::fstream::in | std::fstream::out | std::fstream::binary | std::fstream::ate);
-            if (!idx_file_ || !data_file_) break;
-
-            // save the logstore state
-            start_idx_file_.seekp(0);
-            ptr<buffer> start_idx_buf(std::move(buffer::alloc(sz_ulong)));
-            start_idx_buf->put(last_log_index + 1);
-            start_idx_buf->pos(0);
-            start_idx_file_ << *start_idx_buf;
-            start_idx_ = last_log_index + 1;
-            entries_in_store_ = 0;
-            buf_->reset(start_idx_);
-
-            // close all backup files
-            idx_bak_file.close();
-            data_bak_file.close();
-            start_idx_bak_file.close();
-            return true;
-        }
+    segments_.back()->truncate(index);
+    frame_last_segment();
+    buf_->trim(index);
 
-        // else, we need to compact partial of the logs
-        ulong local_last_idx = last_log_index - start_idx_;
-        ulong idx_pos = (local_last_idx + 1) * sz_ulong;
-        ptr<buffer> data_pos_buf(std::move(buffer::alloc(sz_ulong)));
-        idx_file_.seekg(idx_pos);
-        idx_file_ >> *data_pos_buf;
-        idx_file_.seekp(0, std::fstream::end);
-        data_file_.seekp(0, std::fstream::end);
-        ulong data_pos = data_pos_buf->get_ulong();
-        ulong idx_len = static_cast<ulong>(idx_file_.tellp()) - idx_pos;
-        ulong data_len = static_cast<ulong>(data_file_.tellp()) - data_pos;
-
-        // compact the data file
-        data_bak_file.seekg(data_pos);
-        data_file_.seekp(0);
-        data_file_ << data_bak_file.rdbuf();
-
-        // truncate the data file
-        data_file_.close();
-        if(0 != truncate(data_file_path.c_str(), data_len)) break;
-        data_file_.open(data_file_path, std::fstream::in | std::fstream::out | std::fstream::binary | std::fstream::ate);
-        if (!data_file_) break;
-
-        // compact the index file
-        idx_bak_file.seekg(idx_pos);
-        idx_file_.seekp(0);
-        for (ulong i = 0; i < idx_len / sz_ulong; ++i) {
-            data_pos_buf->pos(0);
-            idx_bak_file >> *data_pos_buf;
-            ulong new_pos = data_pos_buf->get_ulong() - data_pos;
-            data_pos_buf->pos(0);
-            data_pos_buf->put(new_pos);
-            data_pos_buf->pos(0);
-            idx_file_ << *data_pos_buf;
-        }
-
-        // truncate the index file
-        idx_file_.close();
-        if(0 != truncate(idx_file_path.c_str(), idx_len)) break;
-        idx_file_.open(idx_file_path, std::fstream::in | std::fstream::out | std::fstream::binary | std::fstream::ate);
-        if (!idx_file_) break;
-
-        // close all backup files
-        idx_bak_file.close();
-        data_bak_file.close();
-        start_idx_bak_file.close();
-
-        start_idx_file_.seekp(0);
-        ptr<buffer> start_idx_buf(std::move(buffer::alloc(sz_ulong)));
-        start_idx_buf->put(last_log_index + 1);
-        start_idx_buf->pos(0);
-        start_idx_file_ << *start_idx_buf;
-        start_idx_file_.flush();
-        entries_in_store_ -= (last_log_index - start_idx_ + 1);
-        start_idx_ = last_log_index + 1;
-        buf_->reset(entries_in_store_ > (size_t)buf_size_ ? entries_in_store_ + start_idx_ - buf_size_ : start_idx_);
-        fill_buffer();
-        return true;
-    } while (false);
-
-    // restore the state due to errors
-    if (idx_file_) idx_file_.close();
-    if (data_file_) data_file_.close();
-    if (start_idx_file_) start_idx_file_.close();
-    std::remove(idx_file_path.c_str());
-    std::remove(data_file_path.c_str());
-    std::remove(start_idx_file_path.c_str());
-    idx_bak_file.seekg(0);
-    data_bak_file.seekg(0);
-    start_idx_bak_file.seekg(0);
-    data_file_.open(data_bak_path, std::fstream::out);
-    data_file_.close();
-    data_file_.open(data_file_path, std::fstream::in | std::fstream::out | std::fstream::binary | std::fstream::ate);
-    idx_file_.open(idx_file_path, std::fstream::out);
-    idx_file_.close();
-    idx_file_.open(idx_file_path, std::fstream::in | std::fstream::out | std::fstream::binary | std::fstream::ate);
-    start_idx_file_.open(start_idx_file_path, std::fstream::out);
-    start_idx_file_.close();
-    start_idx_file_.open(start_idx_file_path, std::fstream::in | std::fstream::out | std::fstream::binary | std::fstream::ate);
-    if (!idx_file_ || !data_file_ || !start_idx_file_) {
-        throw std::runtime_error("IO error, fails to restore files back.");
-    }
-
-    data_file_ << data_bak_file.rdbuf();
-    idx_file_ << idx_bak_file.rdbuf();
-    start_idx_file_ << start_idx_bak_file.rdbuf();
-    data_file_.flush();
-    idx_file_.flush();
-    start_idx_file_.flush();
-
-    // close all backup files
-    idx_bak_file.close();
-    data_bak_file.close();
-    start_idx_bak_file.close();
-    return false;
-}
+    // the async appends that have the truncated entries never become durable
+    std::vector<ptr<async_result<ulong>>> truncated;
+    {
+        auto_lock(sync_lock_);
+        for (size_t i = 0; i < waiters_.size();) {
+            if (waiters_[i].first >= index) {
+                truncated.push_back(waiters_[i].second);
+                waiters_.erase(waiters_.begin() + i);
+            }
+            else {
+                ++i;
+            }
+        }
+    }
 
-void fs_log_store::close() {
-    idx_file_.close();
-    data_file_.close();
-    start_idx_file_.close();
+    ptr<std::exception> err(cs_new<std::runtime_error>("the log entries are truncated before they are durable"));
+    for (size_t i = 0; i < truncated.size(); ++i) {
+        ulong last_idx = index - 1;
+        truncated[i]->set_result(last_idx, err);
+    }
 }
 
-void fs_log_store::fill_buffer() {
-    ulong first_idx = buf_->first_idx();
-    idx_file_.seekg(0, std::fstream::end);
-    data_file_.seekg(0, std::fstream::end);
-    if (idx_file_.tellg() > 0) {
-        ulong idx_file_len = idx_file_.tellg();
-        ulong data_file_len = data_file_.tellg();
-        ulong idx_pos = (first_idx - start_idx_) * sz_ulong;
-        idx_file_.seekg(idx_pos);
-        ptr<buffer> idx_buf(std::move(buffer::alloc(static_cast<size_t>(idx_file_len - idx_pos))));
-        idx_file_ >> *idx_buf;
-        ulong data_start = idx_buf->get_ulong();
-        data_file_.seekg(data_start);
-        while (idx_buf->size() > idx_buf->pos()) {
-            ulong data_end = idx_buf->get_ulong();
-            ptr<buffer> buf = buffer::alloc(static_cast<size_t>(data_end - data_start));
-            data_file_ >> *buf;
-	    ptr<log_entry> entry = log_entry::deserialize(*buf);
-            buf_->append(entry);
-            data_start = data_end;
-        }
-
-        ptr<buffer> last_buf = buffer::alloc(static_cast<size_t>(data_file_len - data_start));
-        data_file_ >> *last_buf;
-	ptr<log_entry> entry = log_entry::deserialize(*last_buf);
-        buf_->append(entry);
+ptr<log_segment>& fs_log_store::segment_of(ulong index) {
+    size_t lo = 0;
+    size_t hi = segments_.size() - 1;
+    while (lo < hi) {
+        size_t mid = (lo + hi + 1) / 2;
+        if (segments_[mid]->start_idx() <= index) {
+            lo = mid;
+        }
+        else {
+            hi = mid - 1;
+        }
     }
+
+    return segments_[lo];
 }
@@ -3,12 +3,51 @@
 
 namespace cornerstone {
     class log_store_buffer;
+    class log_segment;
+    class io_ring;
+
+    /**
+    * File system based log store, the logs are kept in a list of segments, each segment has a data file (store.<start>.dat)
+    * and an index file (store.<start>.idx), a new segment is rolled out once the data file of the last segment reaches the
+    * segment size. The start index, the list of segments and the terms of the entries are kept in the store header (store.hdr).
+    * Appended entries are staged in memory, written to the segment files in groups and synced to disk by the durability policy,
+    * the most recent entries are cached in memory
+    */
     class fs_log_store : public log_store {
     public:
-        fs_log_store(const std::string& log_folder, int buf_size = -1);
+        typedef std::function<void(ulong)> durable_handler;
+        static const ulong default_segment_size;
+        static const ulong max_segment_size;
+        static const ulong default_cache_size;
+
+        /**
+        * The space of the data files is preallocated in chunks of this size (or the segment size if it's smaller), and the space
+        * of the index files in chunks of an eighth of that, the space is zero filled and synced as it's allocated, so that
+        * the appends don't change the file sizes or the file system metadata, the next chunk is allocated by the background
+        * thread once the writes pass half of the chunk that is left, so it's never done on the append path
+        */
+        static const ulong max_preallocate_size;
+
+    public:
+        /**
+        * Opens the store in log_folder, the header keeps a checkpoint, the last durable index and its term when the header
+        * is saved, so opening the store checks the entries from the checkpoint on only, with no_sync, nothing is durable,
+        * so the checkpoint doesn't advance and the last segment is checked as a whole
+        * @param cache_size, the cache of the recent entries is bounded by cache_size bytes of the serialized entries
+        * @param durability, when the written entries are synced to disk, see durability_policy
+        * @param direct_io, the data files are written with O_DIRECT if it's supported, the writes then bypass the page cache
+        * and are padded to whole blocks
+        * @param codec, the entries are compressed before they are written to the data files if it's set, see log_codec
+        */
+        fs_log_store(const std::string& log_folder, ulong cache_size = default_cache_size, ulong segment_size = default_segment_size, durability_policy durability = per_batch_sync, int32 sync_interval = 10, bool direct_io = false, ptr<log_codec> codec = ptr<log_codec>());
         ~fs_log_store();
 
         __nocopy__(fs_log_store)
+    protected:
+        /**
+        * Creates the store with the segment files written and synced through io_uring if use_io_ring is true
+        */
+        fs_log_store(const std::string& log_folder, ulong cache_size, ulong segment_size, durability_policy durability, int32 sync_interval, bool direct_io, ptr<log_codec> codec, bool use_io_ring);
     public:
         /**
         ** The first available slot of the store, starts with 1
@@ -33,6 +72,20 @@ namespace cornerstone {
         */
         virtual ulong append(ptr<log_entry>& entry);
 
+        /**
+        * Appends the log entries to store as one batch, the entries are written together
+        * @param entries
+        * @return the log index of the first entry in the batch
+        */
+        virtual ulong append_batch(std::vector<ptr<log_entry>>& entries);
+
+        /**
+        * Appends the log entries to store as one batch, the entries are written and synced by the background thread
+        * @param entries
+        * @return the result that is set with the log index of the last entry once the entries are durable
+        */
+        virtual ptr<async_result<ulong>> append_async(std::vector<ptr<log_entry>>& entries);
+
         /**
         * Over writes a log entry at index of {@code index}
         * @param index a value < this->next_slot(), and starts from 1
@@ -40,6 +93,13 @@ namespace cornerstone {
         */
         virtual void write_at(ulong index, ptr<log_entry>& entry);
 
+        /**
+        * Removes all log entries starting from index, the segments are truncated in place and the cache, the term runs
+        * and the async appends of the removed entries are updated together
+        * @param index a value <= this->next_slot(), and starts from 1
+        */
+        virtual void truncate(ulong index);
+
         /**
         * Get log entries with index between start and end
         * @param start, the start index of log entries
@@ -56,13 +116,21 @@ namespace cornerstone {
         virtual ptr<log_entry> entry_at(ulong index);
 
         /**
-        * Gets the term for the log entry at the specified index
+        * Gets the term for the log entry at the specified index, the term is found in the term runs of the header,
+        * so the segments are never read
         * Suggest to stop the system if the index >= this->next_slot()
         * @param index, starts from 1
         * @return the term for the specified log entry or 0 if index < this->start_index()
         */
         virtual ulong term_at(ulong index);
 
+        /**
+        * Gets the first index of the term of the log entry at the specified index, it's the start of its term run
+        * @param index, a value >= this->start_index() and < this->next_slot()
+        * @return the first index of the term, or this->start_index() if the term starts before it
+        */
+        virtual ulong first_index_of_term(ulong index);
+
         /**
         * Pack cnt log items starts from index
         * @param index
@@ -79,25 +147,105 @@ namespace cornerstone {
         virtual void apply_pack(ulong index, buffer& pack);
 
         /**
-        * Compact the log store by removing all log entries including the log at the last_log_index
+        * Compact the log store by removing all log entries including the log at the last_log_index, the new start index
+        * is saved in the header and then the segments that are fully compacted are removed, the space of the compacted entries
+        * in the first remaining segment is released by punching a hole, nothing is copied
         * @param last_log_index
         * @return compact successfully or not
         */
         virtual bool compact(ulong last_log_index);
 
+        /**
+        * The number of entries that are read from the cache, by entry_at and log_entries
+        */
+        ulong cache_hits() const;
+
+        /**
+        * The number of entries that are read from the segments as they are not in the cache
+        */
+        ulong cache_misses() const;
+
+        /**
+        * The bytes of the entries in the cache, it's bounded by the cache size except that the last entry always stays
+        */
+        ulong cache_bytes() const;
+
+        /**
+        * The last log index that is durable, with no_sync policy, it's the last log index that is written to the files
+        */
+        virtual ulong durable_index() const;
+
+        /**
+        * Blocks until the log entry at index is durable, concurrent calls are served by one write and one sync
+        * @param index
+        */
+        void sync(ulong index);
+
+        /**
+        * Sets the handler that is called with the new durable index each time the durable index advances,
+        * the handler is called without any lock of the store being held, but it must not call sync
+        * @param handler
+        */
+        void set_durable_handler(const durable_handler& handler);
+
+        /**
+        * Syncs the written entries and saves the header, the header is also saved as a whole as the segments are rolled,
+        * compacted or truncated below the checkpoint, to a temp file that replaces it
+        */
         void close();
     private:
+        ulong append_entry(ptr<log_entry>& entry);
+        void apply_pack_entries(ulong index, buffer& pack);
+        void commit_writes(ulong index);
+        bool flush_and_sync();
+        void complete_waiters(ulong index, ptr<std::exception> err);
+        void sync_in_bg();
+        void allocate_ahead();
+        ptr<buffer> read_entry(ulong index);
         void fill_buffer();
+        bool load_header(std::vector<ulong>& seg_starts, ulong& checkpoint_term);
+        void load_legacy_files(std::vector<ulong>& seg_starts);
+        void load_segments(const std::vector<ulong>& seg_starts);
+        void load_term_runs();
+        void save_header();
+        void track_term(ulong index, ulong term);
+        ptr<log_segment> new_segment(ulong start_idx, bool create_new);
+        void roll_segment();
+        void frame_last_segment();
+        void truncate_from(ulong index);
+        ptr<log_segment>& segment_of(ulong index);
     private:
-        std::fstream idx_file_;
-        std::fstream data_file_;
-        std::fstream start_idx_file_;
+        std::vector<ptr<log_segment>> segments_;
+        std::vector<std::pair<ulong, ulong>> term_runs_;
         ulong entries_in_store_;
         ulong start_idx_;
+        ulong checkpoint_idx_;
+        ulong header_version_;
+        ulong runs_end_;
+        ulong segment_size_;
         std::string log_folder_;
         mutable std::recursive_mutex store_lock_;
         log_store_buffer* buf_;
-        int buf_size_;
+        io_ring* write_ring_;
+        io_ring* sync_ring_;
+        ulong cache_size_;
+        std::atomic<ulong> cache_hits_;
+        std::atomic<ulong> cache_misses_;
+        durability_policy durability_;
+        int32 sync_interval_;
+        bool direct_io_;
+        ptr<log_codec> codec_;
+        std::atomic<ulong> durable_idx_;
+        ulong truncate_gen_;
+        bool syncing_;
+        bool stopping_;
+        bool space_wanted_;
+        std::mutex sync_lock_;
+        std::condition_variable sync_cv_;
+        std::condition_variable bg_cv_;
+        durable_handler durable_handler_;
+        std::vector<std::pair<ulong, ptr<async_result<ulong>>>> waiters_;
+        std::thread sync_thread_;
     };
 }
 
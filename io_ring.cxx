@@ -0,0 +1,298 @@
+#include "cornerstone.hxx"
+
+#ifdef __linux__
+#include <cerrno>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+using namespace cornerstone;
+
+#ifdef __linux__
+// the largest length of one operation, a longer write is split
+#define IO_RING_MAX_LEN 0x40000000
+
+struct io_ring::ring_state {
+    ring_state()
+        : fd(-1),
+        sq_ring(MAP_FAILED),
+        sq_ring_size(0),
+        cq_ring(MAP_FAILED),
+        cq_ring_size(0),
+        sqes(static_cast<io_uring_sqe*>(MAP_FAILED)),
+        sqes_size(0),
+        sq_entries(0),
+        sq_head(nilptr),
+        sq_tail(nilptr),
+        sq_mask(nilptr),
+        sq_array(nilptr),
+        cq_head(nilptr),
+        cq_tail(nilptr),
+        cq_mask(nilptr),
+        cqes(nilptr),
+        broken(false) {}
+
+    ~ring_state() {
+        if (sqes != MAP_FAILED) {
+            ::munmap(sqes, sqes_size);
+        }
+
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring) {
+            ::munmap(cq_ring, cq_ring_size);
+        }
+
+        if (sq_ring != MAP_FAILED) {
+            ::munmap(sq_ring, sq_ring_size);
+        }
+
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    int fd;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    io_uring_sqe* sqes;
+    size_t sqes_size;
+    uint sq_entries;
+    uint* sq_head;
+    uint* sq_tail;
+    uint* sq_mask;
+    uint* sq_array;
+    uint* cq_head;
+    uint* cq_tail;
+    uint* cq_mask;
+    io_uring_cqe* cqes;
+    bool broken;
+
+    __nocopy__(ring_state)
+};
+
+struct ring_op {
+    ring_op(byte opcode, int fd, byte* data, size_t len, ulong offset)
+        : opcode(opcode), fd(fd), data(data), len(len), offset(offset) {}
+
+    byte opcode;
+    int fd;
+    byte* data;
+    size_t len;
+    ulong offset;
+};
+
+template<typename T>
+static T* ring_field(void* ring, uint offset) {
+    return reinterpret_cast<T*>(static_cast<byte*>(ring) + offset);
+}
+
+// submits the ops and waits for all of them to complete, results has the result of each op, if the submission fails,
+// the ops that the kernel has taken are still waited for, so that their completions are not taken for the ones of
+// the next batch, the ring is broken if they could not be waited for
+static bool submit_and_wait(io_ring::ring_state& s, const ring_op* ops, size_t cnt, std::vector<int>& results) {
+    uint start = *s.sq_tail;
+    uint tail = start;
+    uint mask = *s.sq_mask;
+    for (size_t i = 0; i < cnt; ++i) {
+        uint idx = tail & mask;
+        io_uring_sqe* sqe = &s.sqes[idx];
+        ::memset(sqe, 0, sizeof(io_uring_sqe));
+        sqe->opcode = ops[i].opcode;
+        sqe->fd = ops[i].fd;
+        sqe->addr = reinterpret_cast<ulong>(ops[i].data);
+        sqe->len = static_cast<uint>(ops[i].len);
+        sqe->off = ops[i].offset;
+        if (ops[i].opcode == IORING_OP_FSYNC) {
+            sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        }
+
+        sqe->user_data = i;
+        s.sq_array[idx] = idx;
+        tail += 1;
+    }
+
+    // the kernel reads the entries once it sees the new tail
+    __atomic_store_n(s.sq_tail, tail, __ATOMIC_RELEASE);
+    results.assign(cnt, 0);
+    size_t completed = 0;
+    size_t in_flight = cnt;
+    bool submitted = true;
+    while (true) {
+        uint head = *s.cq_head;
+        uint cq_tail = __atomic_load_n(s.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != cq_tail; ++head) {
+            io_uring_cqe* cqe = &s.cqes[head & *s.cq_mask];
+            results[static_cast<size_t>(cqe->user_data)] = cqe->res;
+            completed += 1;
+        }
+
+        __atomic_store_n(s.cq_head, head, __ATOMIC_RELEASE);
+        if (completed == in_flight) {
+            return submitted;
+        }
+
+        uint to_submit = submitted ? tail - __atomic_load_n(s.sq_head, __ATOMIC_ACQUIRE) : 0;
+        if (::syscall(__NR_io_uring_enter, s.fd, to_submit, 1, IORING_ENTER_GETEVENTS, nilptr, 0) >= 0 || errno == EINTR) {
+            continue;
+        }
+
+        if (!submitted) {
+            s.broken = true;
+            return false;
+        }
+
+        // the entries are only taken by the kernel within io_uring_enter, the ones it hasn't taken are taken back
+        submitted = false;
+        tail = __atomic_load_n(s.sq_head, __ATOMIC_ACQUIRE);
+        __atomic_store_n(s.sq_tail, tail, __ATOMIC_RELEASE);
+        in_flight = tail - start;
+    }
+}
+
+// runs the ops in batches of the ring size, the short reads and writes are continued,
+// a read that reaches the end of the file fails
+static bool run_ops(io_ring::ring_state& s, std::vector<ring_op>& ops) {
+    if (s.broken) {
+        return false;
+    }
+
+    std::vector<int> results;
+    while (ops.size() > 0) {
+        size_t cnt = std::min(ops.size(), static_cast<size_t>(s.sq_entries));
+        if (!submit_and_wait(s, &ops[0], cnt, results)) {
+            return false;
+        }
+
+        std::vector<ring_op> remaining(ops.begin() + cnt, ops.end());
+        for (size_t i = 0; i < cnt; ++i) {
+            ring_op& op = ops[i];
+            int res = results[i];
+            if (res == -EINTR || res == -EAGAIN) {
+                remaining.push_back(op);
+            }
+            else if (res < 0 || (res == 0 && op.len > 0)) {
+                return false;
+            }
+            else if (static_cast<size_t>(res) < op.len) {
+                remaining.push_back(ring_op(op.opcode, op.fd, op.data + res, op.len - static_cast<size_t>(res), op.offset + static_cast<ulong>(res)));
+            }
+        }
+
+        ops.swap(remaining);
+    }
+
+    return true;
+}
+
+static void add_ops(std::vector<ring_op>& ops, byte opcode, int fd, byte* data, size_t len, ulong offset) {
+    while (len > 0) {
+        size_t op_len = std::min(len, static_cast<size_t>(IO_RING_MAX_LEN));
+        ops.push_back(ring_op(opcode, fd, data, op_len, offset));
+        data += op_len;
+        len -= op_len;
+        offset += op_len;
+    }
+}
+
+io_ring::io_ring(uint entries)
+    : state_(nilptr), lock_() {
+    io_uring_params params;
+    ::memset(&params, 0, sizeof(params));
+    int fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    if (fd < 0) {
+        throw std::runtime_error(sstrfmt("io_uring is not supported, error %d").fmt(errno));
+    }
+
+    ring_state* s = new ring_state();
+    s->fd = fd;
+    s->sq_entries = params.sq_entries;
+    s->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint);
+    s->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+        s->sq_ring_size = s->cq_ring_size = std::max(s->sq_ring_size, s->cq_ring_size);
+    }
+
+    s->sq_ring = ::mmap(nilptr, s->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (s->sq_ring != MAP_FAILED) {
+        s->cq_ring = single_mmap ? s->sq_ring : ::mmap(nilptr, s->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    }
+
+    if (s->cq_ring != MAP_FAILED) {
+        s->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        s->sqes = static_cast<io_uring_sqe*>(::mmap(nilptr, s->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+    }
+
+    if (s->sqes == MAP_FAILED) {
+        delete s;
+        throw std::runtime_error("fail to map the io_uring");
+    }
+
+    s->sq_head = ring_field<uint>(s->sq_ring, params.sq_off.head);
+    s->sq_tail = ring_field<uint>(s->sq_ring, params.sq_off.tail);
+    s->sq_mask = ring_field<uint>(s->sq_ring, params.sq_off.ring_mask);
+    s->sq_array = ring_field<uint>(s->sq_ring, params.sq_off.array);
+    s->cq_head = ring_field<uint>(s->cq_ring, params.cq_off.head);
+    s->cq_tail = ring_field<uint>(s->cq_ring, params.cq_off.tail);
+    s->cq_mask = ring_field<uint>(s->cq_ring, params.cq_off.ring_mask);
+    s->cqes = ring_field<io_uring_cqe>(s->cq_ring, params.cq_off.cqes);
+    state_ = s;
+}
+
+io_ring::~io_ring() {
+    delete state_;
+}
+
+bool io_ring::write(const std::vector<write_op>& ops) {
+    std::vector<ring_op> ring_ops;
+    for (size_t i = 0; i < ops.size(); ++i) {
+        add_ops(ring_ops, IORING_OP_WRITE, ops[i].fd, const_cast<byte*>(ops[i].data), ops[i].len, ops[i].offset);
+    }
+
+    auto_lock(lock_);
+    return run_ops(*state_, ring_ops);
+}
+
+bool io_ring::sync(const std::vector<int>& fds) {
+    std::vector<ring_op> ring_ops;
+    for (size_t i = 0; i < fds.size(); ++i) {
+        ring_ops.push_back(ring_op(IORING_OP_FSYNC, fds[i], nilptr, 0, 0));
+    }
+
+    auto_lock(lock_);
+    return run_ops(*state_, ring_ops);
+}
+
+bool io_ring::read(int fd, ulong offset, byte* data, size_t len) {
+    std::vector<ring_op> ring_ops;
+    add_ops(ring_ops, IORING_OP_READ, fd, data, len, offset);
+    auto_lock(lock_);
+    return run_ops(*state_, ring_ops);
+}
+#else
+struct io_ring::ring_state {
+};
+
+io_ring::io_ring(uint)
+    : state_(nilptr), lock_() {
+    throw std::runtime_error("io_uring is not supported");
+}
+
+io_ring::~io_ring() {
+}
+
+bool io_ring::write(const std::vector<write_op>&) {
+    return false;
+}
+
+bool io_ring::sync(const std::vector<int>&) {
+    return false;
+}
+
+bool io_ring::read(int, ulong, byte*, size_t) {
+    return false;
+}
+#endif
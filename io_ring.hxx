@@ -0,0 +1,55 @@
+#ifndef _IO_RING_HXX_
+#define _IO_RING_HXX_
+
+namespace cornerstone {
+    /**
+    * A Linux io_uring instance, a batch of file writes or syncs is submitted by one system call and the batch is
+    * waited for as a whole, the batches are served one at a time, the kernel interface is used directly, no liburing
+    * is required, the constructor throws std::runtime_error if io_uring is not supported by the system.
+    * A batch that fails still waits for the ops that were submitted, if that fails as well, all later batches fail
+    */
+    class io_ring {
+    public:
+        struct write_op {
+            write_op(int fd, ulong offset, const byte* data, size_t len)
+                : fd(fd), offset(offset), data(data), len(len) {}
+
+            int fd;
+            ulong offset;
+            const byte* data;
+            size_t len;
+        };
+
+        struct ring_state;
+    public:
+        io_ring(uint entries = 64);
+        ~io_ring();
+
+        __nocopy__(io_ring)
+    public:
+        /**
+        * Writes all the data of the ops, the short writes are continued until all bytes are written
+        * @param ops
+        * @return false if any of the writes fails
+        */
+        bool write(const std::vector<write_op>& ops);
+
+        /**
+        * Syncs the data of the files to disk, fdatasync, all files are synced as one batch
+        * @param fds
+        * @return false if any of the syncs fails
+        */
+        bool sync(const std::vector<int>& fds);
+
+        /**
+        * Reads len bytes at offset of the file
+        * @return false if the file doesn't have len bytes at offset or the read fails
+        */
+        bool read(int fd, ulong offset, byte* data, size_t len);
+    private:
+        ring_state* state_;
+        std::mutex lock_;
+    };
+}
+
+#endif //_IO_RING_HXX_
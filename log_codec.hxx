@@ -0,0 +1,39 @@
+#ifndef _LOG_CODEC_HXX_
+#define _LOG_CODEC_HXX_
+
+namespace cornerstone {
+    /**
+    * A codec that compresses the log entries before they are written to the log store, the id of the codec is kept
+    * with each compressed entry, so that the entry is decompressed by the same codec, lz_codec is the built-in one
+    */
+    class log_codec {
+    __interface_body__(log_codec)
+
+    public:
+        /**
+        * The id of the codec, 1 is taken by lz_codec, 0 is reserved
+        */
+        virtual byte id() const = 0;
+
+        /**
+        * Compresses data and appends the compressed data to out
+        * @param data
+        * @param len
+        * @param out
+        * @return false if the data is not worth compressing, out may have been changed then
+        */
+        virtual bool compress(const byte* data, size_t len, std::vector<byte>& out) = 0;
+
+        /**
+        * Decompresses data into out, which must be exactly out_len bytes after decompressing
+        * @param data
+        * @param len
+        * @param out
+        * @param out_len
+        * @return false if the data is broken
+        */
+        virtual bool decompress(const byte* data, size_t len, byte* out, size_t out_len) = 0;
+    };
+}
+
+#endif //_LOG_CODEC_HXX_
@@ -0,0 +1,72 @@
+#ifndef _LOG_RECORD_HXX_
+#define _LOG_RECORD_HXX_
+
+// the framing of the log records on disk, which is shared by fs_log_store and mmap_log_store, so that the log packs
+// of one store could be applied to the other, it's internal to the log stores and not included by cornerstone.hxx
+namespace cornerstone {
+    // a record is the length and the CRC32C of the entry, followed by the entry, the integers are little endian
+    static const size_t record_header_size = sizeof(uint) * 2;
+
+    // the length of a record that has a compressed entry has this bit set
+    static const uint compressed_record = 0x80000000;
+
+    inline void put_ulong_to(byte* data, ulong val) {
+        for (size_t i = 0; i < sz_ulong; ++i) {
+            data[i] = static_cast<byte>(val >> (i * 8));
+        }
+    }
+
+    inline ulong get_ulong(const byte* data) {
+        ulong val = 0;
+        for (size_t i = 0; i < sz_ulong; ++i) {
+            val |= static_cast<ulong>(data[i]) << (i * 8);
+        }
+
+        return val;
+    }
+
+    inline void put_uint(byte* data, uint val) {
+        for (size_t i = 0; i < sizeof(uint); ++i) {
+            data[i] = static_cast<byte>(val >> (i * 8));
+        }
+    }
+
+    inline uint get_uint(const byte* data) {
+        uint val = 0;
+        for (size_t i = 0; i < sizeof(uint); ++i) {
+            val |= static_cast<uint>(data[i]) << (i * 8);
+        }
+
+        return val;
+    }
+
+    // the length of the entry of a record, len_field is the length field of the record header
+    inline uint record_len(uint len_field) {
+        return len_field & ~compressed_record;
+    }
+
+    // the checksum covers the length field as well, so that a torn length is detected, it starts from prev_crc,
+    // so that a store could chain each record to the one before it, the records of a log pack are not chained
+    inline uint record_crc(const byte* entry, uint len_field, uint prev_crc = 0) {
+        byte len_data[sizeof(uint)];
+        put_uint(len_data, len_field);
+        return crc32c(entry, record_len(len_field), crc32c(len_data, sizeof(uint), prev_crc));
+    }
+
+    inline void put_record_header(byte* header, const byte* entry, uint len_field) {
+        put_uint(header, len_field);
+        put_uint(header + sizeof(uint), record_crc(entry, len_field));
+    }
+
+    // whether the record of size bytes is an unchained record with a matching checksum
+    inline bool valid_record(const byte* record, ulong size) {
+        if (size < record_header_size) {
+            return false;
+        }
+
+        uint len_field = get_uint(record);
+        return record_len(len_field) == size - record_header_size && record_crc(record + record_header_size, len_field) == get_uint(record + sizeof(uint));
+    }
+}
+
+#endif //_LOG_RECORD_HXX_
@@ -29,6 +29,24 @@ namespace cornerstone {
         */
         virtual ulong append(ptr<log_entry>& entry) = 0;
 
+        /**
+        * Appends the log entries to store as one batch, the entries are written together
+        * @param entries
+        * @return the log index of the first entry in the batch
+        */
+        virtual ulong append_batch(std::vector<ptr<log_entry>>& entries) = 0;
+
+        /**
+        * Appends the log entries to store as one batch without waiting for them to be durable,
+        * the default implementation appends them by append_batch, so the result is ready once it returns
+        * @param entries
+        * @return the result that is set with the log index of the last entry once the entries are durable
+        */
+        virtual ptr<async_result<ulong>> append_async(std::vector<ptr<log_entry>>& entries) {
+            ulong last_idx = append_batch(entries) + entries.size() - 1;
+            return cs_new<async_result<ulong>>(last_idx);
+        }
+
         /**
         * Over writes a log entry at index of {@code index}
         * @param index a value < this->next_slot(), and starts from 1
@@ -36,6 +54,12 @@ namespace cornerstone {
         */
         virtual void write_at(ulong index, ptr<log_entry>& entry) = 0;
 
+        /**
+        * Removes all log entries starting from index in one operation, it's how the conflicting entries are rolled back
+        * @param index a value <= this->next_slot(), and starts from 1
+        */
+        virtual void truncate(ulong index) = 0;
+
         /**
         * Get log entries with index between start and end
         * @param start, the start index of log entries
@@ -59,6 +83,30 @@ namespace cornerstone {
         */
         virtual ulong term_at(ulong index) = 0;
 
+        /**
+        * Gets the first index of the term of the log entry at the specified index, it's where the run of the entries
+        * with that term starts, the terms never go down along the log, so the default implementation does a binary
+        * search with term_at
+        * @param index, a value >= this->start_index() and < this->next_slot()
+        * @return the first index of the term, or this->start_index() if the term starts before it
+        */
+        virtual ulong first_index_of_term(ulong index) {
+            ulong term = term_at(index);
+            ulong low = start_index();
+            ulong high = index;
+            while (low < high) {
+                ulong mid = low + (high - low) / 2;
+                if (term_at(mid) < term) {
+                    low = mid + 1;
+                }
+                else {
+                    high = mid;
+                }
+            }
+
+            return low;
+        }
+
         /**
         * Pack cnt log items starts from index
         * @param index
@@ -80,6 +128,13 @@ namespace cornerstone {
         * @return compact successfully or not
         */
         virtual bool compact(ulong last_log_index) = 0;
+
+        /**
+        * The last log index that is durable, the default implementation takes all entries in store as durable
+        */
+        virtual ulong durable_index() const {
+            return next_slot() - 1;
+        }
     };
 }
 
@@ -0,0 +1,165 @@
+#include "cornerstone.hxx"
+
+using namespace cornerstone;
+
+// a match is at least LZ_MIN_MATCH bytes, the last LZ_LAST_LITERALS bytes are always literals and no match starts
+// within the last LZ_MATCH_LIMIT bytes, as the LZ4 block format requires
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5
+#define LZ_MATCH_LIMIT 12
+#define LZ_MAX_OFFSET 0xFFFF
+#define LZ_HASH_BITS 12
+
+const byte lz_codec::codec_id;
+
+static uint read_uint(const byte* data) {
+    uint val;
+    ::memcpy(&val, data, sizeof(uint));
+    return val;
+}
+
+static uint hash_of(uint val) {
+    return (val * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+// a length that doesn't fit into the 4 bits of the token is continued by bytes, 255 means there are more
+static void put_length(std::vector<byte>& out, size_t len) {
+    for (; len >= 255; len -= 255) {
+        out.push_back(255);
+    }
+
+    out.push_back(static_cast<byte>(len));
+}
+
+static bool get_length(const byte* data, size_t len, size_t& pos, size_t& result) {
+    byte b = 255;
+    while (b == 255) {
+        if (pos >= len) {
+            return false;
+        }
+
+        b = data[pos++];
+        result += b;
+    }
+
+    return true;
+}
+
+static void put_sequence(std::vector<byte>& out, const byte* literals, size_t literal_len, size_t offset, size_t match_len) {
+    size_t match_code = match_len > 0 ? match_len - LZ_MIN_MATCH : 0;
+    out.push_back(static_cast<byte>((std::min(literal_len, static_cast<size_t>(15)) << 4) | std::min(match_code, static_cast<size_t>(15))));
+    if (literal_len >= 15) {
+        put_length(out, literal_len - 15);
+    }
+
+    out.insert(out.end(), literals, literals + literal_len);
+    if (match_len == 0) {
+        return;
+    }
+
+    out.push_back(static_cast<byte>(offset));
+    out.push_back(static_cast<byte>(offset >> 8));
+    if (match_code >= 15) {
+        put_length(out, match_code - 15);
+    }
+}
+
+byte lz_codec::id() const {
+    return codec_id;
+}
+
+bool lz_codec::compress(const byte* data, size_t len, std::vector<byte>& out) {
+    if (len <= LZ_MATCH_LIMIT) {
+        return false;
+    }
+
+    // the positions are kept plus one, so that zero is an empty slot
+    uint table[1 << LZ_HASH_BITS];
+    ::memset(table, 0, sizeof(table));
+    size_t out_start = out.size();
+    size_t anchor = 0;
+    size_t pos = 0;
+    while (pos + LZ_MATCH_LIMIT < len) {
+        uint seq = read_uint(data + pos);
+        uint& slot = table[hash_of(seq)];
+        size_t candidate = slot;
+        slot = static_cast<uint>(pos + 1);
+        if (candidate == 0 || pos - (candidate - 1) > LZ_MAX_OFFSET || read_uint(data + candidate - 1) != seq) {
+            pos += 1;
+            continue;
+        }
+
+        candidate -= 1;
+        size_t match_len = LZ_MIN_MATCH;
+        while (pos + match_len < len - LZ_LAST_LITERALS && data[candidate + match_len] == data[pos + match_len]) {
+            ++match_len;
+        }
+
+        put_sequence(out, data + anchor, pos - anchor, pos - candidate, match_len);
+        pos += match_len;
+        anchor = pos;
+        if (out.size() - out_start >= len) {
+            return false;
+        }
+    }
+
+    put_sequence(out, data + anchor, len - anchor, 0, 0);
+    return out.size() - out_start < len;
+}
+
+bool lz_codec::decompress(const byte* data, size_t len, byte* out, size_t out_len) {
+    size_t pos = 0;
+    size_t out_pos = 0;
+    while (pos < len) {
+        byte token = data[pos++];
+        size_t literal_len = token >> 4;
+        if (literal_len == 15 && !get_length(data, len, pos, literal_len)) {
+            return false;
+        }
+
+        if (literal_len > len - pos || literal_len > out_len - out_pos) {
+            return false;
+        }
+
+        ::memcpy(out + out_pos, data + pos, literal_len);
+        pos += literal_len;
+        out_pos += literal_len;
+
+        // the last sequence has the literals only
+        if (pos == len) {
+            break;
+        }
+
+        if (len - pos < 2) {
+            return false;
+        }
+
+        size_t offset = static_cast<size_t>(data[pos]) | (static_cast<size_t>(data[pos + 1]) << 8);
+        pos += 2;
+        size_t match_len = token & 0x0F;
+        if (match_len == 15 && !get_length(data, len, pos, match_len)) {
+            return false;
+        }
+
+        match_len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > out_pos || match_len > out_len - out_pos) {
+            return false;
+        }
+
+        // the match could overlap the bytes it produces, so it's copied byte by byte then
+        byte* dst = out + out_pos;
+        const byte* src = dst - offset;
+        if (offset >= match_len) {
+            ::memcpy(dst, src, match_len);
+        }
+        else {
+            for (size_t i = 0; i < match_len; ++i) {
+                dst[i] = src[i];
+            }
+        }
+
+        out_pos += match_len;
+    }
+
+    return out_pos == out_len;
+}
@@ -0,0 +1,25 @@
+#ifndef _LZ_CODEC_HXX_
+#define _LZ_CODEC_HXX_
+
+namespace cornerstone {
+    /**
+    * A fast LZ77 codec, the compressed data is a list of sequences in the LZ4 block format, each sequence is a run of
+    * literals followed by a match of at least 4 bytes within the last 64KB, matches are found through a hash table of
+    * 4 bytes prefixes, so the compression is a single pass over the data
+    */
+    class lz_codec : public log_codec {
+    public:
+        static const byte codec_id = 1;
+    public:
+        lz_codec() {}
+
+        __nocopy__(lz_codec)
+
+    public:
+        virtual byte id() const;
+        virtual bool compress(const byte* data, size_t len, std::vector<byte>& out);
+        virtual bool decompress(const byte* data, size_t len, byte* out, size_t out_len);
+    };
+}
+
+#endif //_LZ_CODEC_HXX_
@@ -0,0 +1,890 @@
+#include "cornerstone.hxx"
+#include "log_record.hxx"
+
+#define LOG_MAP_SEGMENT_FILE "store.%llu.map"
+#define LOG_MAP_SPARE_FILE "store.spare.%llu.map"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+using namespace cornerstone;
+
+// the segment file starts with the magic, "CSMAP" and the format version, the start index of the segment and
+// the start index of the store when the segment is created or compacted, and then the records, a zero length ends
+// the records, the checksum of each record starts from the checksum of the record before it, so a record is only valid
+// if all records before it are, the compressed records are not supported by this store
+static const ulong map_segment_magic = 0x01000050414D5343;
+static const size_t map_header_size = sz_ulong * 3;
+
+static ptr<log_entry> no_entry(cs_new<log_entry>(0, ptr<buffer>(), log_val_type::app_log));
+
+#ifndef _WIN32
+static void list_files(const std::string& folder, std::vector<std::string>& files) {
+    DIR* dir = ::opendir(folder.empty() ? "." : folder.c_str());
+    if (dir == nilptr) {
+        throw std::runtime_error(sstrfmt("fail to list the log folder, error %d").fmt(errno));
+    }
+
+    for (struct dirent* ent = ::readdir(dir); ent != nilptr; ent = ::readdir(dir)) {
+        files.push_back(ent->d_name);
+    }
+
+    ::closedir(dir);
+}
+
+// maps the file for reading and writing, with create, the file is created or resized to size bytes and
+// the blocks are allocated up front, so writing to the mapping doesn't run out of disk space, otherwise,
+// the whole file is mapped and size is set to the size of the file
+static byte* map_file(const std::string& path, bool create, ulong& size, int& fd) {
+    fd = ::open(path.c_str(), O_RDWR | (create ? O_CREAT : 0), 0644);
+    if (fd < 0) {
+        throw std::runtime_error(sstrfmt("fail to open log segment, error %d").fmt(errno));
+    }
+
+    bool ok = true;
+    if (create) {
+        ok = ::ftruncate(fd, static_cast<off_t>(size)) == 0;
+#ifdef __linux__
+        // the file system may not support it, the blocks are allocated by the page faults then
+        if (ok) {
+            ::fallocate(fd, 0, 0, static_cast<off_t>(size));
+        }
+#endif
+    }
+    else {
+        struct stat st;
+        ok = ::fstat(fd, &st) == 0;
+        size = ok ? static_cast<ulong>(st.st_size) : 0;
+    }
+
+    void* base = MAP_FAILED;
+    if (ok && size >= map_header_size + record_header_size) {
+        base = ::mmap(nilptr, static_cast<size_t>(size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+
+    if (base == MAP_FAILED) {
+        int err = errno;
+        ::close(fd);
+        fd = -1;
+        throw std::runtime_error(sstrfmt("fail to map log segment, error %d").fmt(err));
+    }
+
+    return static_cast<byte*>(base);
+}
+
+static void unmap_file(byte* base, ulong size, int fd) {
+    ::munmap(base, static_cast<size_t>(size));
+    ::close(fd);
+}
+
+// msync takes page aligned addresses
+static bool sync_mapped(byte* base, ulong start, ulong end) {
+    ulong page_size = static_cast<ulong>(::sysconf(_SC_PAGESIZE));
+    start -= start % page_size;
+    return ::msync(base + start, static_cast<size_t>(end - start), MS_SYNC) == 0;
+}
+#else
+static void list_files(const std::string&, std::vector<std::string>&) {
+}
+
+static byte* map_file(const std::string&, bool, ulong&, int&) {
+    throw std::runtime_error("memory mapped log store is not supported");
+}
+
+static void unmap_file(byte*, ulong, int) {
+}
+
+static bool sync_mapped(byte*, ulong, ulong) {
+    return false;
+}
+#endif
+
+namespace cornerstone {
+    // a segment file that is mapped as a whole, the records are written into the mapping directly, the readers
+    // copy the entries out of it,
+    // the range of the mapping that is written since last sync is tracked, so only that range is synced
+    class mapped_segment {
+    public:
+        mapped_segment(const std::string& path, int fd, byte* base, ulong size)
+            : path_(path),
+            fd_(fd),
+            base_(base),
+            size_(size),
+            offsets_(),
+            end_(map_header_size),
+            tail_crc_(0),
+            dirty_start_(0),
+            dirty_end_(0) {}
+
+        ~mapped_segment() {
+            close();
+        }
+
+        __nocopy__(mapped_segment)
+
+    public:
+        // creates the segment, a spare file is reused if spare_path is not empty
+        static ptr<mapped_segment> create(const std::string& path, const std::string& spare_path, ulong start_idx, ulong first_idx, ulong size) {
+            if (!spare_path.empty() && std::rename(spare_path.c_str(), path.c_str()) != 0) {
+                throw std::runtime_error("fail to reuse the spare log segment");
+            }
+
+            int fd = -1;
+            byte* base = map_file(path, true, size, fd);
+            ptr<mapped_segment> seg(cs_new<mapped_segment>(path, fd, base, size));
+            put_ulong_to(base, map_segment_magic);
+            put_ulong_to(base + sz_ulong, start_idx);
+            put_ulong_to(base + sz_ulong * 2, first_idx);
+            ::memset(base + map_header_size, 0, record_header_size);
+            seg->tail_crc_ = seg->seed();
+            seg->touch(0, map_header_size + record_header_size);
+            return seg;
+        }
+
+        // opens the segment, the records are scanned until the first one that is not valid
+        static ptr<mapped_segment> open(const std::string& path) {
+            int fd = -1;
+            ulong size = 0;
+            byte* base = map_file(path, false, size, fd);
+            ptr<mapped_segment> seg(cs_new<mapped_segment>(path, fd, base, size));
+            if (get_ulong(base) != map_segment_magic) {
+                throw std::runtime_error("bad log segment, the magic doesn't match");
+            }
+
+            seg->scan();
+            return seg;
+        }
+
+    public:
+        const std::string& path() const {
+            return path_;
+        }
+
+        ulong size() const {
+            return size_;
+        }
+
+        ulong start_idx() const {
+            return get_ulong(base_ + sz_ulong);
+        }
+
+        ulong first_idx() const {
+            return get_ulong(base_ + sz_ulong * 2);
+        }
+
+        ulong next_idx() const {
+            return start_idx() + offsets_.size();
+        }
+
+        // the record and the zero length after it must fit into the segment
+        bool has_room(size_t entry_len) const {
+            return end_ + record_header_size * 2 + entry_len <= size_;
+        }
+
+        void append(ulong term, byte type, const byte* data, size_t len) {
+            byte* record = base_ + end_;
+            byte* entry = record + record_header_size;
+            uint entry_len = static_cast<uint>(sz_ulong + 1 + len);
+            put_ulong_to(entry, term);
+            entry[sz_ulong] = type;
+            if (len > 0) {
+                ::memcpy(entry + sz_ulong + 1, data, len);
+            }
+
+            ::memset(entry + entry_len, 0, record_header_size);
+            tail_crc_ = record_crc(entry, entry_len, tail_crc_);
+            put_uint(record, entry_len);
+            put_uint(record + sizeof(uint), tail_crc_);
+            offsets_.push_back(end_);
+            touch(end_, record_header_size * 2 + entry_len);
+            end_ += record_header_size + entry_len;
+        }
+
+        // the serialized log entry in the mapping, it's only valid until the segment is truncated or closed,
+        // so it's copied by the readers
+        const byte* entry(ulong index, size_t& len) const {
+            const byte* record = base_ + offsets_[static_cast<size_t>(index - start_idx())];
+            len = get_uint(record);
+            return record + record_header_size;
+        }
+
+        // removes the records starting from index, the zero length takes the place of the first record
+        void truncate(ulong index) {
+            size_t cnt = static_cast<size_t>(index - start_idx());
+            if (cnt >= offsets_.size()) {
+                return;
+            }
+
+            end_ = offsets_[cnt];
+            tail_crc_ = cnt == 0 ? seed() : get_uint(base_ + offsets_[cnt - 1] + sizeof(uint));
+            offsets_.resize(cnt);
+            ::memset(base_ + end_, 0, record_header_size);
+            touch(end_, record_header_size);
+        }
+
+        void set_first_idx(ulong first_idx) {
+            put_ulong_to(base_ + sz_ulong * 2, first_idx);
+            touch(sz_ulong * 2, sz_ulong);
+        }
+
+        // grows the file of a segment without records, so it could take an entry that is larger than the segment size
+        void extend(ulong size) {
+            unmap_file(base_, size_, fd_);
+            base_ = nilptr;
+            base_ = map_file(path_, true, size, fd_);
+            size_ = size;
+        }
+
+        void sync() {
+            if (dirty_end_ == 0) {
+                return;
+            }
+
+            if (!sync_mapped(base_, dirty_start_, dirty_end_)) {
+                throw std::runtime_error("fail to sync log segment");
+            }
+
+            dirty_start_ = dirty_end_ = 0;
+        }
+
+        void close() {
+            if (base_ != nilptr) {
+                unmap_file(base_, size_, fd_);
+                base_ = nilptr;
+                fd_ = -1;
+            }
+        }
+
+    private:
+        // the checksum chain starts from the checksum of the magic and the start index,
+        // so the records of a reused file never chain to the new header
+        uint seed() const {
+            return crc32c(base_, sz_ulong * 2);
+        }
+
+        void touch(ulong offset, ulong len) {
+            if (dirty_end_ == 0) {
+                dirty_start_ = offset;
+                dirty_end_ = offset + len;
+                return;
+            }
+
+            dirty_start_ = std::min(dirty_start_, offset);
+            dirty_end_ = std::max(dirty_end_, offset + len);
+        }
+
+        void scan() {
+            ulong pos = map_header_size;
+            uint crc = seed();
+            while (pos + record_header_size <= size_) {
+                uint len = get_uint(base_ + pos);
+                if (len < sz_ulong + 1 || (len & compressed_record) != 0 || len > size_ - pos - record_header_size) {
+                    break;
+                }
+
+                uint next_crc = record_crc(base_ + pos + record_header_size, len, crc);
+                if (next_crc != get_uint(base_ + pos + sizeof(uint))) {
+                    break;
+                }
+
+                offsets_.push_back(pos);
+                crc = next_crc;
+                pos += record_header_size + len;
+            }
+
+            end_ = pos;
+            tail_crc_ = crc;
+
+            // a torn or a stale record after the last one is replaced by the zero length
+            if (end_ + record_header_size <= size_ && get_uint(base_ + end_) != 0) {
+                ::memset(base_ + end_, 0, record_header_size);
+                touch(end_, record_header_size);
+            }
+        }
+
+    private:
+        std::string path_;
+        int fd_;
+        byte* base_;
+        ulong size_;
+        std::vector<ulong> offsets_;
+        ulong end_;
+        uint tail_crc_;
+        ulong dirty_start_;
+        ulong dirty_end_;
+    };
+}
+
+const ulong mmap_log_store::default_segment_size = 16 * 1024 * 1024;
+const size_t mmap_log_store::max_spare_segments = 4;
+
+mmap_log_store::mmap_log_store(const std::string& log_folder, ulong segment_size, durability_policy durability, int32 sync_interval)
+    : log_folder_(log_folder),
+    segment_size_(segment_size),
+    durability_(durability),
+    sync_interval_(sync_interval > 0 ? sync_interval : 1),
+    segments_(),
+    spares_(),
+    start_idx_(1),
+    next_idx_(1),
+    durable_idx_(0),
+    last_sync_(std::chrono::steady_clock::now()),
+    store_lock_(),
+    stopping_(false),
+    sync_lock_(),
+    bg_cv_(),
+    waiters_(),
+    sync_thread_() {
+#ifdef _WIN32
+    throw std::runtime_error("memory mapped log store is not supported");
+#else
+    if (log_folder_.length() > 0 && log_folder_[log_folder_.length() - 1] != '/') {
+        log_folder_.push_back('/');
+    }
+
+    load_segments();
+    if (durability_ == interval_sync) {
+        sync_thread_ = std::thread(std::bind(&mmap_log_store::sync_in_bg, this));
+    }
+#endif
+}
+
+mmap_log_store::~mmap_log_store() {
+    close();
+}
+
+ulong mmap_log_store::next_slot() const {
+    recur_lock(store_lock_);
+    return next_idx_;
+}
+
+ulong mmap_log_store::start_index() const {
+    recur_lock(store_lock_);
+    return start_idx_;
+}
+
+ptr<log_entry> mmap_log_store::last_entry() const {
+    recur_lock(store_lock_);
+    if (next_idx_ == start_idx_) {
+        return no_entry;
+    }
+
+    return read_entry(next_idx_ - 1);
+}
+
+ulong mmap_log_store::append(ptr<log_entry>& entry) {
+    recur_lock(store_lock_);
+    ulong index = next_idx_;
+    append_entry(*entry);
+    commit_writes();
+    return index;
+}
+
+ulong mmap_log_store::append_batch(std::vector<ptr<log_entry>>& entries) {
+    recur_lock(store_lock_);
+    ulong first_idx = next_idx_;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        append_entry(*entries[i]);
+    }
+
+    // the batch is the group commit, all entries are synced by one msync for each segment
+    if (entries.size() > 0) {
+        commit_writes();
+    }
+
+    return first_idx;
+}
+
+ptr<async_result<ulong>> mmap_log_store::append_async(std::vector<ptr<log_entry>>& entries) {
+    ulong last_idx = append_batch(entries) + entries.size() - 1;
+    ptr<async_result<ulong>> result(cs_new<async_result<ulong>>());
+
+    // the durable index is checked with the sync lock held, the same lock that the waiters are completed with
+    if (durability_ == interval_sync) {
+        auto_lock(sync_lock_);
+        if (durable_idx_ < last_idx) {
+            waiters_.push_back(std::make_pair(last_idx, result));
+            return result;
+        }
+    }
+
+    ptr<std::exception> no_err;
+    result->set_result(last_idx, no_err);
+    return result;
+}
+
+void mmap_log_store::write_at(ulong index, ptr<log_entry>& entry) {
+    recur_lock(store_lock_);
+    if (index < start_idx_ || index > next_idx_) {
+        throw std::range_error("index out of range");
+    }
+
+    if (index < next_idx_) {
+        truncate_from(index);
+    }
+
+    append_entry(*entry);
+    commit_writes();
+}
+
+void mmap_log_store::truncate(ulong index) {
+    recur_lock(store_lock_);
+    if (index < start_idx_ || index > next_idx_) {
+        throw std::range_error("index out of range");
+    }
+
+    if (index < next_idx_) {
+        truncate_from(index);
+        commit_writes();
+    }
+}
+
+ptr<std::vector<ptr<log_entry>>> mmap_log_store::log_entries(ulong start, ulong end) {
+    recur_lock(store_lock_);
+    if (start < start_idx_) {
+        throw std::range_error("index out of range");
+    }
+
+    if (start >= end || start >= next_idx_) {
+        return ptr<std::vector<ptr<log_entry>>>();
+    }
+
+    ulong good_end = std::min(end, next_idx_);
+    ptr<std::vector<ptr<log_entry>>> results(cs_new<std::vector<ptr<log_entry>>>());
+    results->reserve(static_cast<size_t>(good_end - start));
+    for (ulong idx = start; idx < good_end; ++idx) {
+        results->push_back(read_entry(idx));
+    }
+
+    return results;
+}
+
+ptr<log_entry> mmap_log_store::entry_at(ulong index) {
+    recur_lock(store_lock_);
+    if (index < start_idx_) {
+        throw std::range_error("index out of range");
+    }
+
+    if (index >= next_idx_) {
+        return ptr<log_entry>();
+    }
+
+    return read_entry(index);
+}
+
+ulong mmap_log_store::term_at(ulong index) {
+    recur_lock(store_lock_);
+    if (index < start_idx_) {
+        throw std::range_error("index out of range");
+    }
+
+    if (index >= next_idx_) {
+        return 0;
+    }
+
+    // IMPORTANT!!
+    // We hack the log_entry serialization details here
+    size_t len = 0;
+    return get_ulong(segment_of(index)->entry(index, len));
+}
+
+ptr<buffer> mmap_log_store::pack(ulong index, int32 cnt) {
+    recur_lock(store_lock_);
+    if (index < start_idx_) {
+        throw std::range_error("index out of range");
+    }
+
+    if (index >= next_idx_) {
+        return ptr<buffer>();
+    }
+
+    // pack format, int32 idx_len, int32 data_len, idx_len bytes of offsets and data_len bytes of log records,
+    // the same as the packs of fs_log_store, the records are framed with unchained checksums
+    ulong end_idx = std::min(index + static_cast<ulong>(cnt), next_idx_);
+    size_t idx_len = static_cast<size_t>(end_idx - index) * sz_ulong;
+    size_t data_len = 0;
+    for (ulong idx = index; idx < end_idx; ++idx) {
+        size_t len = 0;
+        segment_of(idx)->entry(idx, len);
+        data_len += record_header_size + len;
+    }
+
+    ptr<buffer> result = buffer::alloc(2 * sz_int + idx_len + data_len);
+    result->put(static_cast<int32>(idx_len));
+    result->put(static_cast<int32>(data_len));
+    ulong data_pos = 0;
+    for (ulong idx = index; idx < end_idx; ++idx) {
+        size_t len = 0;
+        segment_of(idx)->entry(idx, len);
+        result->put(data_pos);
+        data_pos += record_header_size + len;
+    }
+
+    // the records are copied once, from the mapping straight into the pack
+    byte* data = result->data();
+    for (ulong idx = index; idx < end_idx; ++idx) {
+        size_t len = 0;
+        const byte* entry = segment_of(idx)->entry(idx, len);
+        ::memcpy(data + record_header_size, entry, len);
+        put_record_header(data, entry, static_cast<uint>(len));
+        data += record_header_size + len;
+    }
+
+    result->pos(0);
+    return result;
+}
+
+void mmap_log_store::apply_pack(ulong index, buffer& pack) {
+    recur_lock(store_lock_);
+    if (index < start_idx_ || index > next_idx_) {
+        throw std::range_error("index out of range");
+    }
+
+    // the pack comes from the wire, its index and data must fit in what is left of it before anything is read from them
+    int32 idx_len = pack.get_int();
+    int32 data_len = pack.get_int();
+    if (idx_len < 0 || data_len < 0 || idx_len % sz_ulong != 0 ||
+        static_cast<ulong>(idx_len) + static_cast<ulong>(data_len) > static_cast<ulong>(pack.size() - pack.pos())) {
+        throw std::runtime_error("bad log pack, the index or data length is out of range");
+    }
+
+    size_t cnt = static_cast<size_t>(idx_len) / sz_ulong;
+    std::vector<ulong> offsets;
+    for (size_t i = 0; i < cnt; ++i) {
+        offsets.push_back(pack.get_ulong());
+        if (i > 0 && offsets[i] <= offsets[i - 1]) {
+            throw std::runtime_error("bad log pack, the log offsets are not increasing");
+        }
+    }
+
+    // the offsets in the pack may not start from zero (packed by a store without segments), rebase them
+    ulong base = cnt > 0 ? offsets[0] : 0;
+    if (cnt > 0 && offsets[cnt - 1] - base > static_cast<ulong>(data_len)) {
+        throw std::runtime_error("bad log pack, the log offsets are beyond the data");
+    }
+
+    offsets.push_back(base + static_cast<ulong>(data_len));
+    const byte* data = pack.data();
+    for (size_t i = 0; i < cnt; ++i) {
+        const byte* record = data + (offsets[i] - base);
+        ulong size = offsets[i + 1] - offsets[i];
+        if (size < record_header_size + sz_ulong + 1) {
+            throw std::runtime_error("bad log pack, the log record is broken");
+        }
+
+        if ((get_uint(record) & compressed_record) != 0) {
+            throw std::runtime_error("bad log pack, compressed log records are not supported");
+        }
+
+        if (!valid_record(record, size)) {
+            throw std::runtime_error("bad log pack, the log record is broken");
+        }
+    }
+
+    if (index < next_idx_) {
+        truncate_from(index);
+    }
+
+    for (size_t i = 0; i < cnt; ++i) {
+        const byte* entry = data + (offsets[i] - base) + record_header_size;
+        size_t len = static_cast<size_t>(offsets[i + 1] - offsets[i]) - record_header_size;
+        append_record(get_ulong(entry), entry[sz_ulong], entry + sz_ulong + 1, len - sz_ulong - 1);
+    }
+
+    commit_writes();
+}
+
+bool mmap_log_store::compact(ulong last_log_index) {
+    recur_lock(store_lock_);
+    if (last_log_index < start_idx_) {
+        throw std::range_error("index out of range");
+    }
+
+    // the new start index is synced to the segment that has it before the compacted segments are dropped,
+    // the segments that are left by an interrupted compaction are dropped on next open
+    ulong new_start_idx = last_log_index + 1;
+    size_t cnt = 0;
+    if (new_start_idx >= next_idx_) {
+        // all entries are compacted, start over with a new segment, unless the last one is already there
+        if (segments_.back()->start_idx() != new_start_idx) {
+            start_idx_ = new_start_idx;
+            segments_.push_back(create_segment(new_start_idx, segment_size_));
+        }
+
+        next_idx_ = new_start_idx;
+        cnt = segments_.size() - 1;
+    }
+    else {
+        while (segments_[cnt]->next_idx() <= new_start_idx) {
+            ++cnt;
+        }
+    }
+
+    start_idx_ = new_start_idx;
+    segments_[cnt]->set_first_idx(start_idx_);
+    segments_[cnt]->sync();
+    for (size_t i = 0; i < cnt; ++i) {
+        retire_segment(*segments_[i]);
+    }
+
+    segments_.erase(segments_.begin(), segments_.begin() + cnt);
+    if (durable_idx_ < start_idx_ - 1) {
+        durable_idx_ = start_idx_ - 1;
+    }
+
+    return true;
+}
+
+ulong mmap_log_store::durable_index() const {
+    recur_lock(store_lock_);
+    return durable_idx_;
+}
+
+void mmap_log_store::sync() {
+    ulong durable_idx = 0;
+    {
+        recur_lock(store_lock_);
+        for (size_t i = 0; i < segments_.size(); ++i) {
+            segments_[i]->sync();
+        }
+
+        durable_idx_ = durable_idx = next_idx_ - 1;
+        last_sync_ = std::chrono::steady_clock::now();
+    }
+
+    complete_waiters(durable_idx);
+}
+
+void mmap_log_store::close() {
+    {
+        auto_lock(sync_lock_);
+        stopping_ = true;
+        bg_cv_.notify_all();
+    }
+
+    if (sync_thread_.joinable()) {
+        sync_thread_.join();
+    }
+
+    recur_lock(store_lock_);
+    if (segments_.size() == 0) {
+        return;
+    }
+
+    if (durability_ != no_sync) {
+        sync();
+    }
+
+    for (size_t i = 0; i < segments_.size(); ++i) {
+        segments_[i]->close();
+    }
+
+    segments_.clear();
+}
+
+void mmap_log_store::append_entry(log_entry& entry) {
+    buffer& data = entry.get_buf();
+    data.pos(0);
+    append_record(entry.get_term(), static_cast<byte>(entry.get_val_type()), data.data(), data.size());
+}
+
+void mmap_log_store::append_record(ulong term, byte type, const byte* data, size_t len) {
+    size_t entry_len = sz_ulong + 1 + len;
+    if (!segments_.back()->has_room(entry_len)) {
+        // an entry that is larger than the segment size gets a segment of its own
+        ulong size = std::max(segment_size_, static_cast<ulong>(map_header_size + record_header_size * 2 + entry_len));
+        if (segments_.back()->next_idx() == segments_.back()->start_idx()) {
+            segments_.back()->extend(size);
+        }
+        else {
+            segments_.push_back(create_segment(next_idx_, size));
+        }
+    }
+
+    segments_.back()->append(term, type, data, len);
+    next_idx_ += 1;
+}
+
+void mmap_log_store::commit_writes() {
+    if (durability_ == per_batch_sync) {
+        sync();
+    }
+    else if (durability_ == interval_sync && std::chrono::steady_clock::now() - last_sync_ >= std::chrono::milliseconds(sync_interval_)) {
+        sync();
+    }
+}
+
+void mmap_log_store::truncate_from(ulong index) {
+    // the segments after index go first, so an interrupted truncation leaves the entries before index only
+    while (segments_.size() > 1 && segments_.back()->start_idx() >= index) {
+        retire_segment(*segments_.back());
+        segments_.pop_back();
+    }
+
+    segments_.back()->truncate(index);
+    next_idx_ = index;
+    if (durable_idx_ >= index) {
+        durable_idx_ = index - 1;
+    }
+}
+
+// sets the results of the waiting appends that have the last index <= index, the results are set without the sync lock
+void mmap_log_store::complete_waiters(ulong index) {
+    std::vector<std::pair<ulong, ptr<async_result<ulong>>>> completed;
+    {
+        auto_lock(sync_lock_);
+        std::vector<std::pair<ulong, ptr<async_result<ulong>>>> waiting;
+        for (size_t i = 0; i < waiters_.size(); ++i) {
+            if (waiters_[i].first <= index) {
+                completed.push_back(waiters_[i]);
+            }
+            else {
+                waiting.push_back(waiters_[i]);
+            }
+        }
+
+        waiters_.swap(waiting);
+    }
+
+    ptr<std::exception> no_err;
+    for (size_t i = 0; i < completed.size(); ++i) {
+        completed[i].second->set_result(completed[i].first, no_err);
+    }
+}
+
+// with interval_sync policy, the background thread syncs the written entries every sync_interval milliseconds,
+// so the durable index doesn't wait for the next append, a failed sync is retried in next round
+void mmap_log_store::sync_in_bg() {
+    std::unique_lock<std::mutex> lock(sync_lock_);
+    while (!stopping_) {
+        bg_cv_.wait_for(lock, std::chrono::milliseconds(sync_interval_));
+        if (stopping_) {
+            break;
+        }
+
+        lock.unlock();
+        try {
+            sync();
+        }
+        catch (std::exception&) {
+        }
+
+        lock.lock();
+    }
+}
+
+ptr<mapped_segment> mmap_log_store::create_segment(ulong start_idx, ulong size) {
+    std::string spare_path;
+    if (size == segment_size_ && spares_.size() > 0) {
+        spare_path = spares_.back();
+        spares_.pop_back();
+    }
+
+    return mapped_segment::create(log_folder_ + sstrfmt(LOG_MAP_SEGMENT_FILE).fmt(start_idx), spare_path, start_idx, start_idx_, size);
+}
+
+void mmap_log_store::retire_segment(mapped_segment& seg) {
+    seg.close();
+
+    // the files of the segment size are kept for the next segments, as many as max_spare_segments
+    if (seg.size() == segment_size_ && spares_.size() < max_spare_segments) {
+        for (ulong n = 0; ; ++n) {
+            std::string spare_path = log_folder_ + sstrfmt(LOG_MAP_SPARE_FILE).fmt(n);
+            if (std::find(spares_.begin(), spares_.end(), spare_path) != spares_.end()) {
+                continue;
+            }
+
+            if (std::rename(seg.path().c_str(), spare_path.c_str()) == 0) {
+                spares_.push_back(spare_path);
+                return;
+            }
+
+            break;
+        }
+    }
+
+    std::remove(seg.path().c_str());
+}
+
+const ptr<mapped_segment>& mmap_log_store::segment_of(ulong index) const {
+    // the last segment that starts at or before index
+    size_t low = 0;
+    size_t high = segments_.size();
+    while (high - low > 1) {
+        size_t mid = (low + high) / 2;
+        if (segments_[mid]->start_idx() <= index) {
+            low = mid;
+        }
+        else {
+            high = mid;
+        }
+    }
+
+    return segments_[low];
+}
+
+ptr<log_entry> mmap_log_store::read_entry(ulong index) const {
+    size_t len = 0;
+    const byte* entry = segment_of(index)->entry(index, len);
+    ptr<buffer> data = buffer::alloc(len - sz_ulong - 1);
+    ::memcpy(data->data(), entry + sz_ulong + 1, len - sz_ulong - 1);
+    return cs_new<log_entry>(get_ulong(entry), data, static_cast<log_val_type>(entry[sz_ulong]));
+}
+
+void mmap_log_store::load_segments() {
+    std::vector<std::string> files;
+    list_files(log_folder_, files);
+    std::vector<std::pair<ulong, std::string>> seg_files;
+    for (size_t i = 0; i < files.size(); ++i) {
+        unsigned long long num = 0;
+        char tail = 0;
+        if (std::sscanf(files[i].c_str(), LOG_MAP_SEGMENT_FILE "%c", &num, &tail) == 1) {
+            seg_files.push_back(std::make_pair(static_cast<ulong>(num), log_folder_ + files[i]));
+        }
+        else if (std::sscanf(files[i].c_str(), LOG_MAP_SPARE_FILE "%c", &num, &tail) == 1) {
+            spares_.push_back(log_folder_ + files[i]);
+        }
+    }
+
+    std::sort(seg_files.begin(), seg_files.end());
+    for (size_t i = 0; i < seg_files.size(); ++i) {
+        segments_.push_back(mapped_segment::open(seg_files[i].second));
+        start_idx_ = std::max(start_idx_, segments_.back()->first_idx());
+    }
+
+    if (segments_.size() == 0) {
+        segments_.push_back(create_segment(start_idx_, segment_size_));
+        segments_.back()->sync();
+    }
+
+    // drop the segments that are left behind by an interrupted compaction
+    size_t cnt = 0;
+    while (cnt < segments_.size() - 1 && segments_[cnt]->next_idx() <= start_idx_) {
+        retire_segment(*segments_[cnt++]);
+    }
+
+    segments_.erase(segments_.begin(), segments_.begin() + cnt);
+
+    // and the ones that are left behind by an interrupted truncation, which don't follow the segments before them
+    for (cnt = 1; cnt < segments_.size() && segments_[cnt]->start_idx() == segments_[cnt - 1]->next_idx(); ++cnt) {
+    }
+
+    for (size_t i = cnt; i < segments_.size(); ++i) {
+        retire_segment(*segments_[i]);
+    }
+
+    segments_.resize(cnt);
+    if (segments_.front()->start_idx() > start_idx_ || segments_.back()->next_idx() < start_idx_) {
+        throw std::runtime_error("bad store files, the segments don't have the start index");
+    }
+
+    next_idx_ = segments_.back()->next_idx();
+    durable_idx_ = next_idx_ - 1;
+}
@@ -0,0 +1,170 @@
+#ifndef _MMAP_LOG_STORE_HXX_
+#define _MMAP_LOG_STORE_HXX_
+
+namespace cornerstone {
+    class mapped_segment;
+
+    /**
+    * Memory mapped log store, the logs are kept in a list of segment files (store.<start>.map) of a fixed size, which are
+    * preallocated and mapped for writing, so an append copies the entry straight into the mapping, there is no write
+    * system call and no serialized copy of the entry.
+    * Reads are not zero copy, each entry that is read is copied out of the mapping into a new buffer, as a buffer keeps
+    * its size and the reference count in front of its data, so it cannot point into the mapping. The segments that are compacted are kept as spare files (store.spare.<n>.map) for the next segments,
+    * so the files are allocated once and then used as a ring.
+    * Each record is chained to the one before it by its checksum, so that the stale records of a reused file or of the
+    * truncated entries are never taken as entries when the store is opened.
+    * The written entries are synced to disk by msync at the end of each append call with per_batch_sync, which is the
+    * group commit boundary, every sync_interval milliseconds by a background thread with interval_sync, or only when
+    * the store is closed with no_sync. The result of append_async is set once the entries are synced with interval_sync,
+    * and once they are written with the other policies.
+    * It's for POSIX systems only, the constructor throws std::runtime_error on Windows
+    */
+    class mmap_log_store : public log_store {
+    public:
+        static const ulong default_segment_size;
+        static const size_t max_spare_segments;
+    public:
+        mmap_log_store(const std::string& log_folder, ulong segment_size = default_segment_size, durability_policy durability = per_batch_sync, int32 sync_interval = 10);
+        ~mmap_log_store();
+
+        __nocopy__(mmap_log_store)
+
+    public:
+        /**
+        ** The first available slot of the store, starts with 1
+        */
+        virtual ulong next_slot() const;
+
+        /**
+        ** The start index of the log store, at the very beginning, it must be 1
+        ** however, after some compact actions, this could be anything greater or equals to one
+        */
+        virtual ulong start_index() const;
+
+        /**
+        * The last log entry in store
+        * @return a dummy constant entry with value set to null and term set to zero if no log entry in store
+        */
+        virtual ptr<log_entry> last_entry() const;
+
+        /**
+        * Appends a log entry to store
+        * @param entry
+        */
+        virtual ulong append(ptr<log_entry>& entry);
+
+        /**
+        * Appends the log entries to store as one batch, the entries are synced together
+        * @param entries
+        * @return the log index of the first entry in the batch
+        */
+        virtual ulong append_batch(std::vector<ptr<log_entry>>& entries);
+
+        /**
+        * Appends the log entries to store as one batch, with interval_sync, the result is set by the sync that covers them
+        * @param entries
+        * @return the result that is set with the log index of the last entry once the entries are durable
+        */
+        virtual ptr<async_result<ulong>> append_async(std::vector<ptr<log_entry>>& entries);
+
+        /**
+        * Over writes a log entry at index of {@code index}
+        * @param index a value < this->next_slot(), and starts from 1
+        * @param entry
+        */
+        virtual void write_at(ulong index, ptr<log_entry>& entry);
+
+        /**
+        * Removes all log entries starting from index
+        * @param index a value <= this->next_slot(), and starts from 1
+        */
+        virtual void truncate(ulong index);
+
+        /**
+        * Get log entries with index between start and end
+        * @param start, the start index of log entries
+        * @param end, the end index of log entries (exclusive)
+        * @return the log entries between [start, end)
+        */
+        virtual ptr<std::vector<ptr<log_entry>>> log_entries(ulong start, ulong end);
+
+        /**
+        * Gets the log entry at the specified index
+        * @param index, starts from 1
+        * @return the log entry or null if index >= this->next_slot()
+        */
+        virtual ptr<log_entry> entry_at(ulong index);
+
+        /**
+        * Gets the term for the log entry at the specified index, the term is read from the mapping
+        * @param index, starts from 1
+        * @return the term for the specified log entry or 0 if index >= this->next_slot()
+        */
+        virtual ulong term_at(ulong index);
+
+        /**
+        * Pack cnt log items starts from index, the pack has the same format as the one of fs_log_store
+        * @param index
+        * @param cnt
+        * @return log pack
+        */
+        virtual ptr<buffer> pack(ulong index, int32 cnt);
+
+        /**
+        * Apply the log pack to current log store, starting from index
+        * @param index, the log index that start applying the pack, index starts from 1
+        * @param pack
+        */
+        virtual void apply_pack(ulong index, buffer& pack);
+
+        /**
+        * Compact the log store by removing all log entries including the log at the last_log_index
+        * @param last_log_index
+        * @return compact successfully or not
+        */
+        virtual bool compact(ulong last_log_index);
+
+        /**
+        * The last log index that is synced to disk
+        */
+        virtual ulong durable_index() const;
+
+        /**
+        * Syncs all written entries to disk
+        */
+        void sync();
+
+        void close();
+    private:
+        void append_entry(log_entry& entry);
+        void append_record(ulong term, byte type, const byte* data, size_t len);
+        void commit_writes();
+        void truncate_from(ulong index);
+        ptr<mapped_segment> create_segment(ulong start_idx, ulong size);
+        void retire_segment(mapped_segment& seg);
+        const ptr<mapped_segment>& segment_of(ulong index) const;
+        ptr<log_entry> read_entry(ulong index) const;
+        void load_segments();
+        void sync_in_bg();
+        void complete_waiters(ulong index);
+    private:
+        std::string log_folder_;
+        ulong segment_size_;
+        durability_policy durability_;
+        int32 sync_interval_;
+        std::vector<ptr<mapped_segment>> segments_;
+        std::vector<std::string> spares_;
+        ulong start_idx_;
+        ulong next_idx_;
+        std::atomic<ulong> durable_idx_;
+        std::chrono::steady_clock::time_point last_sync_;
+        mutable std::recursive_mutex store_lock_;
+        bool stopping_;
+        std::mutex sync_lock_;
+        std::condition_variable bg_cv_;
+        std::vector<std::pair<ulong, ptr<async_result<ulong>>>> waiters_;
+        std::thread sync_thread_;
+    };
+}
+
+#endif //_MMAP_LOG_STORE_HXX_
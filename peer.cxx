@@ -4,15 +4,15 @@ using namespace cornerstone;
 
 void peer::send_req(ptr<req_msg>& req, rpc_handler& handler) {
     ptr<rpc_result> pending = cs_new<rpc_result>(handler);
-    rpc_handler h = (rpc_handler)std::bind(&peer::handle_rpc_result, this, req, pending, std::placeholders::_1, std::placeholders::_2);
+    rpc_handler h = (rpc_handler)std::bind(&peer::handle_rpc_result, this, req, pending, busy_gen_.load(), std::placeholders::_1, std::placeholders::_2);
     rpc_->send(req, h);
 }
 
-void peer::handle_rpc_result(ptr<req_msg>& req, ptr<rpc_result>& pending_result, ptr<resp_msg>& resp, ptr<rpc_exception>& err) {
+void peer::handle_rpc_result(ptr<req_msg>& req, ptr<rpc_result>& pending_result, ulong busy_gen, ptr<resp_msg>& resp, ptr<rpc_exception>& err) {
     if (err == nilptr) {
         if (req->get_type() == msg_type::append_entries_request ||
             req->get_type() == msg_type::install_snapshot_request) {
-            set_free();
+            set_free(busy_gen);
         }
 
         resume_hb_speed();
@@ -22,11 +22,18 @@ void peer::handle_rpc_result(ptr<req_msg>& req, ptr<rpc_result>& pending_result,
     else {
         if (req->get_type() == msg_type::append_entries_request ||
             req->get_type() == msg_type::install_snapshot_request) {
-            set_free();
+            set_free(busy_gen);
         }
 
         slow_down_hb();
         ptr<resp_msg> no_resp;
         pending_result->set_result(no_resp, err);
     }
-}
\ No newline at end of file
+}
+
+// the slot of a request is freed only if the slots are not cleared after it's sent
+void peer::set_free(ulong busy_gen) {
+    if (busy_gen == busy_gen_.load()) {
+        set_free();
+    }
+}
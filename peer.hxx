@@ -14,7 +14,11 @@ namespace cornerstone {
             max_hb_interval_(ctx.params_->max_hb_interval()),
             next_log_idx_(0),
             matched_idx_(0),
-            busy_flag_(false),
+            max_inflight_(std::max<int32>(1, ctx.params_->max_inflight_appends_)),
+            inflight_(0),
+            busy_gen_(0),
+            pipelined_(false),
+            epoch_(0),
             pending_commit_flag_(false),
             hb_enabled_(false),
             hb_task_(cs_new<timer_task<peer&>, timer_task<peer&>::executor&, peer&>(hb_exec, *this)),
@@ -45,13 +49,67 @@ namespace cornerstone {
             return current_hb_interval_;
         }
 
+        /**
+        * Takes a slot for an appendEntries or installSnapshot request, there is one slot only until the peer
+        * accepts the entries or while a snapshot is in sync, otherwise the requests are pipelined up to the
+        * in-flight window
+        * @return false if no slot is available
+        */
         bool make_busy() {
-            bool f = false;
-            return busy_flag_.compare_exchange_strong(f, true);
+            int32 limit = pipelined_ && !snp_sync_ctx_ ? max_inflight_ : 1;
+            int32 cnt = inflight_.load();
+            while (cnt < limit) {
+                if (inflight_.compare_exchange_weak(cnt, cnt + 1)) {
+                    return true;
+                }
+            }
+
+            return false;
         }
 
         void set_free() {
-            busy_flag_.store(false);
+            int32 cnt = inflight_.load();
+            while (cnt > 0 && !inflight_.compare_exchange_weak(cnt, cnt - 1));
+        }
+
+        bool is_busy() const {
+            return inflight_.load() > 0;
+        }
+
+        /**
+        * Frees all the slots, as when the server becomes the leader, the requests of the earlier term that are
+        * still in flight don't free the slots when they come back, which belong to the requests of this term by then
+        */
+        void clear_busy() {
+            ++busy_gen_;
+            inflight_.store(0);
+            pipelined_ = false;
+            ++epoch_;
+        }
+
+        bool is_pipelined() const {
+            return pipelined_;
+        }
+
+        void start_pipeline() {
+            pipelined_ = true;
+        }
+
+        /**
+        * Stops pipelining after a request is rejected or failed, the responses of the requests that are still
+        * in flight are stale, as they were sent after the failed one, they are told by the epoch they are sent in
+        */
+        void stop_pipeline() {
+            pipelined_ = false;
+            ++epoch_;
+        }
+
+        /**
+        * The epoch of the requests that are sent to the peer, it moves on when the pipeline stops or the
+        * peer is reset, the responses of the requests that are sent in an earlier epoch are dropped
+        */
+        ulong get_epoch() const {
+            return epoch_;
         }
 
         bool is_hb_enabled() const {
@@ -113,7 +171,8 @@ namespace cornerstone {
 
         void send_req(ptr<req_msg>& req, rpc_handler& handler);
     private:
-        void handle_rpc_result(ptr<req_msg>& req, ptr<rpc_result>& pending_result, ptr<resp_msg>& resp, ptr<rpc_exception>& err);
+        void handle_rpc_result(ptr<req_msg>& req, ptr<rpc_result>& pending_result, ulong busy_gen, ptr<resp_msg>& resp, ptr<rpc_exception>& err);
+        void set_free(ulong busy_gen);
     private:
         const srv_config& config_;
         delayed_task_scheduler& scheduler_;
@@ -124,7 +183,11 @@ namespace cornerstone {
         int32 max_hb_interval_;
         ulong next_log_idx_;
         ulong matched_idx_;
-        std::atomic_bool busy_flag_;
+        int32 max_inflight_;
+        std::atomic<int32> inflight_;
+        std::atomic<ulong> busy_gen_;
+        bool pipelined_;
+        ulong epoch_;
         std::atomic_bool pending_commit_flag_;
         bool hb_enabled_;
         ptr<delayed_task> hb_task_;
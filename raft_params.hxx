@@ -13,7 +13,10 @@ namespace cornerstone {
             log_sync_stop_gap_(10),
             snapshot_distance_(0),
             snapshot_block_size_(0),
-            max_append_size_(100) {}
+            max_append_size_(100),
+            max_inflight_appends_(1),
+            proposal_batch_window_(0),
+            proposal_batch_size_(64 * 1024) {}
 
         __nocopy__(raft_params)
     public:
@@ -67,6 +70,39 @@ namespace cornerstone {
             return *this;
         }
 
+        /**
+        * The maximum appendEntries requests could be in flight to a peer, once the peer accepts the entries,
+        * the leader keeps sending the entries after the ones in flight without waiting for the responses,
+        * 1 means the next request is sent after the response of the last one
+        * @param size
+        * @return self
+        */
+        raft_params& with_max_inflight_appends(int32 size) {
+            max_inflight_appends_ = size;
+            return *this;
+        }
+
+        /**
+        * The client proposals on the leader are gathered for up to the window in milliseconds, then appended to the
+        * log store as one batch and replicated by one round of appendEntries, 0 disables the batching
+        * @param window
+        * @return self
+        */
+        raft_params& with_proposal_batch_window(int32 window) {
+            proposal_batch_window_ = window;
+            return *this;
+        }
+
+        /**
+        * The batch of client proposals is appended before the window is over once it has this many bytes
+        * @param size
+        * @return self
+        */
+        raft_params& with_proposal_batch_size(int32 size) {
+            proposal_batch_size_ = size;
+            return *this;
+        }
+
         /**
         * For new member that just joined the cluster, we will use log sync to ask it to catch up,
         * and this parameter is to specify how many log entries to pack for each sync request
@@ -124,6 +160,9 @@ namespace cornerstone {
         int32 snapshot_distance_;
         int32 snapshot_block_size_;
         int32 max_append_size_;
+        int32 max_inflight_appends_;
+        int32 proposal_batch_window_;
+        int32 proposal_batch_size_;
     };
 }
 
@@ -27,7 +27,75 @@ static const char* __msg_type_str[] = {
 };
 
 ptr<resp_msg> raft_server::process_req(req_msg& req) {
-    recur_lock(lock_);
+    ptr<async_result<ulong>> pending_append;
+    ptr<resp_msg> resp;
+    loop_.run([this, &req, &resp, &pending_append]() -> void {
+        resp = handle_req(req, pending_append);
+    });
+
+    // the appended entries are written by the log store while the event loop goes on, so that the other
+    // requests are not blocked by the disk, the response is sent back once the entries are durable
+    if (pending_append) {
+        try {
+            pending_append->get();
+        }
+        catch (ptr<std::exception>& err) {
+            return resp_of_failed_append(resp, err);
+        }
+    }
+
+    return resp;
+}
+
+// the request is handled on the event loop and the result is set from there, or by the log store once the appended
+// entries are durable, so the caller is never blocked, neither by the loop nor by the disk
+ptr<async_result<ptr<resp_msg>>> raft_server::process_req_async(ptr<req_msg>& req) {
+    ptr<async_result<ptr<resp_msg>>> result(cs_new<async_result<ptr<resp_msg>>>());
+    ptr<req_msg> request(req);
+    bool posted = loop_.post([this, request, result]() -> void {
+        ptr<async_result<ulong>> pending_append;
+        ptr<resp_msg> resp;
+        ptr<std::exception> err;
+        try {
+            resp = handle_req(*request, pending_append);
+        }
+        catch (std::exception& ex) {
+            err = cs_new<std::runtime_error>(ex.what());
+        }
+
+        if (err || !pending_append) {
+            result->set_result(resp, err);
+            return;
+        }
+
+        async_result<ulong>::handler_type handler = [this, resp, result](ulong&, ptr<std::exception>& append_err) -> void {
+            ptr<resp_msg> final_resp(resp);
+            ptr<std::exception> no_err;
+            if (append_err) {
+                final_resp = resp_of_failed_append(final_resp, append_err);
+            }
+
+            result->set_result(final_resp, no_err);
+        };
+        pending_append->when_ready(handler);
+    });
+
+    if (!posted) {
+        ptr<resp_msg> no_resp;
+        ptr<std::exception> err(cs_new<std::runtime_error>("the server is stopping"));
+        result->set_result(no_resp, err);
+    }
+
+    return result;
+}
+
+// the entries of an accepted append are not durable, the leader is told to resend them from the end of the log
+ptr<resp_msg> raft_server::resp_of_failed_append(ptr<resp_msg>& resp, ptr<std::exception>& err) {
+    l_.info(sstrfmt("the appended log entries are not durable, %s").fmt(err->what()));
+    return cs_new<resp_msg>(resp->get_term(), resp->get_type(), resp->get_src(), resp->get_dst(), log_store_->next_slot());
+}
+
+ptr<resp_msg> raft_server::handle_req(req_msg& req, ptr<async_result<ulong>>& pending_append) {
     l_.debug(
         lstrfmt("Receive a %s message from %d with LastLogIndex=%llu, LastLogTerm=%llu, EntriesLength=%d, CommitIndex=%llu and Term=%llu")
         .fmt(
@@ -52,13 +120,13 @@ ptr<resp_msg> raft_server::process_req(req_msg& req) {
 
     ptr<resp_msg> resp;
     if (req.get_type() == msg_type::append_entries_request) {
-        resp = handle_append_entries(req);
+        resp = handle_append_entries(req, pending_append);
     }
     else if (req.get_type() == msg_type::request_vote_request) {
         resp = handle_vote_req(req);
     }
     else if (req.get_type() == msg_type::client_request) {
-        resp = handle_cli_req(req);
+        resp = handle_cli_req(req, pending_append);
     }
     else {
         // extended requests
@@ -79,7 +147,7 @@ ptr<resp_msg> raft_server::process_req(req_msg& req) {
     return resp;
 }
 
-ptr<resp_msg> raft_server::handle_append_entries(req_msg& req) {
+ptr<resp_msg> raft_server::handle_append_entries(req_msg& req, ptr<async_result<ulong>>& pending_append) {
     if (req.get_term() == state_->get_term()) {
         if (role_ == srv_role::candidate) {
             become_follower();
@@ -102,7 +170,17 @@ ptr<resp_msg> raft_server::handle_append_entries(req_msg& req) {
     ptr<resp_msg> resp(cs_new<resp_msg>(state_->get_term(), msg_type::append_entries_response, id_, req.get_src(), log_store_->next_slot()));
     bool log_okay = req.get_last_log_idx() == 0 ||
         (req.get_last_log_idx() < log_store_->next_slot() && req.get_last_log_term() == term_for_log(req.get_last_log_idx()));
-    if (req.get_term() < state_->get_term() || !log_okay) {
+    if (req.get_term() < state_->get_term()) {
+        return resp;
+    }
+
+    // the conflict term and its first index let the leader skip the whole term in one round trip
+    if (!log_okay) {
+        ulong conflict_idx = req.get_last_log_idx();
+        if (conflict_idx < log_store_->next_slot() && conflict_idx >= log_store_->start_index()) {
+            resp->set_conflict(log_store_->term_at(conflict_idx), log_store_->first_index_of_term(conflict_idx));
+        }
+
         return resp;
     }
 
@@ -122,31 +200,43 @@ ptr<resp_msg> raft_server::handle_append_entries(req_msg& req) {
             }
         }
 
-        // dealing with overwrites
-        while (idx < log_store_->next_slot() && log_idx < req.log_entries().size()) {
-            ptr<log_entry> old_entry(log_store_->entry_at(idx));
-            if (old_entry->get_val_type() == log_val_type::app_log) {
-                state_machine_.rollback(idx, old_entry->get_buf());
-            }
-            else if (old_entry->get_val_type() == log_val_type::conf) {
-                l_.info(sstrfmt("revert from a prev config change to config at %llu").fmt(config_->get_log_idx()));
-                config_changing_ = false;
+        // dealing with overwrites, the conflicting entries are rolled back in one truncation,
+        // the overwriting entries are then appended with the new entries as one batch
+        ulong new_entries_idx = idx;
+        if (idx < log_store_->next_slot() && log_idx < req.log_entries().size()) {
+            new_entries_idx = std::min(log_store_->next_slot(), idx + (req.log_entries().size() - log_idx));
+            for (ulong i = idx; i < new_entries_idx; ++i) {
+                ptr<log_entry> old_entry(log_store_->entry_at(i));
+                if (old_entry->get_val_type() == log_val_type::app_log) {
+                    state_machine_.rollback(i, old_entry->get_buf());
+                }
+                else if (old_entry->get_val_type() == log_val_type::conf) {
+                    l_.info(sstrfmt("revert from a prev config change to config at %llu").fmt(config_->get_log_idx()));
+                    config_changing_ = false;
+                }
             }
 
-            log_store_->write_at(idx++, req.log_entries().at(log_idx++));
+            log_store_->truncate(idx);
         }
 
-        // append new log entries
-        while (log_idx < req.log_entries().size()) {
-            ptr<log_entry> entry = req.log_entries().at(log_idx ++);
-            ulong idx_for_entry = log_store_->append(entry);
-            if (entry->get_val_type() == log_val_type::conf) {
-                l_.info(sstrfmt("receive a config change from leader at %llu").fmt(idx_for_entry));
-                config_changing_ = true;
+        // append the rest of the log entries in one batch, the response waits for them to be durable
+        if (log_idx < req.log_entries().size()) {
+            std::vector<ptr<log_entry>> entries(req.log_entries().begin() + log_idx, req.log_entries().end());
+            ulong idx_for_entry = log_store_->next_slot();
+            pending_append = log_store_->append_async(entries);
+            for (size_t i = 0; i < entries.size(); ++i, ++idx_for_entry) {
+                if (idx_for_entry < new_entries_idx) {
+                    continue;
+                }
 
-            }
-            else {
-                state_machine_.pre_commit(idx_for_entry, entry->get_buf());
+                ptr<log_entry>& entry = entries[i];
+                if (entry->get_val_type() == log_val_type::conf) {
+                    l_.info(sstrfmt("receive a config change from leader at %llu").fmt(idx_for_entry));
+                    config_changing_ = true;
+                }
+                else {
+                    state_machine_.pre_commit(idx_for_entry, entry->get_buf());
+                }
             }
         }
     }
@@ -172,26 +262,124 @@ ptr<resp_msg> raft_server::handle_vote_req(req_msg& req) {
     return resp;
 }
 
-ptr<resp_msg> raft_server::handle_cli_req(req_msg& req) {
+ptr<resp_msg> raft_server::handle_cli_req(req_msg& req, ptr<async_result<ulong>>& pending_append) {
     ptr<resp_msg> resp (cs_new<resp_msg>(state_->get_term(), msg_type::append_entries_response, id_, leader_));
     if (role_ != srv_role::leader) {
         return resp;
     }
 
+    // each request has its own result, as a result has one handler only
     std::vector<ptr<log_entry>>& entries = req.log_entries();
+    pending_append = cs_new<async_result<ulong>>();
+    if (ctx_->params_->proposal_batch_window_ <= 0) {
+        std::vector<ptr<async_result<ulong>>> proposals(1, pending_append);
+        append_to_leader_log(entries, proposals);
+        resp->accept(log_store_->next_slot());
+        return resp;
+    }
+
+    // the proposals are gathered into one batch, which is appended and replicated once the window is over
+    // or the batch is big enough, the response waits for the batch to be durable
+    if (proposal_results_.empty()) {
+        if (!batch_task_) {
+            batch_task_ = cs_new<timer_task<void>>(batch_exec_);
+        }
+
+        scheduler_.schedule(batch_task_, ctx_->params_->proposal_batch_window_);
+    }
+
+    for (std::vector<ptr<log_entry>>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+        proposals_.push_back(*it);
+        proposal_bytes_ += (*it)->get_buf().size();
+    }
+
+    proposal_results_.push_back(pending_append);
+    resp->accept(log_store_->next_slot() + proposals_.size());
+    if (proposal_bytes_ >= (size_t)std::max(0, ctx_->params_->proposal_batch_size_)) {
+        flush_proposals();
+    }
+
+    return resp;
+}
+
+void raft_server::handle_batch_timeout() {
+    if (!loop_.in_loop()) {
+        loop_.post(std::bind(&raft_server::handle_batch_timeout, this));
+        return;
+    }
+
+    flush_proposals();
+}
+
+void raft_server::flush_proposals() {
+    if (batch_task_) {
+        scheduler_.cancel(batch_task_);
+    }
+
+    if (proposal_results_.empty()) {
+        return;
+    }
+
+    std::vector<ptr<async_result<ulong>>> results;
+    results.swap(proposal_results_);
+    std::vector<ptr<log_entry>> entries;
+    entries.swap(proposals_);
+    proposal_bytes_ = 0;
+    if (role_ != srv_role::leader) {
+        ulong last_idx(0);
+        ptr<std::exception> err(cs_new<std::runtime_error>("the proposals are dropped as this server is not the leader anymore"));
+        for (size_t i = 0; i < results.size(); ++i) {
+            results[i]->set_result(last_idx, err);
+        }
+
+        return;
+    }
+
+    append_to_leader_log(entries, results);
+}
+
+// the entries are replicated while the log store writes them, so the disk write of the leader runs in parallel with the
+// replication, the leader counts for the quorum with the durable index of the store, the commit is counted again when
+// the entries are durable, which also completes the proposals
+void raft_server::append_to_leader_log(std::vector<ptr<log_entry>>& entries, std::vector<ptr<async_result<ulong>>>& proposals) {
+    ulong idx_for_entry = log_store_->next_slot();
+    ptr<async_result<ulong>> appended = log_store_->append_async(entries);
     for (size_t i = 0; i < entries.size(); ++i) {
-        log_store_->append(entries.at(i));
-        state_machine_.pre_commit(log_store_->next_slot() - 1, entries.at(i)->get_buf());
+        state_machine_.pre_commit(idx_for_entry + i, entries.at(i)->get_buf());
     }
 
     // urgent commit, so that the commit will not depend on hb
     request_append_entries();
-    resp->accept(log_store_->next_slot());
-    return resp;
+    async_result<ulong>::handler_type handler = (async_result<ulong>::handler_type)std::bind(&raft_server::on_leader_log_durable, this, proposals, std::placeholders::_1, std::placeholders::_2);
+    appended->when_ready(handler);
+}
+
+void raft_server::on_leader_log_durable(std::vector<ptr<async_result<ulong>>>& proposals, ulong& last_idx, ptr<std::exception>& err) {
+    for (size_t i = 0; i < proposals.size(); ++i) {
+        proposals[i]->set_result(last_idx, err);
+    }
+
+    if (err) {
+        l_.info(sstrfmt("the log entries of the leader are not durable, %s").fmt(err->what()));
+        return;
+    }
+
+    // this could be called by the thread of the log store, the commit is counted on the event loop
+    loop_.post(std::bind(&raft_server::handle_leader_log_durable, this));
+}
+
+void raft_server::handle_leader_log_durable() {
+    if (role_ == srv_role::leader) {
+        commit_by_quorum();
+    }
 }
 
 void raft_server::handle_election_timeout() {
-    recur_lock(lock_);
+    if (!loop_.in_loop()) {
+        loop_.post(std::bind(&raft_server::handle_election_timeout, this));
+        return;
+    }
+
     if (steps_to_down_ > 0) {
         if (--steps_to_down_ == 0) {
             l_.info("no hearing further news from leader, remove this server from cluster and step down");
@@ -268,7 +456,7 @@ void raft_server::request_vote() {
 
 void raft_server::request_append_entries() {
     if (peers_.size() == 0) {
-        commit(log_store_->next_slot() - 1);
+        commit(log_store_->durable_index());
         return;
     }
 
@@ -278,9 +466,20 @@ void raft_server::request_append_entries() {
 }
 
 bool raft_server::request_append_entries(peer& p) {
-    if (p.make_busy()) {
+    // with requests in flight, another request is only worth for the entries that are not sent yet,
+    // the requests are pipelined until the window is full or all entries are sent
+    bool sent(false);
+    while ((!p.is_busy() || p.get_next_log_idx() < log_store_->next_slot()) && p.make_busy()) {
         ptr<req_msg> msg = create_append_entries_req(p);
-        p.send_req(msg, resp_handler_);
+        rpc_handler handler = (rpc_handler)std::bind(&raft_server::handle_replication_resp, this, p.get_epoch(), std::placeholders::_1, std::placeholders::_2);
+        p.send_req(msg, handler);
+        sent = true;
+        if (!p.is_pipelined()) {
+            break;
+        }
+    }
+
+    if (sent) {
         return true;
     }
 
@@ -289,9 +488,14 @@ bool raft_server::request_append_entries(peer& p) {
 }
 
 void raft_server::handle_peer_resp(ptr<resp_msg>& resp, ptr<rpc_exception>& err) {
-    recur_lock(lock_);
+    if (!loop_.in_loop()) {
+        loop_.post(std::bind(&raft_server::handle_peer_resp, this, resp, err));
+        return;
+    }
+
     if (err) {
         l_.info(sstrfmt("peer response error: %s").fmt(err->what()));
+        handle_append_entries_failure(*err);
         return;
     }
 
@@ -324,6 +528,33 @@ void raft_server::handle_peer_resp(ptr<resp_msg>& resp, ptr<rpc_exception>& err)
     }
 }
 
+// the responses of the requests that are sent before the peer is rolled back or reset are dropped, they are
+// about the entries that the peer is no longer expected to have, a higher term in them still steps down the server
+void raft_server::handle_replication_resp(ulong epoch, ptr<resp_msg>& resp, ptr<rpc_exception>& err) {
+    if (!loop_.in_loop()) {
+        loop_.post(std::bind(&raft_server::handle_replication_resp, this, epoch, resp, err));
+        return;
+    }
+
+    if (resp && update_term(resp->get_term())) {
+        return;
+    }
+
+    int32 peer_id = resp ? resp->get_src() : (err && err->req() ? err->req()->get_dst() : -1);
+    peer_itor it = peers_.find(peer_id);
+    if (it != peers_.end() && it->second->get_epoch() != epoch) {
+        // the slot of the dropped request is free, the peer is probed again once the stale requests are all back
+        l_.debug(sstrfmt("drop the response of a request sent before rolling back peer %d").fmt(peer_id));
+        if (role_ == srv_role::leader && !request_append_entries(*it->second)) {
+            it->second->set_pending_commit();
+        }
+
+        return;
+    }
+
+    handle_peer_resp(resp, err);
+}
+
 void raft_server::handle_append_entries_resp(resp_msg& resp) {
     peer_itor it = peers_.find(resp.get_src());
     if (it == peers_.end()) {
@@ -336,30 +567,50 @@ void raft_server::handle_append_entries_resp(resp_msg& resp) {
     ptr<peer> p = it->second;
     if (resp.get_accepted()) {
         {
-            std::lock_guard<std::mutex>(p->get_lock());
-            p->set_next_log_idx(resp.get_next_idx());
-            p->set_matched_idx(resp.get_next_idx() - 1);
-        }
+            // the responses of the pipelined requests could only move the peer forward
+            std::lock_guard<std::mutex> guard(p->get_lock());
+            if (resp.get_next_idx() > p->get_next_log_idx()) {
+                p->set_next_log_idx(resp.get_next_idx());
+            }
 
-        // try to commit with this response
-        // TODO: keep this to save a "new" operation for each response
-        std::unique_ptr<ulong> matched_indexes(new ulong[peers_.size() + 1]);
-        matched_indexes.get()[0] = log_store_->next_slot() - 1;
-        int i = 1;
-        for (it = peers_.begin(); it != peers_.end(); ++it, ++i) {
-            matched_indexes.get()[i] = it->second->get_matched_idx();
+            if (resp.get_next_idx() - 1 > p->get_matched_idx()) {
+                p->set_matched_idx(resp.get_next_idx() - 1);
+                commit_tracker_.update(p->get_id(), p->get_matched_idx());
+            }
+
+            p->start_pipeline();
         }
 
-        std::sort(matched_indexes.get(), matched_indexes.get() + (peers_.size() + 1), std::greater<ulong>());
-        commit(matched_indexes.get()[(peers_.size() + 1) / 2]);
+        // try to commit with this response
+        commit_by_quorum();
         need_to_catchup = p->clear_pending_commit() || resp.get_next_idx() < log_store_->next_slot();
     }
     else {
         std::lock_guard<std::mutex> guard(p->get_lock());
-        if (resp.get_next_idx() > 0 && p->get_next_log_idx() > resp.get_next_idx()) {
+        if (p->is_pipelined()) {
+            // the requests in flight are rejected as well, roll back to the last matched entry and probe from there
+            p->set_next_log_idx(p->get_matched_idx() + 1);
+            p->stop_pipeline();
+        }
+        else if (resp.get_next_idx() > 0 && p->get_next_log_idx() > resp.get_next_idx()) {
             // fast move for the peer to catch up
             p->set_next_log_idx(resp.get_next_idx());
         }
+        else if (resp.get_conflict_term() > 0) {
+            // skip the conflict term, to the last entry of the term in this log, or to the first entry of the term in the peer,
+            // the newer terms of this log are skipped a term at a time
+            ulong idx = p->get_next_log_idx() - 1;
+            while (idx > 0 && idx >= log_store_->start_index() && log_store_->term_at(idx) > resp.get_conflict_term()) {
+                idx = log_store_->first_index_of_term(idx) - 1;
+            }
+
+            if (idx > 0 && idx >= log_store_->start_index() && log_store_->term_at(idx) == resp.get_conflict_term()) {
+                p->set_next_log_idx(idx + 1);
+            }
+            else {
+                p->set_next_log_idx(std::min(resp.get_conflict_idx(), p->get_next_log_idx() - 1));
+            }
+        }
         else {
             p->set_next_log_idx(p->get_next_log_idx() - 1);
         }
@@ -367,9 +618,35 @@ void raft_server::handle_append_entries_resp(resp_msg& resp) {
 
     // This may not be a leader anymore, such as the response was sent out long time ago
     // and the role was updated by UpdateTerm call
-    // Try to match up the logs for this peer
-    if (role_ == srv_role::leader && need_to_catchup) {
-        request_append_entries(*p);
+    // Try to match up the logs for this peer, the commit index goes with the next response if requests are in flight
+    if (role_ == srv_role::leader && need_to_catchup && !request_append_entries(*p)) {
+        p->set_pending_commit();
+    }
+}
+
+// commits the index that a majority has matched, the leader matches the entries that are durable in its log store
+void raft_server::commit_by_quorum() {
+    commit_tracker_.update(id_, log_store_->durable_index());
+    commit(commit_tracker_.quorum_index());
+}
+
+void raft_server::handle_append_entries_failure(rpc_exception& err) {
+    ptr<req_msg> req = err.req();
+    if (!req || req->get_type() != msg_type::append_entries_request) {
+        return;
+    }
+
+    peer_itor it = peers_.find(req->get_dst());
+    if (it == peers_.end()) {
+        return;
+    }
+
+    // the entries of the failed request are not there for the requests after it, roll back to the last matched entry
+    ptr<peer> p = it->second;
+    std::lock_guard<std::mutex> guard(p->get_lock());
+    if (p->is_pipelined()) {
+        p->set_next_log_idx(p->get_matched_idx() + 1);
+        p->stop_pipeline();
     }
 }
 
@@ -396,6 +673,7 @@ void raft_server::handle_install_snapshot_resp(resp_msg& resp) {
                 ptr<snapshot> nil_snp;
                 p->set_next_log_idx(sync_ctx->get_snapshot()->get_last_log_idx() + 1);
                 p->set_matched_idx(sync_ctx->get_snapshot()->get_last_log_idx());
+                commit_tracker_.update(p->get_id(), p->get_matched_idx());
                 p->set_snapshot_in_sync(nil_snp);
                 need_to_catchup = p->clear_pending_commit() || resp.get_next_idx() < log_store_->next_slot();
             }
@@ -440,7 +718,12 @@ void raft_server::handle_voting_resp(resp_msg& resp) {
 }
 
 void raft_server::handle_hb_timeout(peer& p) {
-    recur_lock(lock_);
+    if (!loop_.in_loop()) {
+        ptr<peer> hb_peer(cs_safe(&p));
+        loop_.post([this, hb_peer]() -> void { handle_hb_timeout(*hb_peer); });
+        return;
+    }
+
     l_.debug(sstrfmt("Heartbeat timeout for %d").fmt(p.get_id()));
     if (role_ == srv_role::leader) {
         request_append_entries(p);
@@ -491,11 +774,13 @@ void raft_server::become_leader() {
     role_ = srv_role::leader;
     leader_ = id_;
     srv_to_join_.reset();
+    commit_tracker_.reset();
     ptr<snapshot> nil_snp;
     for (peer_itor it = peers_.begin(); it != peers_.end(); ++it) {
         it->second->set_next_log_idx(log_store_->next_slot());
+        it->second->set_matched_idx(0);
         it->second->set_snapshot_in_sync(nil_snp);
-        it->second->set_free();
+        it->second->clear_busy();
         enable_hb_for_peer(*(it->second));
     }
 
@@ -525,6 +810,7 @@ void raft_server::become_follower() {
 
     srv_to_join_.reset();
     role_ = srv_role::follower;
+    flush_proposals();
     restart_election_timer();
 }
 
@@ -558,7 +844,9 @@ void raft_server::commit(ulong target_idx) {
         }
     }
 
+    // the commit thread checks the index again under the lock before waiting, so the notification is not lost
     if (log_store_->next_slot() - 1 > state_->get_commit_idx() && quick_commit_idx_ > state_->get_commit_idx()) {
+        std::lock_guard<std::mutex> guard(commit_lock_);
         commit_cv_.notify_one();
     }
 }
@@ -639,11 +927,25 @@ void raft_server::on_snapshot_completed(ptr<snapshot>& s, bool result, ptr<std::
             break;
         }
 
-        {
-            recur_lock(lock_);
+        // this runs on the thread of the state machine, the log store is compacted on the event loop without
+        // waiting for it, the snapshot is done once the compaction is, or once the server turns out to be stopping
+        ptr<snapshot> snp(s);
+        bool posted = loop_.post([this, snp]() -> void {
             l_.debug("snapshot created, compact the log store");
-            log_store_->compact(s->get_last_log_idx());
+            try {
+                log_store_->compact(snp->get_last_log_idx());
+            }
+            catch (std::exception& ex) {
+                l_.err(lstrfmt("failed to compact the log store due to %s").fmt(ex.what()));
+            }
+
+            snp_in_progress_.store(false);
+        });
+        if (posted) {
+            return;
         }
+
+        l_.info("the server is stopping, the log store is not compacted for the snapshot");
     } while (false);
     snp_in_progress_.store(false);
 }
@@ -655,13 +957,10 @@ ptr<req_msg> raft_server::create_append_entries_req(peer& p) {
     ulong term(0L);
     ulong starting_idx(1L);
 
-    {
-        recur_lock(lock_);
-        starting_idx = log_store_->start_index();
-        cur_nxt_idx = log_store_->next_slot();
-        commit_idx = quick_commit_idx_;
-        term = state_->get_term();
-    }
+    starting_idx = log_store_->start_index();
+    cur_nxt_idx = log_store_->next_slot();
+    commit_idx = quick_commit_idx_;
+    term = state_->get_term();
 
     {
         std::lock_guard<std::mutex> guard(p.get_lock());
@@ -700,6 +999,12 @@ ptr<req_msg> raft_server::create_append_entries_req(peer& p) {
     std::vector<ptr<log_entry>>& v = req->log_entries();
     if (log_entries) {
         v.insert(v.end(), log_entries->begin(), log_entries->end());
+
+        // while pipelining, the next request continues after the entries of this one
+        std::lock_guard<std::mutex> guard(p.get_lock());
+        if (p.is_pipelined()) {
+            p.set_next_log_idx(end_idx);
+        }
     }
 
     return req;
@@ -737,6 +1042,7 @@ void raft_server::reconfigure(const ptr<cluster_config>& new_config) {
         ptr<peer> p = cs_new<peer, srv_config&, context&, timer_task<peer&>::executor&>(*srv_added, *ctx_, exec);
         p->set_next_log_idx(log_store_->next_slot());
         peers_.insert(std::make_pair(srv_added->get_id(), p));
+        commit_tracker_.add_voter(srv_added->get_id());
         l_.info(sstrfmt("server %d is added to cluster").fmt(srv_added->get_id()));
         if (role_ == srv_role::leader) {
             l_.info(sstrfmt("enable heartbeating for server %d").fmt(srv_added->get_id()));
@@ -762,6 +1068,7 @@ void raft_server::reconfigure(const ptr<cluster_config>& new_config) {
         if (pit != peers_.end()) {
             pit->second->enable_hb(false);
             peers_.erase(pit);
+            commit_tracker_.remove_voter(srv_removed);
             l_.info(sstrfmt("server %d is removed from cluster").fmt(srv_removed));
         }
         else {
@@ -887,7 +1194,11 @@ bool raft_server::handle_snapshot_sync_req(snapshot_sync_req& req) {
 }
 
 void raft_server::handle_ext_resp(ptr<resp_msg>& resp, ptr<rpc_exception>& err) {
-    recur_lock(lock_);
+    if (!loop_.in_loop()) {
+        loop_.post(std::bind(&raft_server::handle_ext_resp, this, resp, err));
+        return;
+    }
+
     if (err) {
         handle_ext_resp_err(*err);
         return;
@@ -1017,6 +1328,7 @@ void raft_server::handle_ext_resp_err(rpc_exception& err) {
                         if (pit != peers_.end()) {
                             pit->second->enable_hb(false);
                             peers_.erase(pit);
+                            commit_tracker_.remove_voter(p->get_id());
                             l_.info(sstrfmt("server %d is removed from cluster").fmt(p->get_id()));
                         }
                         else {
@@ -1144,6 +1456,7 @@ void raft_server::sync_log_to_new_srv(ulong start_idx) {
     int32 gap = (int32)(quick_commit_idx_ - start_idx);
     if (gap < ctx_->params_->log_sync_stop_gap_) {
         l_.info(lstrfmt("LogSync is done for server %d with log gap %d, now put the server into cluster").fmt(srv_to_join_->get_id(), gap));
+        flush_proposals();
         ptr<cluster_config> new_conf = cs_new<cluster_config>(log_store_->next_slot(), config_->get_log_idx());
         new_conf->get_servers().insert(new_conf->get_servers().end(), config_->get_servers().begin(), config_->get_servers().end());
         new_conf->get_servers().push_back(conf_to_add_);
@@ -1212,6 +1525,7 @@ ptr<resp_msg> raft_server::handle_leave_cluster_req(req_msg& req) {
 }
 
 void raft_server::rm_srv_from_cluster(int32 srv_id) {
+    flush_proposals();
     ptr<cluster_config> new_conf = cs_new<cluster_config>(log_store_->next_slot(), config_->get_log_idx());
     for (cluster_config::const_srv_itor it = config_->get_servers().begin(); it != config_->get_servers().end(); ++it) {
         if ((*it)->get_id() != srv_id) {
@@ -1307,7 +1621,10 @@ void raft_server::commit_in_bg() {
             while (quick_commit_idx_ <= current_commit_idx
                 || current_commit_idx >= log_store_->next_slot() - 1) {
                 std::unique_lock<std::mutex> lock(commit_lock_);
-                commit_cv_.wait(lock);
+                if (!stopping_ && (quick_commit_idx_ <= current_commit_idx || current_commit_idx >= log_store_->next_slot() - 1)) {
+                    commit_cv_.wait(lock);
+                }
+
                 if (stopping_) {
                     lock.unlock();
                     lock.release();
@@ -1328,20 +1645,21 @@ void raft_server::commit_in_bg() {
                 if (log_entry->get_val_type() == log_val_type::app_log) {
                     state_machine_.commit(current_commit_idx, log_entry->get_buf());
                 } else if (log_entry->get_val_type() == log_val_type::conf) {
-                    recur_lock(lock_);
-                    log_entry->get_buf().pos(0);
-                    ptr<cluster_config> new_conf = cluster_config::deserialize(log_entry->get_buf());
-                    l_.info(sstrfmt("config at index %llu is committed").fmt(new_conf->get_log_idx()));
-                    ctx_->state_mgr_.save_config(*new_conf);
-                    config_changing_ = false;
-                    if (config_->get_log_idx() < new_conf->get_log_idx()) {
-                        reconfigure(new_conf);
-                    }
+                    loop_.run([this, &log_entry]() -> void {
+                        log_entry->get_buf().pos(0);
+                        ptr<cluster_config> new_conf = cluster_config::deserialize(log_entry->get_buf());
+                        l_.info(sstrfmt("config at index %llu is committed").fmt(new_conf->get_log_idx()));
+                        ctx_->state_mgr_.save_config(*new_conf);
+                        config_changing_ = false;
+                        if (config_->get_log_idx() < new_conf->get_log_idx()) {
+                            reconfigure(new_conf);
+                        }
 
-                    if (catching_up_ && new_conf->get_server(id_) != nilptr) {
-                        l_.info("this server is committed as one of cluster members");
-                        catching_up_ = false;
-                    }
+                        if (catching_up_ && new_conf->get_server(id_) != nilptr) {
+                            l_.info("this server is committed as one of cluster members");
+                            catching_up_ = false;
+                        }
+                    });
                 }
 
                 state_->set_commit_idx(current_commit_idx);
@@ -1401,9 +1719,13 @@ ptr<async_result<bool>> raft_server::send_msg_to_leader(ptr<req_msg>& req) {
     }
 
     if (leader_id == id_) {
-        ptr<resp_msg> resp = process_req(*req);
-        result = resp->get_accepted();
-        return cs_new<async_result<bool>>(result);
+        ptr<async_result<bool>> presult(cs_new<async_result<bool>>());
+        async_result<ptr<resp_msg>>::handler_type handler = [presult](ptr<resp_msg>& resp, ptr<std::exception>& err) -> void {
+            bool accepted = !err && resp && resp->get_accepted();
+            presult->set_result(accepted, err);
+        };
+        process_req_async(req)->when_ready(handler);
+        return presult;
     }
 
     ptr<rpc_client> rpc_cli;
@@ -20,7 +20,13 @@ namespace cornerstone {
             scheduler_(ctx->scheduler_),
             election_exec_(std::bind(&raft_server::handle_election_timeout, this)),
             election_task_(),
+            batch_exec_(std::bind(&raft_server::handle_batch_timeout, this)),
+            batch_task_(),
+            proposals_(),
+            proposal_bytes_(0),
+            proposal_results_(),
             peers_(),
+            commit_tracker_(),
             rpc_clients_(),
             role_(srv_role::follower),
             state_(ctx->state_mgr_.read_state()),
@@ -30,7 +36,7 @@ namespace cornerstone {
             config_(ctx->state_mgr_.load_config()),
             srv_to_join_(),
             conf_to_add_(),
-            lock_(),
+            loop_(),
             commit_lock_(),
             rpc_clients_lock_(),
             commit_cv_(),
@@ -79,9 +85,12 @@ namespace cornerstone {
                 if ((*it)->get_id() != id_) {
          	        timer_task<peer&>::executor exec = (timer_task<peer&>::executor)std::bind(&raft_server::handle_hb_timeout, this, std::placeholders::_1);
                     peers_.insert(std::make_pair((*it)->get_id(), cs_new<peer, srv_config&, context&, timer_task<peer&>::executor&>(**it, *ctx_, exec)));
+                    commit_tracker_.add_voter((*it)->get_id());
                 }
             }
 
+            commit_tracker_.add_voter(id_);
+
             quick_commit_idx_ = state_->get_commit_idx();
             std::thread commiting_thread = std::thread(std::bind(&raft_server::commit_in_bg, this));
             commiting_thread.detach();
@@ -90,18 +99,22 @@ namespace cornerstone {
         }
 
         virtual ~raft_server() {
-            recur_lock(lock_);
-            stopping_ = true;
             std::unique_lock<std::mutex> commit_lock(commit_lock_);
+            stopping_ = true;
             commit_cv_.notify_all();
             std::unique_lock<std::mutex> lock(stopping_lock_);
             commit_lock.unlock();
             commit_lock.release();
             ready_to_stop_cv_.wait(lock);
+            loop_.stop();
             if (election_task_) {
                 scheduler_.cancel(election_task_);
             }
 
+            if (batch_task_) {
+                scheduler_.cancel(batch_task_);
+            }
+
             for (peer_itor it = peers_.begin(); it != peers_.end(); ++it) {
                 if (it->second->get_hb_task()) {
                     scheduler_.cancel(it->second->get_hb_task());
@@ -112,8 +125,18 @@ namespace cornerstone {
     __nocopy__(raft_server)
     
     public:
+        /**
+        * Handles the request and returns the response, it blocks until the response is ready, which could wait for
+        * the log entries of the request to be durable
+        */
         ptr<resp_msg> process_req(req_msg& req);
 
+        /**
+        * Handles the request without blocking the caller, the result is set with the response once it's ready,
+        * or with the error if the request fails, it could be set by the thread of the event loop or of the log store
+        */
+        ptr<async_result<ptr<resp_msg>>> process_req_async(ptr<req_msg>& req);
+
         ptr<async_result<bool>> add_srv(const srv_config& srv);
 
         ptr<async_result<bool>> remove_srv(const int srv_id);
@@ -124,9 +147,11 @@ namespace cornerstone {
         typedef std::unordered_map<int32, ptr<peer>>::const_iterator peer_itor;
 
     private:
-        ptr<resp_msg> handle_append_entries(req_msg& req);
+        ptr<resp_msg> handle_req(req_msg& req, ptr<async_result<ulong>>& pending_append);
+        ptr<resp_msg> resp_of_failed_append(ptr<resp_msg>& resp, ptr<std::exception>& err);
+        ptr<resp_msg> handle_append_entries(req_msg& req, ptr<async_result<ulong>>& pending_append);
         ptr<resp_msg> handle_vote_req(req_msg& req);
-        ptr<resp_msg> handle_cli_req(req_msg& req);
+        ptr<resp_msg> handle_cli_req(req_msg& req, ptr<async_result<ulong>>& pending_append);
         ptr<resp_msg> handle_extended_msg(req_msg& req);
         ptr<resp_msg> handle_install_snapshot_req(req_msg& req);
         ptr<resp_msg> handle_rm_srv_req(req_msg& req);
@@ -139,7 +164,10 @@ namespace cornerstone {
         void request_append_entries();
         bool request_append_entries(peer& p);
         void handle_peer_resp(ptr<resp_msg>& resp, ptr<rpc_exception>& err);
+        void handle_replication_resp(ulong epoch, ptr<resp_msg>& resp, ptr<rpc_exception>& err);
         void handle_append_entries_resp(resp_msg& resp);
+        void commit_by_quorum();
+        void handle_append_entries_failure(rpc_exception& err);
         void handle_install_snapshot_resp(resp_msg& resp);
         void handle_voting_resp(resp_msg& resp);
         void handle_ext_resp(ptr<resp_msg>& resp, ptr<rpc_exception>& err);
@@ -157,6 +185,11 @@ namespace cornerstone {
         void stop_election_timer();
         void handle_hb_timeout(peer& peer);
         void handle_election_timeout();
+        void handle_batch_timeout();
+        void flush_proposals();
+        void append_to_leader_log(std::vector<ptr<log_entry>>& entries, std::vector<ptr<async_result<ulong>>>& proposals);
+        void on_leader_log_durable(std::vector<ptr<async_result<ulong>>>& proposals, ulong& last_idx, ptr<std::exception>& err);
+        void handle_leader_log_durable();
         void sync_log_to_new_srv(ulong start_idx);
         void invite_srv_to_join_cluster();
         void rm_srv_from_cluster(int32 srv_id);
@@ -183,7 +216,13 @@ namespace cornerstone {
         delayed_task_scheduler& scheduler_;
         timer_task<void>::executor election_exec_;
         ptr<delayed_task> election_task_;
+        timer_task<void>::executor batch_exec_;
+        ptr<delayed_task> batch_task_;
+        std::vector<ptr<log_entry>> proposals_;
+        size_t proposal_bytes_;
+        std::vector<ptr<async_result<ulong>>> proposal_results_;
         std::unordered_map<int32, ptr<peer>> peers_;
+        commit_tracker commit_tracker_;
         std::unordered_map<int32, ptr<rpc_client>> rpc_clients_;
         srv_role role_;
         ptr<srv_state> state_;
@@ -194,7 +233,7 @@ namespace cornerstone {
         ptr<cluster_config> config_;
         ptr<peer> srv_to_join_;
         ptr<srv_config> conf_to_add_;
-        std::recursive_mutex lock_;
+        event_loop loop_;
         std::mutex commit_lock_;
         std::mutex rpc_clients_lock_;
         std::condition_variable commit_cv_;
@@ -5,7 +5,7 @@ namespace cornerstone {
     class resp_msg : public msg_base {
     public:
         resp_msg(ulong term, msg_type type, int32 src, int32 dst, ulong next_idx = 0L, bool accepted = false)
-            : msg_base(term, type, src, dst), next_idx_(next_idx), accepted_(accepted) {}
+            : msg_base(term, type, src, dst), next_idx_(next_idx), accepted_(accepted), conflict_term_(0L), conflict_idx_(0L) {}
 
         __nocopy__(resp_msg)
 
@@ -22,9 +22,31 @@ namespace cornerstone {
             next_idx_ = next_idx;
             accepted_ = true;
         }
+
+        /**
+        * The term of the entry that conflicts with the last log entry of the rejected appendEntries request,
+        * 0 if the entry is not there
+        */
+        ulong get_conflict_term() const {
+            return conflict_term_;
+        }
+
+        /**
+        * The first log index of the conflict term
+        */
+        ulong get_conflict_idx() const {
+            return conflict_idx_;
+        }
+
+        void set_conflict(ulong term, ulong idx) {
+            conflict_term_ = term;
+            conflict_idx_ = idx;
+        }
     private:
         ulong next_idx_;
         bool accepted_;
+        ulong conflict_term_;
+        ulong conflict_idx_;
     };
 }
 
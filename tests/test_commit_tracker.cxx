@@ -0,0 +1,66 @@
+#include "../cornerstone.hxx"
+#include <cassert>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <ctime>
+
+using namespace cornerstone;
+
+static ulong sorted_quorum(const std::vector<ulong>& matched) {
+    std::vector<ulong> sorted(matched);
+    std::sort(sorted.begin(), sorted.end(), std::greater<ulong>());
+    return sorted[sorted.size() / 2];
+}
+
+void test_commit_tracker() {
+    commit_tracker tracker;
+    tracker.add_voter(1);
+    tracker.add_voter(2);
+    tracker.add_voter(3);
+    assert(0 == tracker.quorum_index());
+    assert(!tracker.update(1, 10));
+    assert(tracker.update(2, 5));
+    assert(5 == tracker.quorum_index());
+    assert(!tracker.update(3, 3));
+    assert(tracker.update(2, 10));
+    assert(10 == tracker.quorum_index());
+    assert(!tracker.update(4, 20));
+
+    // the index that goes back lowers the quorum index
+    assert(!tracker.update(1, 2));
+    assert(3 == tracker.quorum_index());
+
+    // a non-voting member is tracked without being counted
+    tracker.add_voter(4, 0);
+    assert(!tracker.update(4, 20));
+    assert(3 == tracker.quorum_index());
+    tracker.remove_voter(3);
+    assert(2 == tracker.quorum_index());
+
+    // weighted voters, 1 has the majority by itself
+    tracker.add_voter(1, 3);
+    assert(tracker.update(1, 30));
+    assert(30 == tracker.quorum_index());
+    tracker.reset();
+    assert(0 == tracker.quorum_index());
+
+    // the quorum index is the same as the one of the sorted matched indexes
+    commit_tracker voters;
+    std::vector<ulong> matched(9, 0);
+    for (int32 i = 0; i < 9; ++i) {
+        voters.add_voter(i);
+    }
+
+    std::default_random_engine engine((uint)std::time(nullptr));
+    std::uniform_int_distribution<int32> id_dist(0, 8);
+    std::uniform_int_distribution<int32> step_dist(-3, 10);
+    for (int i = 0; i < 10000; ++i) {
+        int32 id = id_dist(engine);
+        int32 step = step_dist(engine);
+        matched[id] = step < 0 && matched[id] < (ulong)-step ? 0 : matched[id] + step;
+        voters.update(id, matched[id]);
+        assert(sorted_quorum(matched) == voters.quorum_index());
+    }
+}
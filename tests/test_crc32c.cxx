@@ -0,0 +1,31 @@
+#include "../cornerstone.hxx"
+#include <cassert>
+#include <cstring>
+
+using namespace cornerstone;
+
+void test_crc32c() {
+    const char* check = "123456789";
+    assert(0xE3069283 == crc32c(reinterpret_cast<const byte*>(check), strlen(check)));
+
+    byte zeros[32];
+    ::memset(zeros, 0, sizeof(zeros));
+    assert(0x8A9136AA == crc32c(zeros, sizeof(zeros)));
+    assert(0 == crc32c(zeros, 0));
+
+    // the checksum is the same wherever the data starts and however it's split
+    byte data[1024 + 8];
+    for (size_t i = 0; i < sizeof(data); ++i) {
+        data[i] = static_cast<byte>(i * 31 + 7);
+    }
+
+    uint expected = crc32c(data, 1024);
+    for (size_t shift = 1; shift < 8; ++shift) {
+        ::memmove(data + shift, data + shift - 1, 1024);
+        assert(expected == crc32c(data + shift, 1024));
+    }
+
+    for (size_t split = 0; split < 1024; split += 77) {
+        assert(expected == crc32c(data + 7 + split, 1024 - split, crc32c(data + 7, split)));
+    }
+}
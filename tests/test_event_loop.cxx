@@ -0,0 +1,118 @@
+#include "../cornerstone.hxx"
+#include <cassert>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+using namespace cornerstone;
+
+#define PRODUCERS 4
+#define TASKS_PER_PRODUCER 10000
+
+void test_event_loop() {
+    event_loop loop;
+    assert(!loop.in_loop());
+
+    // the tasks of each producer run in the order they are posted, and one at a time, so the state needs no lock
+    std::vector<int> last_seen(PRODUCERS, -1);
+    int total = 0;
+    bool ordered = true;
+    std::vector<std::thread> producers;
+    for (int p = 0; p < PRODUCERS; ++p) {
+        producers.push_back(std::thread([&loop, &last_seen, &total, &ordered, p]() -> void {
+            for (int i = 0; i < TASKS_PER_PRODUCER; ++i) {
+                loop.post([&last_seen, &total, &ordered, p, i]() -> void {
+                    if (last_seen[p] + 1 != i) {
+                        ordered = false;
+                    }
+
+                    last_seen[p] = i;
+                    ++total;
+                });
+            }
+        }));
+    }
+
+    for (size_t i = 0; i < producers.size(); ++i) {
+        producers[i].join();
+    }
+
+    // run waits for all the tasks posted before it
+    int result = 0;
+    loop.run([&total, &result]() -> void { result = total; });
+    assert(PRODUCERS * TASKS_PER_PRODUCER == result);
+    assert(ordered);
+
+    // run is called directly on the loop, otherwise it would wait for itself
+    bool nested = false;
+    bool in_loop = false;
+    loop.run([&loop, &nested, &in_loop]() -> void {
+        in_loop = loop.in_loop();
+        loop.run([&nested]() -> void { nested = true; });
+    });
+    assert(in_loop);
+    assert(nested);
+
+    // the error of the task is thrown by run, the loop keeps going
+    bool thrown = false;
+    try {
+        loop.run([]() -> void { throw std::runtime_error("task failed"); });
+    }
+    catch (std::runtime_error&) {
+        thrown = true;
+    }
+
+    assert(thrown);
+    loop.post([]() -> void { throw std::runtime_error("posted task failed"); });
+    std::atomic<int> after_error(0);
+    loop.post([&after_error]() -> void { after_error = 1; });
+    loop.run([]() -> void {});
+    assert(1 == after_error);
+
+    // the queued tasks are run before the loop stops
+    std::atomic<int> drained(0);
+    for (int i = 0; i < 100; ++i) {
+        loop.post([&drained]() -> void { ++drained; });
+    }
+
+    loop.stop();
+    assert(100 == drained);
+    thrown = false;
+    try {
+        loop.run([]() -> void {});
+    }
+    catch (std::runtime_error&) {
+        thrown = true;
+    }
+
+    assert(thrown);
+
+    // a task that is run while the loop stops is either run or rejected, run never waits for a task that is dropped
+    event_loop loop1;
+    std::atomic<int> ran(0);
+    std::atomic<int> rejected(0);
+    std::vector<std::thread> callers;
+    for (int p = 0; p < PRODUCERS; ++p) {
+        callers.push_back(std::thread([&loop1, &ran, &rejected]() -> void {
+            for (int i = 0; i < TASKS_PER_PRODUCER; ++i) {
+                try {
+                    loop1.run([&ran]() -> void { ++ran; });
+                }
+                catch (std::runtime_error&) {
+                    ++rejected;
+                }
+            }
+        }));
+    }
+
+    while (ran < TASKS_PER_PRODUCER) {
+        std::this_thread::yield();
+    }
+
+    loop1.stop();
+    for (size_t i = 0; i < callers.size(); ++i) {
+        callers[i].join();
+    }
+
+    assert(PRODUCERS * TASKS_PER_PRODUCER == ran + rejected);
+}
@@ -50,6 +50,17 @@ public:
         return (ulong)(log_entries_.size() - 1);
     }
 
+    /**
+    * Appends the log entries to store as one batch
+    * @param entries
+    */
+    virtual ulong append_batch(std::vector<ptr<log_entry>>& entries) {
+        auto_lock(lock_);
+        ulong first_idx = (ulong)log_entries_.size();
+        log_entries_.insert(log_entries_.end(), entries.begin(), entries.end());
+        return first_idx;
+    }
+
     /**
     * Over writes a log entry at index of {@code index}
     * @param index a value < this->next_slot(), and starts from 1
@@ -67,6 +78,19 @@ public:
         }
     }
 
+    /**
+    * Removes all log entries starting from index
+    * @param index a value <= this->next_slot(), and starts from 1
+    */
+    virtual void truncate(ulong index) {
+        auto_lock(lock_);
+        if (index > (ulong)log_entries_.size() || index < 1) {
+            throw std::overflow_error("index out of range");
+        }
+
+        log_entries_.erase(log_entries_.begin() + (size_t)index, log_entries_.end());
+    }
+
     /**
     * Get log entries with index between start and end
     * @param start, the start index of log entries
@@ -4,13 +4,6 @@
 using namespace cornerstone;
 
 #ifdef _WIN32
-#define LOG_INDEX_FILE "\\store.idx"
-#define LOG_DATA_FILE "\\store.dat"
-#define LOG_START_INDEX_FILE "\\store.sti"
-#define LOG_INDEX_FILE_BAK "\\store.idx.bak"
-#define LOG_DATA_FILE_BAK "\\store.dat.bak"
-#define LOG_START_INDEX_FILE_BAK "\\store.sti.bak"
-
 #include <Windows.h>
 
 int mkdir(const char* path, int mode) {
@@ -21,28 +14,80 @@ int mkdir(const char* path, int mode) {
 int rmdir(const char* path) {
     return 1 == ::RemoveDirectoryA(path) ? 0 : -1;
 }
+
+static void list_files(const std::string& folder, std::vector<std::string>& files) {
+    WIN32_FIND_DATAA data;
+    HANDLE find_handle = ::FindFirstFileA((folder + "\\*").c_str(), &data);
+    if (find_handle == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    do {
+        files.push_back(data.cFileName);
+    } while (::FindNextFileA(find_handle, &data));
+    ::FindClose(find_handle);
+}
 #undef min
 #undef max
+#define PATH_SEPARATOR "\\"
 #else
-#define LOG_INDEX_FILE "/store.idx"
-#define LOG_DATA_FILE "/store.dat"
-#define LOG_START_INDEX_FILE "/store.sti"
-#define LOG_INDEX_FILE_BAK "/store.idx.bak"
-#define LOG_DATA_FILE_BAK "/store.dat.bak"
-#define LOG_START_INDEX_FILE_BAK "/store.sti.bak"
-
 #include <unistd.h>
+#include <dirent.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+
+static void list_files(const std::string& folder, std::vector<std::string>& files) {
+    DIR* dir = opendir(folder.c_str());
+    if (dir == NULL) {
+        return;
+    }
+
+    for (struct dirent* ent = readdir(dir); ent != NULL; ent = readdir(dir)) {
+        files.push_back(ent->d_name);
+    }
+
+    closedir(dir);
+}
+#define PATH_SEPARATOR "/"
 #endif
 
+// number of store files with the given suffix, e.g. the number of segments if suffix is ".dat"
+static size_t count_store_files(const std::string& folder, const std::string& suffix) {
+    std::vector<std::string> files;
+    list_files(folder, files);
+    size_t cnt = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (files[i].find("store.") == 0 && files[i].length() > suffix.length() && files[i].compare(files[i].length() - suffix.length(), suffix.length(), suffix) == 0) {
+            ++cnt;
+        }
+    }
+
+    return cnt;
+}
+
+// total size of the segment data files
+static ulong store_data_size(const std::string& folder) {
+    std::vector<std::string> files;
+    list_files(folder, files);
+    ulong size = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (files[i].find("store.") == 0 && files[i].length() > 4 && files[i].compare(files[i].length() - 4, 4, ".dat") == 0) {
+            std::ifstream file(folder + PATH_SEPARATOR + files[i], std::ifstream::binary | std::ifstream::ate);
+            size += static_cast<ulong>(file.tellg());
+        }
+    }
+
+    return size;
+}
+
 static void cleanup(const std::string& folder) {
-    std::remove((folder + LOG_INDEX_FILE).c_str());
-    std::remove((folder + LOG_DATA_FILE).c_str());
-    std::remove((folder + LOG_START_INDEX_FILE).c_str());
-    std::remove((folder + LOG_INDEX_FILE_BAK).c_str());
-    std::remove((folder + LOG_DATA_FILE_BAK).c_str());
-    std::remove((folder + LOG_START_INDEX_FILE_BAK).c_str());
+    std::vector<std::string> files;
+    list_files(folder, files);
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (files[i].find("store.") == 0) {
+            std::remove((folder + PATH_SEPARATOR + files[i]).c_str());
+        }
+    }
 }
 
 static void cleanup() {
@@ -75,6 +120,47 @@ static bool entry_equals(log_entry& entry1, log_entry& entry2) {
     return result;
 }
 
+// corrupts a copy of the pack at pos, the pack starts with the index and data lengths followed by the offsets
+template<typename T>
+static ptr<buffer> corrupt_pack(buffer& pack, size_t pos, T val) {
+    ptr<buffer> result(buffer::copy(pack));
+    result->pos(pos);
+    result->put(val);
+    result->pos(0);
+    return result;
+}
+
+static bool pack_rejected(log_store& store, ulong index, buffer& pack) {
+    try {
+        store.apply_pack(index, pack);
+    }
+    catch (std::runtime_error&) {
+        return true;
+    }
+
+    return false;
+}
+
+// the lengths and offsets of the pack are checked before any record is read
+static void test_corrupt_packs(log_store& store, ulong index, buffer& pack) {
+    size_t offsets_pos = sz_int * 2;
+    size_t cnt = static_cast<size_t>(pack.get_int()) / sz_ulong;
+    int32 data_len = pack.get_int();
+    pack.pos(offsets_pos + (cnt - 1) * sz_ulong);
+    ulong last_offset = pack.get_ulong();
+    pack.pos(0);
+    ulong next_slot = store.next_slot();
+    assert(pack_rejected(store, index, *corrupt_pack(pack, 0, (int32)-8)));
+    assert(pack_rejected(store, index, *corrupt_pack(pack, sz_int, (int32)-1)));
+    assert(pack_rejected(store, index, *corrupt_pack(pack, 0, (int32)(cnt * sz_ulong + 1))));
+    assert(pack_rejected(store, index, *corrupt_pack(pack, 0, (int32)((cnt + 1) * sz_ulong))));
+    assert(pack_rejected(store, index, *corrupt_pack(pack, sz_int, data_len + 1)));
+    assert(pack_rejected(store, index, *corrupt_pack(pack, sz_int, (int32)0x7fffffff)));
+    assert(pack_rejected(store, index, *corrupt_pack(pack, offsets_pos + sz_ulong, last_offset)));
+    assert(pack_rejected(store, index, *corrupt_pack(pack, offsets_pos + (cnt - 1) * sz_ulong, last_offset + (ulong)data_len)));
+    assert(store.next_slot() == next_slot);
+}
+
 void test_log_store() {
     uint seed = (uint)std::chrono::system_clock::now().time_since_epoch().count();
     std::default_random_engine engine(seed);
@@ -161,7 +247,9 @@ void test_log_store_buffer() {
     std::function<int32()> rnd = std::bind(distribution, engine);
 
     cleanup();
-    fs_log_store store(".", 1000);
+
+    // the cache is bounded by bytes, the entries take 17 to 116 bytes each
+    fs_log_store store(".", 64 * 1024);
     int logs_count = rnd() % 1000 + 1500;
     std::vector<ptr<log_entry>> entries;
     for (int i = 0; i < logs_count; ++i) {
@@ -170,14 +258,52 @@ void test_log_store_buffer() {
         entries.push_back(entry);
     }
 
+    assert(store.cache_bytes() <= 64 * 1024);
+    assert(store.cache_bytes() > 64 * 1024 - 116);
     int start = rnd() % (logs_count - 1000);
     int end = logs_count - 500;
     ptr<std::vector<ptr<log_entry>>> results = store.log_entries((ulong)start + 1, (ulong)end + 1);
     for (int i = start; i < end; ++i) {
-        entry_equals(*entries[i], *(*results)[i - start]);
+        assert(entry_equals(*entries[i], *(*results)[i - start]));
     }
 
+    assert(store.cache_hits() + store.cache_misses() == (ulong)(end - start));
+    assert(store.cache_misses() > 0);
+    assert(entry_equals(*store.entry_at((ulong)logs_count), *entries[logs_count - 1]));
+    assert(store.cache_hits() + store.cache_misses() == (ulong)(end - start + 1));
+
+    // an entry that is larger than the cache still stays as the last entry
+    ptr<buffer> large_buf(buffer::alloc(128 * 1024));
+    ptr<log_entry> large_entry(cs_new<log_entry>(1, large_buf));
+    store.append(large_entry);
+    assert(store.cache_bytes() == 128 * 1024 + sz_ulong + 1);
+    assert(entry_equals(*store.last_entry(), *large_entry));
+    store.write_at((ulong)logs_count + 1, entries.back());
+    assert(entry_equals(*store.last_entry(), *entries.back()));
+    entries.push_back(entries.back());
+    logs_count += 1;
     store.close();
+
+    // the buffer only has the last entry after the store is opened, the rest are read from the segments
+    fs_log_store store1(".");
+    assert(entry_equals(*store1.last_entry(), *entries[logs_count - 1]));
+    results = store1.log_entries((ulong)start + 1, (ulong)end + 1);
+    assert(results->size() == (size_t)(end - start));
+    for (int i = start; i < end; ++i) {
+        assert(entry_equals(*entries[i], *(*results)[i - start]));
+    }
+
+    results = store1.log_entries((ulong)end + 1, (ulong)logs_count + 1);
+    assert(results->size() == (size_t)(logs_count - end));
+    for (int i = end; i < logs_count; ++i) {
+        assert(entry_equals(*entries[i], *(*results)[i - end]));
+    }
+
+    ptr<log_entry> entry(rnd_entry(rnd));
+    store1.append(entry);
+    assert(entry_equals(*store1.last_entry(), *entry));
+    assert(entry_equals(*store1.entry_at((ulong)logs_count + 1), *entry));
+    store1.close();
     cleanup();
 }
 
@@ -313,5 +439,1059 @@ void test_log_store_compact_random() {
         assert(entry_equals(*entry, *entries[i + (size_t)idx_to_compact]));
     }
     store.close();
+
+    // the space of the compacted entries is released, the remaining entries are read at the same offsets
+    fs_log_store store1(".", 1000);
+    assert(store1.start_index() == (idx_to_compact + 1));
+    assert(store1.next_slot() == (entries.size() + 1));
+    ulong idx_to_compact1 = (ulong)rnd() % (store1.next_slot() - store1.start_index() - 1) + store1.start_index();
+    assert(store1.compact(idx_to_compact1));
+    for (size_t i = 0; i < store1.next_slot() - idx_to_compact1 - 1; ++i) {
+        ptr<log_entry> entry = store1.entry_at(store1.start_index() + i);
+        assert(entry_equals(*entry, *entries[i + (size_t)idx_to_compact1]));
+    }
+
+    bool compacted = false;
+    try {
+        store1.entry_at(idx_to_compact1);
+    }
+    catch (std::range_error&) {
+        compacted = true;
+    }
+
+    assert(compacted);
+    store1.close();
+    cleanup();
+}
+
+void test_log_store_segments() {
+    uint seed = (uint)std::chrono::system_clock::now().time_since_epoch().count();
+    std::default_random_engine engine(seed);
+    std::uniform_int_distribution<int32> distribution(1, 10000);
+    std::function<int32()> rnd = std::bind(distribution, engine);
+
+    cleanup();
+    std::vector<ptr<log_entry>> entries;
+    {
+        // small segments, so that the logs are spread over a few segments
+        fs_log_store store(".", 100, 4 * 1024);
+        int cnt = rnd() % 500 + 500;
+        for (int i = 0; i < cnt; ++i) {
+            ptr<log_entry> entry(rnd_entry(rnd));
+            store.append(entry);
+            entries.push_back(entry);
+        }
+
+        size_t segments = count_store_files(".", ".dat");
+        assert(segments > 2);
+        assert(count_store_files(".", ".idx") == segments);
+        for (size_t i = 0; i < entries.size(); ++i) {
+            assert(entry_equals(*entries[i], *store.entry_at(i + 1)));
+        }
+
+        // compaction removes the segments below the compacted index only
+        ulong idx_to_compact = entries.size() / 2;
+        assert(store.compact(idx_to_compact));
+        assert(count_store_files(".", ".dat") < segments);
+        assert(store.start_index() == idx_to_compact + 1);
+        assert(store.next_slot() == entries.size() + 1);
+        for (ulong i = store.start_index(); i < store.next_slot(); ++i) {
+            assert(entry_equals(*entries[(size_t)i - 1], *store.entry_at(i)));
+            assert(entries[(size_t)i - 1]->get_term() == store.term_at(i));
+        }
+
+        // overwrite an entry in the middle, all later segments are dropped
+        ulong rnd_idx = store.start_index() + (ulong)rnd() % (store.next_slot() - store.start_index());
+        ptr<log_entry> entry(rnd_entry(rnd));
+        store.write_at(rnd_idx, entry);
+        entries[(size_t)rnd_idx - 1] = entry;
+        entries.erase(entries.begin() + (size_t)rnd_idx, entries.end());
+        assert(store.next_slot() == rnd_idx + 1);
+
+        // a conflicting suffix is truncated in one operation, then replaced by a batch
+        std::vector<ptr<log_entry>> batch;
+        for (int i = 0; i < 200; ++i) {
+            batch.push_back(rnd_entry(rnd));
+        }
+
+        store.append_batch(batch);
+        entries.insert(entries.end(), batch.begin(), batch.end());
+        ulong truncate_idx = store.start_index() + (ulong)rnd() % (store.next_slot() - store.start_index());
+        store.truncate(truncate_idx);
+        entries.erase(entries.begin() + (size_t)truncate_idx - 1, entries.end());
+        assert(store.next_slot() == truncate_idx);
+        store.truncate(truncate_idx);
+        assert(store.next_slot() == truncate_idx);
+        store.append_batch(batch);
+        entries.insert(entries.end(), batch.begin(), batch.end());
+        assert(entry_equals(*store.last_entry(), *entries.back()));
+        for (ulong i = store.start_index(); i < store.next_slot(); ++i) {
+            assert(entry_equals(*entries[(size_t)i - 1], *store.entry_at(i)));
+            assert(entries[(size_t)i - 1]->get_term() == store.term_at(i));
+        }
+
+        store.close();
+    }
+
+    fs_log_store store1(".", 100, 4 * 1024);
+    assert(store1.next_slot() == entries.size() + 1);
+    for (ulong i = store1.start_index(); i < store1.next_slot(); ++i) {
+        assert(entry_equals(*entries[(size_t)i - 1], *store1.entry_at(i)));
+    }
+
+    ptr<std::vector<ptr<log_entry>>> results(store1.log_entries(store1.start_index(), store1.next_slot()));
+    for (size_t i = 0; i < results->size(); ++i) {
+        assert(entry_equals(*entries[(size_t)store1.start_index() + i - 1], *(*results)[i]));
+    }
+
+    // a pack across the segments is written to a store with small segments and a tiny buffer
+    cleanup("tmp");
+    mkdir("tmp", 0x766);
+    {
+        fs_log_store store2("tmp", 10, 4 * 1024);
+        ulong cnt = store1.next_slot() - store1.start_index();
+        ptr<buffer> pack(store1.pack(store1.start_index(), (int32)cnt));
+        store2.apply_pack(1, *pack);
+        assert(store2.next_slot() == cnt + 1);
+        assert(pack->size() < 2 * 4 * 1024 || count_store_files("tmp", ".dat") > 1);
+        for (ulong i = 1; i <= cnt; ++i) {
+            assert(entry_equals(*store1.entry_at(store1.start_index() + i - 1), *store2.entry_at(i)));
+            assert(store1.term_at(store1.start_index() + i - 1) == store2.term_at(i));
+        }
+
+        assert(entry_equals(*store1.last_entry(), *store2.last_entry()));
+        store2.close();
+    }
+
+    cleanup("tmp");
+    rmdir("tmp");
+
+    // compact all
+    assert(store1.compact(store1.next_slot() - 1));
+    assert(count_store_files(".", ".dat") == 1);
+    assert(store1.start_index() == store1.next_slot());
+    store1.close();
+    cleanup();
+}
+
+void test_log_store_durability() {
+    uint seed = (uint)std::chrono::system_clock::now().time_since_epoch().count();
+    std::default_random_engine engine(seed);
+    std::uniform_int_distribution<int32> distribution(1, 10000);
+    std::function<int32()> rnd = std::bind(distribution, engine);
+
+    cleanup();
+    {
+        // concurrent appends share the syncs, and each append returns after its entry is durable
+        fs_log_store store(".", 100, 4 * 1024, per_batch_sync);
+        std::atomic<int> syncs(0);
+        store.set_durable_handler([&syncs](ulong) { syncs += 1; });
+        std::vector<ptr<log_entry>> entries;
+        for (int i = 0; i < 400; ++i) {
+            entries.push_back(rnd_entry(rnd));
+        }
+
+        std::vector<std::thread> writers;
+        for (int t = 0; t < 4; ++t) {
+            writers.push_back(std::thread([&store, &entries, t]() {
+                for (int i = t * 100; i < (t + 1) * 100; ++i) {
+                    ulong idx = store.append(entries[i]);
+                    assert(store.durable_index() >= idx);
+                }
+            }));
+        }
+
+        for (size_t i = 0; i < writers.size(); ++i) {
+            writers[i].join();
+        }
+
+        assert(store.next_slot() == 401);
+        assert(store.durable_index() == 400);
+        assert(syncs > 0 && syncs <= 400);
+
+        // overwriting an entry takes the entries after it out of the durable range
+        ptr<log_entry> entry(rnd_entry(rnd));
+        store.write_at(201, entry);
+        assert(store.durable_index() == 201);
+        store.close();
+    }
+
+    {
+        fs_log_store store(".", 100, 4 * 1024, no_sync);
+        assert(store.next_slot() == 202);
+        assert(store.durable_index() == 201);
+        ptr<log_entry> entry(rnd_entry(rnd));
+        assert(store.append(entry) == 202);
+        assert(store.durable_index() == 202);
+        store.close();
+    }
+
+    {
+        fs_log_store store(".", 100, 4 * 1024, interval_sync, 5);
+        assert(store.durable_index() == 202);
+        ptr<log_entry> entry(rnd_entry(rnd));
+        ulong idx = store.append(entry);
+        store.sync(idx);
+        assert(store.durable_index() == idx);
+        for (int i = 0; i < 10; ++i) {
+            entry = rnd_entry(rnd);
+            idx = store.append(entry);
+        }
+
+        // the background thread catches up
+        for (int i = 0; i < 200 && store.durable_index() < idx; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+
+        assert(store.durable_index() == idx);
+        store.close();
+    }
+
+    cleanup();
+}
+
+void test_log_store_append_batch() {
+    uint seed = (uint)std::chrono::system_clock::now().time_since_epoch().count();
+    std::default_random_engine engine(seed);
+    std::uniform_int_distribution<int32> distribution(1, 10000);
+    std::function<int32()> rnd = std::bind(distribution, engine);
+
+    cleanup();
+    std::vector<ptr<log_entry>> logs;
+    {
+        fs_log_store store(".", 100, 4 * 1024);
+        for (int b = 0; b < 10; ++b) {
+            std::vector<ptr<log_entry>> batch;
+            int cnt = rnd() % 100 + 1;
+            for (int i = 0; i < cnt; ++i) {
+                batch.push_back(rnd_entry(rnd));
+            }
+
+            assert(store.append_batch(batch) == logs.size() + 1);
+            logs.insert(logs.end(), batch.begin(), batch.end());
+            assert(store.next_slot() == logs.size() + 1);
+            assert(store.durable_index() == logs.size());
+        }
+
+        std::vector<ptr<log_entry>> empty_batch;
+        assert(store.append_batch(empty_batch) == logs.size() + 1);
+
+        // the async appends return once the entries are staged, the results are set once they are durable
+        std::vector<ptr<async_result<ulong>>> results;
+        std::atomic<int> completed(0);
+        async_result<ulong>::handler_type handler = [&completed](ulong&, ptr<std::exception>& err) -> void {
+            assert(err == nilptr);
+            completed += 1;
+        };
+
+        for (int b = 0; b < 10; ++b) {
+            std::vector<ptr<log_entry>> batch;
+            int cnt = rnd() % 100 + 1;
+            for (int i = 0; i < cnt; ++i) {
+                batch.push_back(rnd_entry(rnd));
+            }
+
+            results.push_back(store.append_async(batch));
+            results.back()->when_ready(handler);
+            logs.insert(logs.end(), batch.begin(), batch.end());
+            assert(store.next_slot() == logs.size() + 1);
+            assert(entry_equals(*store.last_entry(), *logs.back()));
+        }
+
+        assert(results.back()->get() == logs.size());
+        assert(store.durable_index() >= logs.size());
+        for (size_t i = 0; i < results.size(); ++i) {
+            assert(results[i]->get() <= logs.size());
+        }
+
+        assert(completed == 10);
+        store.close();
+    }
+
+    fs_log_store store1(".", 100, 4 * 1024);
+    assert(store1.next_slot() == logs.size() + 1);
+    for (size_t i = 0; i < logs.size(); ++i) {
+        assert(entry_equals(*logs[i], *store1.entry_at(i + 1)));
+        assert(logs[i]->get_term() == store1.term_at(i + 1));
+    }
+
+    store1.close();
+    cleanup();
+}
+
+void test_log_store_concurrent_reads() {
+    uint seed = (uint)std::chrono::system_clock::now().time_since_epoch().count();
+    std::default_random_engine engine(seed);
+    std::uniform_int_distribution<int32> distribution(1, 10000);
+    std::function<int32()> rnd = std::bind(distribution, engine);
+
+    cleanup();
+    std::vector<ptr<log_entry>> logs;
+    for (int i = 0; i < 2000; ++i) {
+        logs.push_back(rnd_entry(rnd));
+    }
+
+    // a tiny buffer, so that the reads go to the segment files
+    fs_log_store store(".", 10, 16 * 1024, no_sync);
+    for (size_t i = 0; i < 500; ++i) {
+        store.append(logs[i]);
+    }
+
+    std::atomic<bool> done(false);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.push_back(std::thread([&store, &logs, &done, t]() {
+            ulong idx = 1 + t;
+            while (!done) {
+                // the first 400 entries are never overwritten
+                idx = idx % 400 + 1;
+                ptr<log_entry> entry(store.entry_at(idx));
+                assert(entry_equals(*logs[(size_t)idx - 1], *entry));
+                assert(logs[(size_t)idx - 1]->get_term() == store.term_at(idx));
+            }
+        }));
+    }
+
+    // appends and overwrites while the readers are running
+    for (size_t i = 500; i < logs.size(); ++i) {
+        store.append(logs[i]);
+        if (i % 100 == 0) {
+            store.write_at(i - 49, logs[i - 50]);
+            for (size_t j = i - 49; j <= i; ++j) {
+                store.append(logs[j]);
+            }
+        }
+    }
+
+    done = true;
+    for (size_t i = 0; i < readers.size(); ++i) {
+        readers[i].join();
+    }
+
+    assert(store.next_slot() == logs.size() + 1);
+    ptr<std::vector<ptr<log_entry>>> entries(store.log_entries(1, store.next_slot()));
+    for (size_t i = 0; i < logs.size(); ++i) {
+        assert(entry_equals(*logs[i], *(*entries)[i]));
+    }
+
+    store.close();
+    cleanup();
+
+    // the readers read the tail from the cache while the entries are appended and evicted
+    fs_log_store store1(".", 4 * 1024, fs_log_store::default_segment_size, no_sync);
+    done = false;
+    readers.clear();
+    for (int t = 0; t < 4; ++t) {
+        readers.push_back(std::thread([&store1, &logs, &done]() {
+            while (!done) {
+                ulong next = store1.next_slot();
+                ptr<log_entry> last(store1.last_entry());
+                if (next == 1) {
+                    continue;
+                }
+
+                // an entry is only appended once, the last entry is one of the appended ones
+                assert(last->get_term() != 0);
+                ulong idx = next - 1 - (next - 1) % 8;
+                if (idx > 0) {
+                    ptr<log_entry> entry(store1.entry_at(idx));
+                    assert(entry_equals(*logs[(size_t)idx - 1], *entry));
+                }
+            }
+        }));
+    }
+
+    for (size_t i = 0; i < logs.size(); ++i) {
+        store1.append(logs[i]);
+    }
+
+    done = true;
+    for (size_t i = 0; i < readers.size(); ++i) {
+        readers[i].join();
+    }
+
+    assert(store1.cache_bytes() <= 4 * 1024);
+    assert(entry_equals(*store1.last_entry(), *logs.back()));
+    store1.close();
+    cleanup();
+}
+
+void test_log_store_term_runs() {
+    uint seed = (uint)std::chrono::system_clock::now().time_since_epoch().count();
+    std::default_random_engine engine(seed);
+    std::uniform_int_distribution<int32> distribution(1, 10000);
+    std::function<int32()> rnd = std::bind(distribution, engine);
+
+    cleanup();
+    std::vector<ulong> terms;
+    {
+        // the terms change every few entries, like the leader changes
+        fs_log_store store(".", 10, 4 * 1024);
+        ulong term = 1;
+        for (int i = 0; i < 1000; ++i) {
+            if (rnd() % 20 == 0) {
+                term += rnd() % 3 + 1;
+            }
+
+            ptr<buffer> buf = buffer::alloc(rnd() % 100 + 8);
+            ptr<log_entry> entry(cs_new<log_entry>(term, buf));
+            store.append(entry);
+            terms.push_back(term);
+        }
+
+        for (size_t i = 0; i < terms.size(); ++i) {
+            assert(store.term_at(i + 1) == terms[i]);
+        }
+
+        assert(store.term_at(terms.size() + 1) == 0);
+
+        // the first index of a term is where its first run starts
+        for (size_t i = 0; i < terms.size(); ++i) {
+            size_t first = i;
+            while (first > 0 && terms[first - 1] == terms[i]) {
+                --first;
+            }
+
+            assert(store.first_index_of_term(i + 1) == first + 1);
+        }
+
+        // overwrite with a new term, and compact
+        ulong idx = 500 + rnd() % 400;
+        ulong new_term = terms.back() + 1;
+        ptr<log_entry> entry(cs_new<log_entry>(new_term, buffer::alloc(8)));
+        store.write_at(idx, entry);
+        terms.resize((size_t)idx);
+        terms.back() = new_term;
+        assert(store.compact(rnd() % 400 + 1));
+        for (ulong i = store.start_index(); i < store.next_slot(); ++i) {
+            assert(store.term_at(i) == terms[(size_t)i - 1]);
+        }
+
+        // the term that starts before the compacted entries starts at the start index
+        assert(store.first_index_of_term(store.start_index()) == store.start_index());
+        assert(store.first_index_of_term(store.next_slot() - 1) == (ulong)idx);
+
+        store.close();
+    }
+
+    {
+        fs_log_store store(".", 10, 4 * 1024);
+        assert(store.next_slot() == terms.size() + 1);
+        for (ulong i = store.start_index(); i < store.next_slot(); ++i) {
+            assert(store.term_at(i) == terms[(size_t)i - 1]);
+        }
+
+        store.close();
+    }
+
+    // the runs of the entries after the checkpoint are rebuilt from the entries, the header is put back
+    // to the one before the entries are appended, as if the store was stopped before it saved the header again
+    std::ifstream header_file("store.hdr", std::ifstream::binary | std::ifstream::ate);
+    std::vector<char> header((size_t)header_file.tellg());
+    header_file.seekg(0);
+    header_file.read(&header[0], header.size());
+    header_file.close();
+    {
+        fs_log_store store(".", 10, 1024 * 1024);
+        for (int i = 0; i < 50; ++i) {
+            ulong term = terms.back() + (rnd() % 5 == 0 ? 1 : 0);
+            ptr<log_entry> entry(cs_new<log_entry>(term, buffer::alloc(8)));
+            store.append(entry);
+            terms.push_back(term);
+        }
+
+        store.close();
+    }
+
+    std::ofstream saved_header("store.hdr", std::ofstream::binary | std::ofstream::trunc);
+    saved_header.write(&header[0], header.size());
+    saved_header.close();
+    fs_log_store store1(".", 10, 1024 * 1024);
+    assert(store1.next_slot() == terms.size() + 1);
+    for (ulong i = store1.start_index(); i < store1.next_slot(); ++i) {
+        assert(store1.term_at(i) == terms[(size_t)i - 1]);
+    }
+
+    store1.close();
+    cleanup();
+}
+
+void test_log_store_recovery() {
+    uint seed = (uint)std::chrono::system_clock::now().time_since_epoch().count();
+    std::default_random_engine engine(seed);
+    std::uniform_int_distribution<int32> distribution(1, 10000);
+    std::function<int32()> rnd = std::bind(distribution, engine);
+
+    cleanup();
+    std::vector<ptr<log_entry>> logs;
+    {
+        fs_log_store store(".", 10);
+        for (int i = 0; i < 100; ++i) {
+            ptr<log_entry> entry(rnd_entry(rnd));
+            store.append(entry);
+            logs.push_back(entry);
+        }
+
+        store.close();
+    }
+
+    // a torn record at the end of the data file is dropped
+    {
+        std::fstream data_file("store.1.dat", std::fstream::binary | std::fstream::in | std::fstream::out | std::fstream::ate);
+        const char torn[] = { 0x20, 0x00, 0x00, 0x00, 0x01, 0x02 };
+        data_file.write(torn, sizeof(torn));
+    }
+
+    {
+        fs_log_store store(".", 10);
+        assert(store.next_slot() == 101);
+        assert(entry_equals(*store.last_entry(), *logs[99]));
+        store.close();
+    }
+
+    // a record with a bad checksum is dropped, and the index file is rebuilt
+    {
+        std::fstream data_file("store.1.dat", std::fstream::binary | std::fstream::in | std::fstream::out);
+        data_file.seekg(-1, std::fstream::end);
+        char last = 0;
+        data_file.read(&last, 1);
+        data_file.seekp(-1, std::fstream::end);
+        last = ~last;
+        data_file.write(&last, 1);
+    }
+
+    {
+        fs_log_store store(".", 10);
+        assert(store.next_slot() == 100);
+        for (ulong i = 1; i < store.next_slot(); ++i) {
+            ptr<log_entry> entry(store.entry_at(i));
+            assert(entry_equals(*entry, *logs[(size_t)i - 1]));
+        }
+
+        ptr<log_entry> entry(rnd_entry(rnd));
+        store.append(entry);
+        logs[99] = entry;
+
+        // a pack with a broken record is rejected before anything is changed
+        ptr<buffer> pack = store.pack(90, 10);
+        pack->data()[pack->size() - 1] ^= 0xff;
+        bool rejected = false;
+        try {
+            store.apply_pack(90, *pack);
+        }
+        catch (std::runtime_error&) {
+            rejected = true;
+        }
+
+        assert(rejected);
+        assert(store.next_slot() == 101);
+        pack = store.pack(90, 10);
+        test_corrupt_packs(store, 90, *pack);
+        store.close();
+    }
+
+    {
+        fs_log_store store(".", 10);
+        assert(store.next_slot() == 101);
+        for (ulong i = 1; i < store.next_slot(); ++i) {
+            ptr<log_entry> entry(store.entry_at(i));
+            assert(entry_equals(*entry, *logs[(size_t)i - 1]));
+        }
+
+        store.close();
+    }
+
+    cleanup();
+}
+
+void test_log_store_uring() {
+#ifdef __linux__
+    uint seed = (uint)std::chrono::system_clock::now().time_since_epoch().count();
+    std::default_random_engine engine(seed);
+    std::uniform_int_distribution<int32> distribution(1, 10000);
+    std::function<int32()> rnd = std::bind(distribution, engine);
+
+    cleanup();
+    std::vector<ptr<log_entry>> logs;
+    {
+        uring_log_store store(".", 4 * 1024, 16 * 1024);
+        for (int i = 0; i < 500; ++i) {
+            ptr<log_entry> entry(rnd_entry(rnd));
+            store.append(entry);
+            logs.push_back(entry);
+        }
+
+        std::vector<ptr<log_entry>> batch;
+        for (int i = 0; i < 300; ++i) {
+            batch.push_back(rnd_entry(rnd));
+        }
+
+        assert(store.append_async(batch)->get() == logs.size() + batch.size());
+        logs.insert(logs.end(), batch.begin(), batch.end());
+        assert(store.durable_index() == logs.size());
+        assert(count_store_files(".", ".dat") > 1);
+
+        // overwrite in the middle of the segments
+        ulong idx = (ulong)(rnd() % 700 + 50);
+        ptr<log_entry> entry(rnd_entry(rnd));
+        store.write_at(idx, entry);
+        logs.resize((size_t)idx);
+        logs.back() = entry;
+        for (size_t i = 0; i < logs.size(); ++i) {
+            assert(entry_equals(*logs[i], *store.entry_at(i + 1)));
+        }
+
+        store.close();
+    }
+
+    // the files are the same as the ones of fs_log_store
+    {
+        fs_log_store store(".", 4 * 1024, 16 * 1024);
+        assert(store.next_slot() == logs.size() + 1);
+        for (size_t i = 0; i < logs.size(); ++i) {
+            assert(entry_equals(*logs[i], *store.entry_at(i + 1)));
+        }
+
+        ptr<log_entry> entry(rnd_entry(rnd));
+        store.append(entry);
+        logs.push_back(entry);
+        store.close();
+    }
+
+    uring_log_store store1(".", 4 * 1024, 16 * 1024);
+    assert(store1.next_slot() == logs.size() + 1);
+    ptr<std::vector<ptr<log_entry>>> entries(store1.log_entries(1, store1.next_slot()));
+    for (size_t i = 0; i < logs.size(); ++i) {
+        assert(entry_equals(*logs[i], *(*entries)[i]));
+    }
+
+    store1.close();
+    cleanup();
+#endif
+}
+
+void test_log_store_preallocate() {
+    uint seed = (uint)std::chrono::system_clock::now().time_since_epoch().count();
+    std::default_random_engine engine(seed);
+    std::uniform_int_distribution<int32> distribution(1, 10000);
+    std::function<int32()> rnd = std::bind(distribution, engine);
+
+    cleanup();
+    std::vector<ptr<log_entry>> logs;
+    {
+        // the data files are written with direct io
+        fs_log_store store(".", 4 * 1024, 16 * 1024, per_batch_sync, 10, true);
+        for (int i = 0; i < 400; ++i) {
+            ptr<log_entry> entry(rnd_entry(rnd));
+            store.append(entry);
+            logs.push_back(entry);
+        }
+
+        std::vector<ptr<log_entry>> batch;
+        for (int i = 0; i < 200; ++i) {
+            batch.push_back(rnd_entry(rnd));
+        }
+
+        store.append_batch(batch);
+        logs.insert(logs.end(), batch.begin(), batch.end());
+        assert(count_store_files(".", ".dat") > 1);
+
+        // overwrite within a sealed segment, which becomes the tail again
+        ulong idx = (ulong)(rnd() % 500 + 50);
+        ptr<log_entry> entry(rnd_entry(rnd));
+        store.write_at(idx, entry);
+        logs.resize((size_t)idx);
+        logs.back() = entry;
+        for (size_t i = 0; i < logs.size(); ++i) {
+            assert(entry_equals(*logs[i], *store.entry_at(i + 1)));
+        }
+
+        store.close();
+    }
+
+    // the preallocated space that is left by a crash, the data ends at the last record of the tail,
+    // and the offsets end at the first zero offset of the index file
+    {
+        std::vector<std::string> files;
+        list_files(".", files);
+        unsigned long long last_start = 0;
+        for (size_t i = 0; i < files.size(); ++i) {
+            unsigned long long start = 0;
+            if (sscanf(files[i].c_str(), "store.%llu.dat", &start) == 1 && start > last_start) {
+                last_start = start;
+            }
+        }
+
+        std::fstream data_file(sstrfmt("store.%llu.dat").fmt(last_start), std::fstream::binary | std::fstream::in | std::fstream::out | std::fstream::ate);
+        std::vector<char> space(16 * 1024, 0);
+        data_file.write(&space[0], space.size());
+        std::fstream idx_file(sstrfmt("store.%llu.idx").fmt(last_start), std::fstream::binary | std::fstream::in | std::fstream::out | std::fstream::ate);
+        idx_file.write(&space[0], 4 * 1024);
+    }
+
+    {
+        fs_log_store store(".", 4 * 1024, 16 * 1024);
+        assert(store.next_slot() == logs.size() + 1);
+        for (int i = 0; i < 100; ++i) {
+            ptr<log_entry> entry(rnd_entry(rnd));
+            store.append(entry);
+            logs.push_back(entry);
+        }
+
+        ptr<std::vector<ptr<log_entry>>> entries(store.log_entries(1, store.next_slot()));
+        for (size_t i = 0; i < logs.size(); ++i) {
+            assert(entry_equals(*logs[i], *(*entries)[i]));
+        }
+
+        store.close();
+    }
+
+    {
+        fs_log_store store(".", 4 * 1024, 16 * 1024, per_batch_sync, 10, true);
+        assert(store.next_slot() == logs.size() + 1);
+        ptr<log_entry> entry(rnd_entry(rnd));
+        store.append(entry);
+        logs.push_back(entry);
+        store.close();
+    }
+
+#ifdef __linux__
+    uring_log_store store1(".", 4 * 1024, 16 * 1024, per_batch_sync, 10, true);
+#else
+    fs_log_store store1(".", 4 * 1024, 16 * 1024);
+#endif
+    assert(store1.next_slot() == logs.size() + 1);
+    for (int i = 0; i < 50; ++i) {
+        ptr<log_entry> entry(rnd_entry(rnd));
+        store1.append(entry);
+        logs.push_back(entry);
+    }
+
+    for (size_t i = 0; i < logs.size(); ++i) {
+        assert(entry_equals(*logs[i], *store1.entry_at(i + 1)));
+    }
+
+    store1.close();
+    cleanup();
+
+#ifdef __linux__
+    // the space of the segment is allocated ahead of the appends by the background thread, and trimmed as it's closed
+    {
+        fs_log_store store(".", 4 * 1024, 1024 * 1024);
+        ptr<log_entry> entry(rnd_entry(rnd));
+        store.append(entry);
+        for (int i = 0; i < 1000 && store_data_size(".") < 1024 * 1024; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+
+        assert(store_data_size(".") == 1024 * 1024);
+        assert(entry_equals(*entry, *store.entry_at(1)));
+        store.close();
+        assert(store_data_size(".") < 4 * 1024);
+    }
+
+    cleanup();
+#endif
+}
+
+// a codec that keeps half of the data, which is never decompressed, it's for the entries that are only packed
+class half_codec : public log_codec {
+public:
+    half_codec() {}
+
+    __nocopy__(half_codec)
+
+public:
+    virtual byte id() const {
+        return 7;
+    }
+
+    virtual bool compress(const byte* data, size_t len, std::vector<byte>& out) {
+        out.insert(out.end(), data, data + len / 2);
+        return true;
+    }
+
+    virtual bool decompress(const byte*, size_t, byte*, size_t) {
+        return false;
+    }
+};
+
+static ptr<log_entry> text_entry(std::function<int32()>& rnd) {
+    std::string text;
+    int cnt = rnd() % 20 + 1;
+    for (int i = 0; i < cnt; ++i) {
+        text += sstrfmt("{\"key\":\"user.%d\",\"op\":\"put\",\"value\":%d},").fmt(rnd() % 100, rnd());
+    }
+
+    ptr<buffer> buf = buffer::alloc(text.size());
+    ::memcpy(buf->data(), text.data(), text.size());
+    return cs_new<log_entry>(rnd(), buf, log_val_type::app_log);
+}
+
+void test_log_store_codec() {
+    uint seed = (uint)std::chrono::system_clock::now().time_since_epoch().count();
+    std::default_random_engine engine(seed);
+    std::uniform_int_distribution<int32> distribution(1, 10000);
+    std::function<int32()> rnd = std::bind(distribution, engine);
+
+    cleanup();
+    std::vector<ptr<log_entry>> logs;
+    for (int i = 0; i < 600; ++i) {
+        logs.push_back(i % 10 == 0 ? rnd_entry(rnd) : text_entry(rnd));
+    }
+
+    ulong raw_size = 0;
+    {
+        fs_log_store store(".", 4 * 1024, 64 * 1024);
+        store.append_batch(logs);
+        store.close();
+        raw_size = store_data_size(".");
+        cleanup();
+    }
+
+    {
+        fs_log_store store(".", 4 * 1024, 64 * 1024, per_batch_sync, 10, false, cs_new<lz_codec>());
+        for (size_t i = 0; i < 300; ++i) {
+            store.append(logs[i]);
+        }
+
+        std::vector<ptr<log_entry>> batch(logs.begin() + 300, logs.end());
+        store.append_batch(batch);
+        for (size_t i = 0; i < logs.size(); ++i) {
+            assert(entry_equals(*logs[i], *store.entry_at(i + 1)));
+            assert(logs[i]->get_term() == store.term_at(i + 1));
+        }
+
+        store.close();
+        assert(store_data_size(".") * 2 < raw_size);
+    }
+
+    // lz_codec is built in, so the compressed entries are read by a store without a codec, the packs carry them as they are
+    cleanup("tmp");
+    mkdir("tmp", 0x766);
+    {
+        fs_log_store store(".", 4 * 1024, 64 * 1024);
+        assert(store.next_slot() == logs.size() + 1);
+        ptr<std::vector<ptr<log_entry>>> entries(store.log_entries(1, store.next_slot()));
+        for (size_t i = 0; i < logs.size(); ++i) {
+            assert(entry_equals(*logs[i], *(*entries)[i]));
+        }
+
+        fs_log_store store1("tmp", 4 * 1024, 64 * 1024);
+        ptr<buffer> pack(store.pack(1, (int32)logs.size()));
+        store1.apply_pack(1, *pack);
+        assert(store1.next_slot() == logs.size() + 1);
+        for (size_t i = 0; i < logs.size(); ++i) {
+            assert(entry_equals(*logs[i], *store1.entry_at(i + 1)));
+        }
+
+        store1.close();
+        store.close();
+    }
+
+    cleanup("tmp");
+
+    // the entries of a codec that the store doesn't have are rejected
+    {
+        fs_log_store store(".", 4 * 1024, 64 * 1024, per_batch_sync, 10, false, cs_new<half_codec>());
+        ptr<log_entry> entry(text_entry(rnd));
+        store.append(entry);
+        ptr<buffer> pack(store.pack(store.next_slot() - 1, 1));
+        fs_log_store store1("tmp", 4 * 1024, 64 * 1024);
+        bool rejected = false;
+        try {
+            store1.apply_pack(1, *pack);
+        }
+        catch (std::runtime_error&) {
+            rejected = true;
+        }
+
+        assert(rejected);
+        assert(store1.next_slot() == 1);
+        store1.close();
+        store.close();
+    }
+
+    cleanup("tmp");
+    rmdir("tmp");
+    cleanup();
+}
+
+static size_t count_spare_files(const std::string& folder) {
+    std::vector<std::string> files;
+    list_files(folder, files);
+    size_t cnt = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        if (files[i].find("store.spare.") == 0) {
+            cnt += 1;
+        }
+    }
+
+    return cnt;
+}
+
+void test_log_store_mmap() {
+#ifndef _WIN32
+    uint seed = (uint)std::chrono::system_clock::now().time_since_epoch().count();
+    std::default_random_engine engine(seed);
+    std::uniform_int_distribution<int32> distribution(1, 10000);
+    std::function<int32()> rnd = std::bind(distribution, engine);
+
     cleanup();
-}
\ No newline at end of file
+    std::vector<ptr<log_entry>> logs;
+    {
+        mmap_log_store store(".", 16 * 1024);
+        assert(store.last_entry()->get_term() == 0);
+        for (int i = 0; i < 500; ++i) {
+            ptr<log_entry> entry(rnd_entry(rnd));
+            store.append(entry);
+            logs.push_back(entry);
+        }
+
+        std::vector<ptr<log_entry>> batch;
+        for (int i = 0; i < 300; ++i) {
+            batch.push_back(rnd_entry(rnd));
+        }
+
+        assert(store.append_batch(batch) == logs.size() + 1);
+        logs.insert(logs.end(), batch.begin(), batch.end());
+        assert(store.durable_index() == logs.size());
+        assert(count_store_files(".", ".map") > 1);
+
+        // overwrite in the middle of the segments
+        ulong idx = (ulong)(rnd() % 700 + 50);
+        ptr<log_entry> entry(rnd_entry(rnd));
+        store.write_at(idx, entry);
+        logs.resize((size_t)idx);
+        logs.back() = entry;
+
+        // remove the tail
+        store.truncate(logs.size() - 9);
+        logs.resize(logs.size() - 10);
+        assert(store.next_slot() == logs.size() + 1);
+        assert(store.durable_index() == logs.size());
+
+        // an entry that is larger than the segment size
+        ptr<buffer> buf = buffer::alloc(40 * 1024);
+        for (size_t i = 0; i < buf->size(); ++i) {
+            buf->put(static_cast<byte>(rnd() % 256));
+        }
+
+        buf->pos(0);
+        entry = cs_new<log_entry>(rnd(), buf);
+        store.append(entry);
+        logs.push_back(entry);
+        for (size_t i = 0; i < logs.size(); ++i) {
+            assert(entry_equals(*logs[i], *store.entry_at(i + 1)));
+            assert(logs[i]->get_term() == store.term_at(i + 1));
+        }
+
+        store.close();
+    }
+
+    // the entries are found by scanning the segments, the compacted segments are kept as spare files
+    ulong compact_idx = (ulong)(logs.size() / 2);
+    {
+        mmap_log_store store(".", 16 * 1024);
+        assert(store.next_slot() == logs.size() + 1);
+        assert(entry_equals(*logs.back(), *store.last_entry()));
+        ptr<std::vector<ptr<log_entry>>> entries(store.log_entries(1, store.next_slot()));
+        for (size_t i = 0; i < logs.size(); ++i) {
+            assert(entry_equals(*logs[i], *(*entries)[i]));
+        }
+
+        assert(store.compact(compact_idx));
+        assert(store.start_index() == compact_idx + 1);
+        size_t spares = count_spare_files(".");
+        assert(spares > 0);
+
+        // the spare files are taken by the next segments
+        for (int i = 0; i < 300; ++i) {
+            ptr<log_entry> entry(rnd_entry(rnd));
+            store.append(entry);
+            logs.push_back(entry);
+        }
+
+        assert(count_spare_files(".") < spares);
+        store.close();
+    }
+
+    cleanup("tmp");
+    mkdir("tmp", 0x766);
+    {
+        mmap_log_store store(".", 16 * 1024);
+        assert(store.start_index() == compact_idx + 1);
+        assert(store.next_slot() == logs.size() + 1);
+        for (ulong i = compact_idx + 1; i < store.next_slot(); ++i) {
+            assert(entry_equals(*logs[(size_t)i - 1], *store.entry_at(i)));
+        }
+
+        // the packs are the same as the ones of fs_log_store
+        fs_log_store store1("tmp", 4 * 1024, 16 * 1024);
+        ptr<buffer> pack(store.pack(compact_idx + 1, 100));
+        test_corrupt_packs(store, store.next_slot(), *pack);
+        store1.apply_pack(1, *pack);
+        assert(store1.next_slot() == 101);
+        for (ulong i = 1; i < store1.next_slot(); ++i) {
+            assert(entry_equals(*logs[(size_t)(compact_idx + i) - 1], *store1.entry_at(i)));
+        }
+
+        std::vector<ptr<log_entry>> packed(logs.begin() + (size_t)compact_idx, logs.begin() + (size_t)compact_idx + 10);
+        ulong idx = store.next_slot() - 5;
+        pack = store1.pack(1, 10);
+        store.apply_pack(idx, *pack);
+        logs.resize((size_t)idx - 1);
+        logs.insert(logs.end(), packed.begin(), packed.end());
+        assert(store.next_slot() == logs.size() + 1);
+        for (ulong i = compact_idx + 1; i < store.next_slot(); ++i) {
+            assert(entry_equals(*logs[(size_t)i - 1], *store.entry_at(i)));
+        }
+
+        store1.close();
+
+        // compact all entries
+        compact_idx = store.next_slot() - 1;
+        store.compact(compact_idx);
+        assert(store.start_index() == compact_idx + 1);
+        assert(store.next_slot() == compact_idx + 1);
+        ptr<log_entry> entry(rnd_entry(rnd));
+        store.append(entry);
+        logs.push_back(entry);
+        store.close();
+    }
+
+    // with interval_sync, the async appends complete once the background thread syncs them
+    {
+        mmap_log_store store(".", 16 * 1024, interval_sync, 10);
+        std::vector<ptr<log_entry>> batch;
+        for (int i = 0; i < 5; ++i) {
+            batch.push_back(rnd_entry(rnd));
+        }
+
+        ptr<async_result<ulong>> result(store.append_async(batch));
+        logs.insert(logs.end(), batch.begin(), batch.end());
+        assert(result->get() == logs.size());
+        assert(store.durable_index() >= logs.size());
+        store.close();
+    }
+
+    // the entries that are not synced with no_sync are written to disk by the system
+    {
+        mmap_log_store store(".", 16 * 1024, no_sync);
+        assert(store.start_index() == compact_idx + 1);
+        assert(store.next_slot() == logs.size() + 1);
+        assert(entry_equals(*logs.back(), *store.entry_at(store.next_slot() - 1)));
+        ptr<log_entry> entry(rnd_entry(rnd));
+        store.append(entry);
+        logs.push_back(entry);
+        assert(store.durable_index() == logs.size() - 1);
+        store.sync();
+        assert(store.durable_index() == logs.size());
+        store.close();
+    }
+
+    cleanup("tmp");
+    rmdir("tmp");
+    cleanup();
+#endif
+}
@@ -0,0 +1,75 @@
+#include "../cornerstone.hxx"
+#include <cassert>
+#include <cstring>
+
+using namespace cornerstone;
+
+static void check_round_trip(lz_codec& codec, const std::vector<byte>& data, bool compressible) {
+    std::vector<byte> compressed;
+    bool result = codec.compress(data.size() > 0 ? &data[0] : nilptr, data.size(), compressed);
+    assert(result == compressible);
+    if (!result) {
+        return;
+    }
+
+    assert(compressed.size() < data.size());
+    std::vector<byte> decompressed(data.size());
+    assert(codec.decompress(&compressed[0], compressed.size(), &decompressed[0], decompressed.size()));
+    assert(decompressed == data);
+
+    // a broken or truncated input is rejected, never read or written out of the bounds
+    assert(!codec.decompress(&compressed[0], compressed.size(), &decompressed[0], decompressed.size() - 1));
+    for (size_t len = 0; len < compressed.size(); len += compressed.size() / 7 + 1) {
+        codec.decompress(&compressed[0], len, &decompressed[0], decompressed.size());
+    }
+
+    std::vector<byte> broken(compressed);
+    for (size_t i = 0; i < broken.size(); i += 3) {
+        broken[i] = static_cast<byte>(broken[i] * 7 + 1);
+    }
+
+    codec.decompress(&broken[0], broken.size(), &decompressed[0], decompressed.size());
+}
+
+void test_lz_codec() {
+    uint seed = (uint)std::chrono::system_clock::now().time_since_epoch().count();
+    std::default_random_engine engine(seed);
+    std::uniform_int_distribution<int32> distribution(0, 255);
+    std::function<int32()> rnd = std::bind(distribution, engine);
+
+    lz_codec codec;
+    assert(codec.id() == lz_codec::codec_id);
+
+    // too short to compress
+    std::vector<byte> data(8, 'a');
+    check_round_trip(codec, data, false);
+
+    // json like text with repeated keys
+    std::string text;
+    for (int i = 0; i < 200; ++i) {
+        text += sstrfmt("{\"id\":%d,\"name\":\"user%d\",\"tags\":[\"a\",\"b\"],\"active\":true},").fmt(i, rnd());
+    }
+
+    data.assign(text.begin(), text.end());
+    check_round_trip(codec, data, true);
+    std::vector<byte> compressed;
+    codec.compress(&data[0], data.size(), compressed);
+    assert(compressed.size() * 3 < data.size());
+
+    // long runs, the matches overlap the bytes they produce and the lengths take more than one byte
+    data.assign(100000, 'x');
+    for (size_t i = 0; i < 300; ++i) {
+        data.push_back(static_cast<byte>(rnd()));
+    }
+
+    data.insert(data.end(), 70000, 'y');
+    check_round_trip(codec, data, true);
+
+    // random data is not compressible
+    data.clear();
+    for (size_t i = 0; i < 4096; ++i) {
+        data.push_back(static_cast<byte>(rnd()));
+    }
+
+    check_round_trip(codec, data, false);
+}
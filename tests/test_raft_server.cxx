@@ -1,3 +1,755 @@
 #include "../cornerstone.hxx"
-#include <iostream>
+#include <cassert>
+#include <list>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <atomic>
 
+using namespace cornerstone;
+
+#define ELECTION_TIMEOUT 1000
+#define HB_INTERVAL 100
+#define BATCH_WINDOW 7
+
+// the state of a proposal, which is set once its response is back
+enum proposal_state {
+    proposal_pending,
+    proposal_accepted,
+    proposal_rejected
+};
+
+// the timer tasks run when the test fires them, so the test decides when the elections and the heartbeats happen
+class manual_scheduler : public delayed_task_scheduler {
+public:
+    manual_scheduler()
+        : tasks_(), lock_() {}
+
+    __nocopy__(manual_scheduler)
+
+public:
+    virtual void schedule(ptr<delayed_task>& task, int32 milliseconds) __override__ {
+        auto_lock(lock_);
+        task->reset();
+        tasks_.push_back(std::make_pair(task, milliseconds));
+    }
+
+    // runs the tasks that are scheduled with the delay, the tasks scheduled by them wait for the next fire
+    void fire(int32 milliseconds) {
+        std::vector<ptr<delayed_task>> due;
+        {
+            auto_lock(lock_);
+            for (std::list<std::pair<ptr<delayed_task>, int32>>::iterator it = tasks_.begin(); it != tasks_.end();) {
+                if (it->second == milliseconds) {
+                    due.push_back(it->first);
+                    it = tasks_.erase(it);
+                }
+                else {
+                    ++it;
+                }
+            }
+        }
+
+        for (size_t i = 0; i < due.size(); ++i) {
+            due[i]->execute();
+        }
+    }
+
+private:
+    virtual void cancel_impl(ptr<delayed_task>& task) __override__ {
+        auto_lock(lock_);
+        for (std::list<std::pair<ptr<delayed_task>, int32>>::iterator it = tasks_.begin(); it != tasks_.end();) {
+            if (it->first == task) {
+                it = tasks_.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+
+private:
+    std::list<std::pair<ptr<delayed_task>, int32>> tasks_;
+    std::mutex lock_;
+};
+
+// a request that is sent to a peer, it's answered by the test through the handler
+struct sent_req {
+    ptr<req_msg> req;
+    rpc_handler handler;
+};
+
+// the requests are kept per peer in the order they are sent, until the test answers or drops them
+class scripted_rpc_cli_factory : public rpc_client_factory {
+public:
+    class scripted_rpc_client : public rpc_client {
+    public:
+        scripted_rpc_client(scripted_rpc_cli_factory& factory, const std::string& endpoint)
+            : factory_(factory), endpoint_(endpoint) {}
+
+        __nocopy__(scripted_rpc_client)
+
+    public:
+        virtual void send(ptr<req_msg>& req, rpc_handler& when_done) __override__ {
+            sent_req sent;
+            sent.req = req;
+            sent.handler = when_done;
+            auto_lock(factory_.lock_);
+            factory_.sent_[endpoint_].push_back(sent);
+        }
+
+    private:
+        scripted_rpc_cli_factory& factory_;
+        std::string endpoint_;
+    };
+
+public:
+    scripted_rpc_cli_factory()
+        : sent_(), lock_() {}
+
+    __nocopy__(scripted_rpc_cli_factory)
+
+public:
+    virtual ptr<rpc_client> create_client(const std::string& endpoint) __override__ {
+        return cs_new<scripted_rpc_client, scripted_rpc_cli_factory&, const std::string&>(*this, endpoint);
+    }
+
+    size_t pending(const std::string& endpoint) {
+        auto_lock(lock_);
+        return sent_[endpoint].size();
+    }
+
+    sent_req take(const std::string& endpoint) {
+        auto_lock(lock_);
+        std::deque<sent_req>& q = sent_[endpoint];
+        assert(q.size() > 0);
+        sent_req sent = q.front();
+        q.pop_front();
+        return sent;
+    }
+
+    void drop_all() {
+        auto_lock(lock_);
+        sent_.clear();
+    }
+
+private:
+    std::unordered_map<std::string, std::deque<sent_req>> sent_;
+    std::mutex lock_;
+};
+
+// an in memory log store, the appends through append_async could be held and then completed or failed by the test
+class scripted_log_store : public log_store {
+public:
+    scripted_log_store()
+        : entries_(), durable_idx_(0), hold_appends_(false), held_(), async_appends_(0), term_reads_(0), lock_() {
+        entries_.push_back(cs_new<log_entry>(0, buffer::alloc(0)));
+    }
+
+    __nocopy__(scripted_log_store)
+
+public:
+    virtual ulong next_slot() const __override__ {
+        auto_lock(lock_);
+        return entries_.size();
+    }
+
+    virtual ulong start_index() const __override__ {
+        return 1;
+    }
+
+    virtual ptr<log_entry> last_entry() const __override__ {
+        auto_lock(lock_);
+        return entries_.back();
+    }
+
+    virtual ulong append(ptr<log_entry>& entry) __override__ {
+        auto_lock(lock_);
+        entries_.push_back(entry);
+        if (held_.empty()) {
+            durable_idx_ = entries_.size() - 1;
+        }
+
+        return entries_.size() - 1;
+    }
+
+    virtual ulong append_batch(std::vector<ptr<log_entry>>& entries) __override__ {
+        auto_lock(lock_);
+        ulong first_idx = entries_.size();
+        entries_.insert(entries_.end(), entries.begin(), entries.end());
+        if (held_.empty()) {
+            durable_idx_ = entries_.size() - 1;
+        }
+
+        return first_idx;
+    }
+
+    virtual ptr<async_result<ulong>> append_async(std::vector<ptr<log_entry>>& entries) __override__ {
+        ++async_appends_;
+        if (!hold_appends_) {
+            return log_store::append_async(entries);
+        }
+
+        auto_lock(lock_);
+        entries_.insert(entries_.end(), entries.begin(), entries.end());
+        ptr<async_result<ulong>> result(cs_new<async_result<ulong>>());
+        held_.push_back(std::make_pair(result, entries_.size() - 1));
+        return result;
+    }
+
+    virtual void write_at(ulong index, ptr<log_entry>& entry) __override__ {
+        auto_lock(lock_);
+        entries_.resize(index);
+        entries_.push_back(entry);
+        durable_idx_ = std::min(durable_idx_, index - 1);
+    }
+
+    virtual void truncate(ulong index) __override__ {
+        auto_lock(lock_);
+        entries_.resize(index);
+        durable_idx_ = std::min(durable_idx_, index - 1);
+    }
+
+    virtual ptr<std::vector<ptr<log_entry>>> log_entries(ulong start, ulong end) __override__ {
+        auto_lock(lock_);
+        if (start >= end || start >= entries_.size()) {
+            return ptr<std::vector<ptr<log_entry>>>();
+        }
+
+        ptr<std::vector<ptr<log_entry>>> v(cs_new<std::vector<ptr<log_entry>>>());
+        for (ulong i = start; i < end && i < entries_.size(); ++i) {
+            v->push_back(entries_[i]);
+        }
+
+        return v;
+    }
+
+    virtual ptr<log_entry> entry_at(ulong index) __override__ {
+        auto_lock(lock_);
+        return index < entries_.size() ? entries_[index] : ptr<log_entry>();
+    }
+
+    virtual ulong term_at(ulong index) __override__ {
+        ++term_reads_;
+        auto_lock(lock_);
+        return index < entries_.size() ? entries_[index]->get_term() : 0;
+    }
+
+    virtual ptr<buffer> pack(ulong index, int32 cnt) __override__ {
+        return ptr<buffer>();
+    }
+
+    virtual void apply_pack(ulong index, buffer& pack) __override__ {}
+
+    virtual bool compact(ulong last_log_index) __override__ {
+        return false;
+    }
+
+    virtual ulong durable_index() const __override__ {
+        auto_lock(lock_);
+        return durable_idx_;
+    }
+
+public:
+    void hold_appends(bool hold) {
+        hold_appends_ = hold;
+    }
+
+    // the held appends are durable now, their results are set in the order they are appended
+    void complete_appends() {
+        std::vector<std::pair<ptr<async_result<ulong>>, ulong>> held;
+        {
+            auto_lock(lock_);
+            held.swap(held_);
+            durable_idx_ = entries_.size() - 1;
+        }
+
+        for (size_t i = 0; i < held.size(); ++i) {
+            ptr<std::exception> no_err;
+            held[i].first->set_result(held[i].second, no_err);
+        }
+    }
+
+    void fail_appends() {
+        std::vector<std::pair<ptr<async_result<ulong>>, ulong>> held;
+        {
+            auto_lock(lock_);
+            held.swap(held_);
+            entries_.resize(durable_idx_ + 1);
+        }
+
+        for (size_t i = 0; i < held.size(); ++i) {
+            ulong no_idx(0);
+            ptr<std::exception> err(cs_new<std::runtime_error>("disk failure"));
+            held[i].first->set_result(no_idx, err);
+        }
+    }
+
+    int32 async_appends() const {
+        return async_appends_;
+    }
+
+    int32 term_reads() const {
+        return term_reads_;
+    }
+
+private:
+    std::vector<ptr<log_entry>> entries_;
+    ulong durable_idx_;
+    std::atomic<bool> hold_appends_;
+    std::vector<std::pair<ptr<async_result<ulong>>, ulong>> held_;
+    std::atomic<int32> async_appends_;
+    std::atomic<int32> term_reads_;
+    mutable std::mutex lock_;
+};
+
+class scripted_state_mgr : public state_mgr {
+public:
+    scripted_state_mgr(int32 srv_id, int32 srv_count, ptr<log_store> store, ulong term = 0)
+        : srv_id_(srv_id), srv_count_(srv_count), store_(store), term_(term) {}
+
+    __nocopy__(scripted_state_mgr)
+
+public:
+    virtual ptr<cluster_config> load_config() __override__ {
+        ptr<cluster_config> conf(cs_new<cluster_config>());
+        for (int32 i = 1; i <= srv_count_; ++i) {
+            conf->get_servers().push_back(cs_new<srv_config>(i, sstrfmt("peer%d").fmt(i)));
+        }
+
+        return conf;
+    }
+
+    virtual void save_config(const cluster_config& config) __override__ {}
+    virtual void save_state(const srv_state& state) __override__ {}
+    virtual ptr<srv_state> read_state() __override__ {
+        ptr<srv_state> state(cs_new<srv_state>());
+        state->set_term(term_);
+        state->set_voted_for(-1);
+        return state;
+    }
+
+    virtual ptr<log_store> load_log_store() __override__ {
+        return store_;
+    }
+
+    virtual int32 server_id() __override__ {
+        return srv_id_;
+    }
+
+    virtual void system_exit(const int exit_code) __override__ {
+        assert(false);
+    }
+
+private:
+    int32 srv_id_;
+    int32 srv_count_;
+    ptr<log_store> store_;
+    ulong term_;
+};
+
+class counting_state_machine : public state_machine {
+public:
+    counting_state_machine()
+        : committed_(0) {}
+
+    __nocopy__(counting_state_machine)
+
+public:
+    virtual void commit(const ulong log_idx, buffer& data) __override__ {
+        committed_ = log_idx;
+    }
+
+    virtual void pre_commit(const ulong log_idx, buffer& data) __override__ {}
+    virtual void rollback(const ulong log_idx, buffer& data) __override__ {}
+    virtual void save_snapshot_data(snapshot& s, const ulong offset, buffer& data) __override__ {}
+    virtual bool apply_snapshot(snapshot& s) __override__ {
+        return false;
+    }
+
+    virtual int read_snapshot_data(snapshot& s, const ulong offset, buffer& data) __override__ {
+        return 0;
+    }
+
+    virtual ptr<snapshot> last_snapshot() __override__ {
+        return ptr<snapshot>();
+    }
+
+    virtual void create_snapshot(snapshot& s, async_result<bool>::handler_type& when_done) __override__ {}
+
+    ulong committed() const {
+        return committed_;
+    }
+
+private:
+    std::atomic<ulong> committed_;
+};
+
+class silent_logger : public logger {
+public:
+    virtual void debug(const std::string& log_line) __override__ {}
+    virtual void info(const std::string& log_line) __override__ {}
+    virtual void warn(const std::string& log_line) __override__ {}
+    virtual void err(const std::string& log_line) __override__ {}
+};
+
+class idle_rpc_listener : public rpc_listener {
+public:
+    virtual void listen(ptr<msg_handler>& handler) __override__ {}
+    virtual void stop() __override__ {}
+};
+
+// one server of the cluster, whose timers and peers are driven by the test
+struct scripted_server {
+    scripted_server(int32 srv_id, int32 srv_count, raft_params* params, ulong term = 0)
+        : store(cs_new<scripted_log_store>()), smgr(srv_id, srv_count, store, term), sm(), l(), listener(), rpc(), scheduler(), server() {
+        params->with_election_timeout_lower(ELECTION_TIMEOUT)
+            .with_election_timeout_upper(ELECTION_TIMEOUT)
+            .with_hb_interval(HB_INTERVAL)
+            .with_rpc_failure_backoff(0);
+        server = cs_new<raft_server>(new context(smgr, sm, listener, l, rpc, scheduler, params));
+    }
+
+    ~scripted_server() {
+        rpc.drop_all();
+        server.reset();
+    }
+
+    ptr<scripted_log_store> store;
+    scripted_state_mgr smgr;
+    counting_state_machine sm;
+    silent_logger l;
+    idle_rpc_listener listener;
+    scripted_rpc_cli_factory rpc;
+    manual_scheduler scheduler;
+    ptr<raft_server> server;
+};
+
+static std::string endpoint_of(int32 srv_id) {
+    return sstrfmt("peer%d").fmt(srv_id);
+}
+
+// the event loop runs the tasks in order, so the tasks posted before this request are done once it's answered,
+// a vote request of term 0 is never granted once the first election is started
+static void settle(scripted_server& s) {
+    req_msg req(0, msg_type::request_vote_request, 0, 1, 0, 0, 0);
+    s.server->process_req(req);
+}
+
+// answers the request in the term of the request, unless a term is given
+static void reply(sent_req& sent, bool accepted, ulong next_idx, ulong term = 0) {
+    msg_type type = sent.req->get_type() == msg_type::request_vote_request ? msg_type::request_vote_response : msg_type::append_entries_response;
+    ptr<resp_msg> resp(cs_new<resp_msg>(term > 0 ? term : sent.req->get_term(), type, sent.req->get_dst(), sent.req->get_src(), next_idx));
+    if (accepted) {
+        resp->accept(next_idx);
+    }
+
+    ptr<rpc_exception> no_err;
+    sent.handler(resp, no_err);
+}
+
+static void fail(sent_req& sent) {
+    ptr<resp_msg> no_resp;
+    ptr<rpc_exception> err(cs_new<rpc_exception>("connection lost", sent.req));
+    sent.handler(no_resp, err);
+}
+
+// the last index of the entries that are sent by the request
+static ulong last_sent_idx(sent_req& sent) {
+    return sent.req->get_last_log_idx() + sent.req->log_entries().size();
+}
+
+// starts an election on server 1 and gets the vote of server 2
+static void elect(scripted_server& s) {
+    s.scheduler.fire(ELECTION_TIMEOUT);
+    settle(s);
+    sent_req vote = s.rpc.take(endpoint_of(2));
+    reply(vote, true, 0);
+    settle(s);
+
+    // server 3 never votes, its vote request is sent before the appendEntries request
+    sent_req no_vote = s.rpc.take(endpoint_of(3));
+    assert(msg_type::request_vote_request == no_vote.req->get_type());
+}
+
+// answers the requests to the peer as accepted until no more is sent
+static void accept_all(scripted_server& s, int32 peer_id) {
+    while (s.rpc.pending(endpoint_of(peer_id)) > 0) {
+        sent_req sent = s.rpc.take(endpoint_of(peer_id));
+        reply(sent, true, last_sent_idx(sent) + 1);
+        settle(s);
+    }
+}
+
+// the state machine is committed by the commit thread
+static bool wait_for_commit(scripted_server& s, ulong idx) {
+    for (int32 i = 0; i < 500 && s.sm.committed() < idx; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    return s.sm.committed() >= idx;
+}
+
+static ptr<std::atomic<int32>> propose(scripted_server& s, int32 entries, size_t entry_size = 8) {
+    ptr<req_msg> req(cs_new<req_msg>(0, msg_type::client_request, 0, 1, 0, 0, 0));
+    for (int32 i = 0; i < entries; ++i) {
+        ptr<buffer> buf(buffer::alloc(entry_size));
+        req->log_entries().push_back(cs_new<log_entry>(0, buf));
+    }
+
+    ptr<std::atomic<int32>> state(cs_new<std::atomic<int32>>((int32)proposal_pending));
+    async_result<ptr<resp_msg>>::handler_type handler = [state](ptr<resp_msg>& resp, ptr<std::exception>& err) -> void {
+        *state = !err && resp->get_accepted() ? proposal_accepted : proposal_rejected;
+    };
+    s.server->process_req_async(req)->when_ready(handler);
+    return state;
+}
+
+void test_raft_server_pipeline() {
+    raft_params* params(new raft_params());
+    params->with_max_append_size(1).with_max_inflight_appends(4);
+    scripted_server s(1, 3, params);
+    elect(s);
+
+    // the first request goes alone, the config entry at 1 is sent once the vote is won
+    std::string peer2(endpoint_of(2));
+    assert(1 == s.rpc.pending(peer2));
+    sent_req first = s.rpc.take(peer2);
+    assert(0 == first.req->get_last_log_idx() && 1 == last_sent_idx(first));
+    reply(first, true, 2);
+    settle(s);
+
+    // once the peer accepts, the requests are pipelined up to the in-flight limit, one entry each
+    propose(s, 6);
+    settle(s);
+    assert(4 == s.rpc.pending(peer2));
+    std::vector<sent_req> inflight;
+    while (s.rpc.pending(peer2) > 0) {
+        inflight.push_back(s.rpc.take(peer2));
+    }
+
+    // the entries of the pipelined requests follow one another
+    ulong last_idx = inflight[0].req->get_last_log_idx();
+    for (size_t i = 0; i < inflight.size(); ++i) {
+        assert(last_idx == inflight[i].req->get_last_log_idx());
+        last_idx = last_sent_idx(inflight[i]);
+    }
+
+    // a request is sent for each accepted one, the limit still holds
+    sent_req accepted = inflight.front();
+    inflight.erase(inflight.begin());
+    reply(accepted, true, last_sent_idx(accepted) + 1);
+    settle(s);
+    assert(1 == s.rpc.pending(peer2));
+    inflight.push_back(s.rpc.take(peer2));
+    assert(last_idx == inflight.back().req->get_last_log_idx());
+    ulong matched = last_sent_idx(accepted);
+
+    // a rejection rolls the peer back to the last matched entry, no request is sent while the others are in flight
+    sent_req rejected = inflight.front();
+    inflight.erase(inflight.begin());
+    reply(rejected, false, 2);
+    settle(s);
+    assert(0 == s.rpc.pending(peer2));
+
+    // the responses of the requests sent before the rollback are dropped, even a rejection that would move it back
+    // again, the peer is probed from the last matched entry once they are all back
+    for (size_t i = 0; i < inflight.size(); ++i) {
+        if (i == 0) {
+            fail(inflight[i]);
+        }
+        else {
+            reply(inflight[i], false, 1);
+        }
+
+        settle(s);
+        assert((i + 1 < inflight.size() ? 0 : 1) == s.rpc.pending(peer2));
+    }
+
+    sent_req probe = s.rpc.take(peer2);
+    assert(matched == probe.req->get_last_log_idx() && 1 == probe.req->log_entries().size());
+
+    // the accepted probe starts the pipeline again
+    reply(probe, true, last_sent_idx(probe) + 1);
+    settle(s);
+    assert(s.rpc.pending(peer2) > 1 && s.rpc.pending(peer2) <= 4);
+
+    // a failed request rolls the pipeline back as well, the requests after it are stale
+    inflight.clear();
+    while (s.rpc.pending(peer2) > 0) {
+        inflight.push_back(s.rpc.take(peer2));
+    }
+
+    matched = last_sent_idx(probe);
+    fail(inflight[0]);
+    settle(s);
+    for (size_t i = 1; i < inflight.size(); ++i) {
+        reply(inflight[i], true, last_sent_idx(inflight[i]) + 1);
+        settle(s);
+    }
+
+    assert(1 == s.rpc.pending(peer2));
+    probe = s.rpc.take(peer2);
+    assert(matched == probe.req->get_last_log_idx());
+}
+
+void test_raft_server_reelection() {
+    scripted_server s(1, 3, new raft_params());
+    elect(s);
+    std::string peer2(endpoint_of(2));
+    std::string peer3(endpoint_of(3));
+    sent_req old = s.rpc.take(peer2);
+
+    // server 3 has a higher term, this server steps down and then wins the next election
+    sent_req to3 = s.rpc.take(peer3);
+    reply(to3, false, 0, to3.req->get_term() + 1);
+    settle(s);
+    s.scheduler.fire(ELECTION_TIMEOUT);
+    settle(s);
+    sent_req vote = s.rpc.take(peer2);
+    assert(msg_type::request_vote_request == vote.req->get_type());
+    reply(vote, true, 0);
+    settle(s);
+    assert(1 == s.rpc.pending(peer2));
+
+    // the request of the earlier term comes back, it doesn't free the slot of the request of this term,
+    // so there is still one request in flight only
+    reply(old, true, 2);
+    settle(s);
+    propose(s, 1);
+    settle(s);
+    assert(1 == s.rpc.pending(peer2));
+}
+
+void test_raft_server_batching() {
+    raft_params* params(new raft_params());
+    params->with_proposal_batch_window(BATCH_WINDOW).with_proposal_batch_size(20);
+    scripted_server s(1, 3, params);
+    elect(s);
+
+    // the proposals wait for the window, they are appended as one batch once it's over
+    ptr<std::atomic<int32>> p1 = propose(s, 1);
+    ptr<std::atomic<int32>> p2 = propose(s, 1);
+    settle(s);
+    assert(2 == s.store->next_slot() && 0 == s.store->async_appends());
+    assert(proposal_pending == *p1 && proposal_pending == *p2);
+    s.scheduler.fire(BATCH_WINDOW);
+    settle(s);
+    assert(4 == s.store->next_slot() && 1 == s.store->async_appends());
+    assert(proposal_accepted == *p1 && proposal_accepted == *p2);
+
+    // the batch is appended before the window is over once it's big enough, the window is cancelled
+    ptr<std::atomic<int32>> p3 = propose(s, 1);
+    settle(s);
+    assert(4 == s.store->next_slot() && proposal_pending == *p3);
+    ptr<std::atomic<int32>> p4 = propose(s, 2);
+    settle(s);
+    assert(7 == s.store->next_slot() && 2 == s.store->async_appends());
+    assert(proposal_accepted == *p3 && proposal_accepted == *p4);
+    s.scheduler.fire(BATCH_WINDOW);
+    settle(s);
+    assert(2 == s.store->async_appends());
+
+    // the proposals that are waiting fail once the leader steps down, nothing is appended for them
+    ptr<std::atomic<int32>> p5 = propose(s, 1);
+    settle(s);
+    assert(proposal_pending == *p5);
+    sent_req stale = s.rpc.take(endpoint_of(3));
+    reply(stale, false, 0, stale.req->get_term() + 1);
+    settle(s);
+    assert(proposal_rejected == *p5);
+    assert(7 == s.store->next_slot() && 2 == s.store->async_appends());
+
+    // a follower rejects the proposals
+    ptr<std::atomic<int32>> p6 = propose(s, 1);
+    settle(s);
+    assert(proposal_rejected == *p6);
+}
+
+void test_raft_server_durable_commit() {
+    raft_params* params(new raft_params());
+    scripted_server s(1, 3, params);
+    elect(s);
+    s.store->hold_appends(true);
+
+    // a peer has the entries while the leader is still writing them, it's not a quorum yet
+    ptr<std::atomic<int32>> p1 = propose(s, 2);
+    settle(s);
+    accept_all(s, 2);
+    assert(4 == s.store->next_slot() && 1 == s.store->durable_index());
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    assert(0 == s.sm.committed() && proposal_pending == *p1);
+
+    // the leader counts for the quorum once its entries are durable
+    s.store->complete_appends();
+    settle(s);
+    assert(wait_for_commit(s, 3));
+    assert(proposal_accepted == *p1);
+
+    // the entries that fail to be durable on the leader are not committed by it, the proposal is rejected
+    ptr<std::atomic<int32>> p2 = propose(s, 1);
+    settle(s);
+    accept_all(s, 2);
+    s.store->fail_appends();
+    settle(s);
+    assert(proposal_rejected == *p2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    assert(3 == s.sm.committed());
+}
+
+static void append_terms(scripted_log_store& store, ulong term, int32 cnt) {
+    for (int32 i = 0; i < cnt; ++i) {
+        ptr<log_entry> entry(cs_new<log_entry>(term, buffer::alloc(8)));
+        store.append(entry);
+    }
+}
+
+static bool same_log(scripted_log_store& store1, scripted_log_store& store2) {
+    if (store1.next_slot() != store2.next_slot()) {
+        return false;
+    }
+
+    for (ulong i = 1; i < store1.next_slot(); ++i) {
+        if (store1.entry_at(i)->get_term() != store2.entry_at(i)->get_term()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void test_raft_server_conflict() {
+    raft_params* params(new raft_params());
+    params->with_max_append_size(1000);
+    scripted_server leader(1, 3, params, 4);
+    scripted_server follower(2, 3, new raft_params(), 3);
+
+    // the follower has diverged from the leader after the entries of term 1, with long runs of other terms
+    append_terms(*leader.store, 1, 5);
+    append_terms(*leader.store, 4, 200);
+    append_terms(*follower.store, 1, 5);
+    append_terms(*follower.store, 2, 500);
+    append_terms(*follower.store, 3, 500);
+    elect(leader);
+
+    // the requests of the leader are relayed to the follower until the logs match
+    int32 round_trips = 0;
+    int32 leader_reads = leader.store->term_reads();
+    int32 follower_reads = follower.store->term_reads();
+    while (!same_log(*leader.store, *follower.store)) {
+        assert(round_trips < 10 && leader.rpc.pending(endpoint_of(2)) > 0);
+        sent_req sent = leader.rpc.take(endpoint_of(2));
+        ptr<resp_msg> resp(follower.server->process_req(*sent.req));
+        ptr<rpc_exception> no_err;
+        sent.handler(resp, no_err);
+        settle(leader);
+        ++round_trips;
+    }
+
+    // one round trip finds the conflict and the next one sends the entries, the runs are skipped a term at a time
+    // on both sides instead of being walked an entry at a time
+    assert(2 == round_trips);
+    assert(leader.store->term_reads() - leader_reads < 64);
+    assert(follower.store->term_reads() - follower_reads < 64);
+}
@@ -10,22 +10,45 @@
 __decl_test__(async_result);
 __decl_test__(strfmt);
 __decl_test__(buffer);
+__decl_test__(crc32c);
+__decl_test__(lz_codec);
+__decl_test__(commit_tracker);
+__decl_test__(event_loop);
 __decl_test__(serialization);
 __decl_test__(scheduler);
 __decl_test__(logger);
 __decl_test__(log_store);
 __decl_test__(raft_server);
+__decl_test__(raft_server_pipeline);
+__decl_test__(raft_server_reelection);
+__decl_test__(raft_server_batching);
+__decl_test__(raft_server_durable_commit);
+__decl_test__(raft_server_conflict);
 __decl_test__(log_store);
 __decl_test__(ptr);
 __decl_test__(log_store_buffer);
 __decl_test__(log_store_pack);
 __decl_test__(log_store_compact_all);
 __decl_test__(log_store_compact_random);
+__decl_test__(log_store_segments);
+__decl_test__(log_store_durability);
+__decl_test__(log_store_append_batch);
+__decl_test__(log_store_concurrent_reads);
+__decl_test__(log_store_term_runs);
+__decl_test__(log_store_recovery);
+__decl_test__(log_store_uring);
+__decl_test__(log_store_preallocate);
+__decl_test__(log_store_codec);
+__decl_test__(log_store_mmap);
 
 int main() {
     __run_test__(async_result);
     __run_test__(strfmt);
     __run_test__(buffer);
+    __run_test__(crc32c);
+    __run_test__(lz_codec);
+    __run_test__(commit_tracker);
+    __run_test__(event_loop);
     __run_test__(serialization);
     __run_test__(scheduler);
     __run_test__(logger);
@@ -34,7 +57,22 @@ int main() {
     __run_test__(log_store_pack);
     __run_test__(log_store_compact_all);
     __run_test__(log_store_compact_random);
+    __run_test__(log_store_segments);
+    __run_test__(log_store_durability);
+    __run_test__(log_store_append_batch);
+    __run_test__(log_store_concurrent_reads);
+    __run_test__(log_store_term_runs);
+    __run_test__(log_store_recovery);
+    __run_test__(log_store_uring);
+    __run_test__(log_store_preallocate);
+    __run_test__(log_store_codec);
+    __run_test__(log_store_mmap);
     __run_test__(ptr);
+    __run_test__(raft_server_pipeline);
+    __run_test__(raft_server_reelection);
+    __run_test__(raft_server_batching);
+    __run_test__(raft_server_durable_commit);
+    __run_test__(raft_server_conflict);
     __run_test__(raft_server);
     return 0;
-}
\ No newline at end of file
+}
\ No newline at end of file
@@ -0,0 +1,7 @@
+#include "cornerstone.hxx"
+
+using namespace cornerstone;
+
+uring_log_store::uring_log_store(const std::string& log_folder, ulong cache_size, ulong segment_size, durability_policy durability, int32 sync_interval, bool direct_io, ptr<log_codec> codec)
+    : fs_log_store(log_folder, cache_size, segment_size, durability, sync_interval, direct_io, codec, true) {
+}
@@ -0,0 +1,20 @@
+#ifndef _URING_LOG_STORE_HXX_
+#define _URING_LOG_STORE_HXX_
+
+namespace cornerstone {
+    /**
+    * The file system based log store that writes and syncs the segment files through io_uring, see fs_log_store,
+    * a group of staged entries is written by one submission of the index and data writes, and the two files of
+    * a segment are synced by one submission, the written entries are read through the mapped segment files,
+    * it has the same files as fs_log_store, so a store could be opened by either of them, it's for Linux only,
+    * the constructor throws std::runtime_error if io_uring is not supported by the system
+    */
+    class uring_log_store : public fs_log_store {
+    public:
+        uring_log_store(const std::string& log_folder, ulong cache_size = default_cache_size, ulong segment_size = default_segment_size, durability_policy durability = per_batch_sync, int32 sync_interval = 10, bool direct_io = false, ptr<log_codec> codec = ptr<log_codec>());
+
+        __nocopy__(uring_log_store)
+    };
+}
+
+#endif //_URING_LOG_STORE_HXX_